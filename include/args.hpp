@@ -3,6 +3,11 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
+#include <filesystem>
+#include <sstream>
+#include <cstdio>
+#include "macros.hpp"
 #include "status.hpp"
 #include "third_party/argh/argh.hpp"
 #include "utils.hpp"
@@ -53,7 +58,9 @@ public:
         parser.add_params({
             "-o", "--output",
             "-u", "--sampling_time",
-            "-t", "--max_time"
+            "-t", "--max_time",
+            "--metrics-textfile",
+            "--history"
         });        
     }
 
@@ -91,6 +98,16 @@ public:
             force = true;
         }
 
+        if(parser["--consolidate"]) {
+            consolidate = true;
+        }
+
+        parser("--metrics-textfile", metrics_textfile) >> metrics_textfile;
+
+        // Finished steps are only archived on request
+        const char *history_env = std::getenv("JOBREPORT_HISTORY");
+        parser("--history", history_env != nullptr ? history_env : "") >> history;
+
         // This is required for the main command
         if(cmd.empty()) {
             return Status::MissingNonArguments;
@@ -102,6 +119,12 @@ public:
             return Status::InvalidValue;
         }
 
+        if (!metrics_textfile.empty() && !std::filesystem::is_directory(metrics_textfile)) {
+            std::cout << "Invalid value for --metrics-textfile" << std::endl
+                      << "Expected a directory, got: \"" << metrics_textfile << "\"" << std::endl;
+            return Status::InvalidValue;
+        }
+
         return Status::Success;
     }
 
@@ -122,9 +145,44 @@ public:
             << "    -u, --sampling_time <seconds>   Set the time between samples (default: automatically determined)" << std::endl
             << "    -t, --max_time <time>           Set the maximum monitoring time (format: DD-HH:MM:SS, default: determined by SLURM)" << std::endl
             << "    --ignore-gpu-binding            Ignore SLURM task to GPU binding flags like --gpus-per-task" << std::endl
+            << "    --consolidate                   Write one file per node and step instead of one per task" << std::endl
+            << "    --metrics-textfile <dir>        Write live GPU metrics for the node_exporter textfile collector to <dir>" << std::endl
+            << "    --history <dir>                 Append each finished step to the history store <dir> (default: $JOBREPORT_HISTORY)" << std::endl
             << "  print                             Print a job report" << std::endl
             << "    -h, --help                      Shows help message" << std::endl
             << "    -o, --output <path>             Output path for the report file (default: ./)" << std::endl
+            << "    -r, --resolution <seconds>      Time resolution of the power timeline (default: automatic)" << std::endl
+            << "    -m, --heatmap <metric>          Node x GPU heatmap of sm, membw, power or memory" << std::endl
+            << "    -s, --sort-by <column>[:desc]   Order the per-GPU table by a column" << std::endl
+            << "    -w, --where <filters>           Only show the GPUs matching <column><op><value>[,...]" << std::endl
+            << "    -n, --top <N>                   Only show the first N GPUs" << std::endl
+            << "    --profile                       Show the time and resources of each stage of print" << std::endl
+            << "  export                            Export job reports in a machine-readable format" << std::endl
+            << "    -h, --help                      Shows help message" << std::endl
+            << "    -f, --format <format>           ndjson, json or csv (default: ndjson)" << std::endl
+            << "    -o, --output <path>             Output file (default: stdout)" << std::endl
+            << "  archive                           Append job reports to the history store" << std::endl
+            << "    -h, --help                      Shows help message" << std::endl
+            << "    -d, --store <path>              History store directory (default: $JOBREPORT_HISTORY)" << std::endl
+            << "  query                             Aggregate the steps of the history store" << std::endl
+            << "    -h, --help                      Shows help message" << std::endl
+            << "    -d, --store <path>              History store directory (default: $JOBREPORT_HISTORY)" << std::endl
+            << "    -w, --where <filters>           Only aggregate the steps matching <column><op><value>[,...]" << std::endl
+            << "    -g, --group-by <group>          Aggregate by user, account, job, month or day" << std::endl
+            << "    --since, --until <time>         Bounds of the step start time" << std::endl
+            << "  status [<job id> | <directory>]   Show the live statistics of the running jobs of this node" << std::endl
+            << "    -h, --help                      Shows help message" << std::endl
+            << "  watch                             Follow a running job" << std::endl
+            << "    -h, --help                      Shows help message" << std::endl
+            << "    -r, --refresh <seconds>         Refresh period of the view (default: 2)" << std::endl
+            << "  diff                              Compare the steps of two job reports" << std::endl
+            << "    -h, --help                      Shows help message" << std::endl
+            << "    -o, --output <path>             Output file (default: stdout)" << std::endl
+            << "  synth                             Write a synthetic job report, without GPUs" << std::endl
+            << "    -h, --help                      Shows help message" << std::endl
+            << "    -o, --output <dir>              Job directory (default: jobreport_<job id>)" << std::endl
+            << "    -n, -g, -r, -s <n>              Nodes, GPUs per node, ranks per node and steps" << std::endl
+            << "    --timeseries                    Also write the time series of each rank" << std::endl
             << "  container-hook                    Write enroot hook for jobreport" << std::endl
             << "    -h, --help                      Shows help message" << std::endl
             << "    -o, --output <path>             Output path for the enroot hook file" << std::endl
@@ -153,6 +211,9 @@ public:
     std::string max_time = "";            // -t, --max_time
     std::string cmd = "";                 // Non-arguments to run as a workload command
     bool ignore_gpu_binding = false;      // --ignore-gpu-binding
+    bool consolidate = false;             // --consolidate
+    std::string metrics_textfile = "";    // --metrics-textfile
+    std::string history = "";             // --history
 
 private:
     argh::parser parser;
@@ -167,7 +228,13 @@ public:
     PrintCmdArgs() {
         // Preregister the optional arguments which accept values
         parser.add_params({
-            "-o", "--output"
+            "-o", "--output",
+            "-r", "--resolution",
+            "-m", "--heatmap",
+            "-s", "--sort-by",
+            "-w", "--where",
+            "-n", "--top",
+            "--profile-trace"
         });
     }
 
@@ -180,30 +247,446 @@ public:
         }
 
         parser({"-o", "--output"}, output) >> output;
+        parser({"-r", "--resolution"}, resolution) >> resolution;
+        parser({"-m", "--heatmap"}) >> heatmap;
+        parser({"-s", "--sort-by"}) >> sort_by;
+        parser({"-w", "--where"}) >> where;
+        parser({"-n", "--top"}, top) >> top;
+        parser({"--profile-trace"}) >> profile_trace;
+        profile = parser[{"--profile"}];
         parser(2) >> input;
 
         if (input.empty()) {
             return Status::MissingArgument;
         }
 
+        if (resolution < 0) {
+            std::cout << "Invalid value for -r, --resolution" << std::endl
+                      << "Expected a positive value, got: \"" << resolution << "\"" << std::endl;
+            return Status::InvalidValue;
+        }
+
+        if (!heatmap.empty() && heatmap != "sm" && heatmap != "membw" && heatmap != "power" && heatmap != "memory") {
+            std::cout << "Invalid value for -m, --heatmap" << std::endl
+                      << "Expected one of sm, membw, power, memory, got: \"" << heatmap << "\"" << std::endl;
+            return Status::InvalidValue;
+        }
+
+        if (top < 0) {
+            std::cout << "Invalid value for -n, --top" << std::endl
+                      << "Expected a positive value, got: \"" << top << "\"" << std::endl;
+            return Status::InvalidValue;
+        }
+
         return Status::Success;
     }
 
     void help() {
         std::cout 
-            << "Usage: jobreport print [-h -o <path>] <directory>" << std::endl
+            << "Usage: jobreport print [-h -o <path> -r <seconds> -m <metric> -s <column>[:desc] -w <filters> -n <N>] <directory>" << std::endl
             << std::endl
             << "Options:" << std::endl
             << "  -h, --help                     Show this help message" << std::endl
             << "  -o, --output <path>            Output path for the report file (default: None)" << std::endl
+            << "  -r, --resolution <seconds>     Time resolution of the power timeline (default: automatic)" << std::endl
+            << "  -m, --heatmap <metric>         Show a node x GPU heatmap of sm, membw, power or memory" << std::endl
+            << "                                 instead of the per-GPU table" << std::endl
+            << "  -s, --sort-by <column>[:desc]  Order the per-GPU table by a column" << std::endl
+            << "  -w, --where <filters>          Only show the GPUs matching <column><op><value>, with op one of" << std::endl
+            << "                                 < <= > >= == !=; several filters are separated by commas" << std::endl
+            << "                                 Columns: host, gpu, sm, membw, power, memory, energy, elapsed," << std::endl
+            << "                                 or any column name of the CSV files" << std::endl
+            << "  -n, --top <N>                  Only show the first N GPUs" << std::endl
+            << "  --profile                      Show the time and resources of each stage of print" << std::endl
+            << "  --profile-trace <path>         Write them as Chrome trace events (chrome://tracing)" << std::endl
             << std::endl
             << "Example:" << std::endl
             << "  jobreport print jobreport_1234" << std::endl
-            << "  jobreport print -o report.txt jobreport_1234" << std::endl;
+            << "  jobreport print -o report.txt jobreport_1234" << std::endl
+            << "  jobreport print -m sm jobreport_1234" << std::endl
+            << "  jobreport print -s sm -n 10 jobreport_1234" << std::endl
+            << "  jobreport print -w \"power>300,memory>=40G\" jobreport_1234" << std::endl;
     }
 
     std::string input = ""; 
     std::string output = "";
+    double resolution = 0;                // -r, --resolution
+    std::string heatmap = "";             // -m, --heatmap
+    std::string sort_by = "";             // -s, --sort-by
+    std::string where = "";               // -w, --where
+    long long top = 0;                    // -n, --top
+    bool profile = false;                 // --profile
+    std::string profile_trace = "";       // --profile-trace
+
+private:
+    argh::parser parser;
+};
+
+/*
+jobreport archive: Append job reports to the history store
+    -d, --store: History store directory (default: $JOBREPORT_HISTORY)
+    [directories]: Job or step directories
+*/
+class ArchiveCmdArgs {
+public:
+    ArchiveCmdArgs() {
+        // Preregister the optional arguments which accept values
+        parser.add_params({
+            "-d", "--store"
+        });
+    }
+
+    Status parse(int argc, char** argv) {
+        parser.parse(argc, argv);
+
+        // Check if -h or --help is present
+        if(parser[{"-?", "-h", "--help"}]) {
+            return Status::Help;
+        }
+
+        parser({"-d", "--store"}) >> store;
+
+        // Positional arguments after "jobreport archive"
+        const auto &pos = parser.pos_args();
+        for (size_t i = 2; i < pos.size(); ++i) {
+            inputs.push_back(pos[i]);
+        }
+
+        if (inputs.empty()) {
+            return Status::MissingArgument;
+        }
+
+        return Status::Success;
+    }
+
+    void help() {
+        std::cout 
+            << "Usage: jobreport archive [-h -d <store>] <directory>..." << std::endl
+            << std::endl
+            << "Options:" << std::endl
+            << "  -h, --help                     Show this help message" << std::endl
+            << "  -d, --store <path>             History store directory (default: $JOBREPORT_HISTORY)" << std::endl
+            << std::endl
+            << "Appends the summary of every step of every directory to the history" << std::endl
+            << "store, skipping the steps it already has." << std::endl
+            << std::endl
+            << "Example:" << std::endl
+            << "  jobreport archive -d ~/jobreport_history jobreport_1234" << std::endl;
+    }
+
+    std::vector<std::string> inputs;
+    std::string store = "";
+
+private:
+    argh::parser parser;
+};
+
+/*
+jobreport query: Aggregate the steps of the history store
+    -d, --store: History store directory (default: $JOBREPORT_HISTORY)
+    -w, --where: Filters on the columns of the store
+    -g, --group-by: user, account, job, month or day
+    --since, --until: Bounds of the step start time
+*/
+class QueryCmdArgs {
+public:
+    QueryCmdArgs() {
+        // Preregister the optional arguments which accept values
+        parser.add_params({
+            "-d", "--store",
+            "-w", "--where",
+            "-g", "--group-by",
+            "--since",
+            "--until"
+        });
+    }
+
+    Status parse(int argc, char** argv) {
+        parser.parse(argc, argv);
+
+        // Check if -h or --help is present
+        if(parser[{"-?", "-h", "--help"}]) {
+            return Status::Help;
+        }
+
+        parser({"-d", "--store"}) >> store;
+        parser({"-w", "--where"}) >> where;
+        parser({"-g", "--group-by"}) >> group_by;
+        parser("--since") >> since;
+        parser("--until") >> until;
+
+        if (!group_by.empty() && group_by != "user" && group_by != "account" && group_by != "job"
+            && group_by != "month" && group_by != "day") {
+            std::cout << "Invalid value for -g, --group-by" << std::endl
+                      << "Expected one of user, account, job, month, day, got: \"" << group_by << "\"" << std::endl;
+            return Status::InvalidValue;
+        }
+
+        return Status::Success;
+    }
+
+    void help() {
+        std::cout 
+            << "Usage: jobreport query [-h -d <store> -w <filters> -g <group> --since <time> --until <time>]" << std::endl
+            << std::endl
+            << "Options:" << std::endl
+            << "  -h, --help                     Show this help message" << std::endl
+            << "  -d, --store <path>             History store directory (default: $JOBREPORT_HISTORY)" << std::endl
+            << "  -w, --where <filters>          Only aggregate the steps matching <column><op><value>, with op" << std::endl
+            << "                                 one of < <= > >= == !=; several filters are separated by commas" << std::endl
+            << "                                 Columns: job, step, user, account, nodes, gpus, gpu_hours," << std::endl
+            << "                                 energy, power, sm, membw, memory, imbalance, sm_gpu_min," << std::endl
+            << "                                 sm_gpu_max, idle_gpus" << std::endl
+            << "  -g, --group-by <group>         Aggregate by user, account, job, month or day (default: all steps)" << std::endl
+            << "  --since <time>                 Only steps started at or after <time>" << std::endl
+            << "  --until <time>                 Only steps started at or before <time>" << std::endl
+            << "                                 Times: YYYY-MM-DD[THH:MM[:SS]], or <N>h, <N>d, <N>w ago" << std::endl
+            << std::endl
+            << "Example:" << std::endl
+            << "  jobreport query -w account=g42 --since 30d" << std::endl
+            << "  jobreport query -g user -w \"sm<20,gpus>=8\" --since 2026-01-01" << std::endl;
+    }
+
+    std::string store = "";               // -d, --store
+    std::string where = "";               // -w, --where
+    std::string group_by = "";            // -g, --group-by
+    std::string since = "";               // --since
+    std::string until = "";               // --until
+
+private:
+    argh::parser parser;
+};
+
+/*
+jobreport status: Show the live statistics of the running jobs of this node
+    [target]: Job id, report directory or control socket (default: all running jobs)
+*/
+class StatusCmdArgs {
+public:
+    Status parse(int argc, char** argv) {
+        parser.parse(argc, argv);
+
+        // Check if -h or --help is present
+        if(parser[{"-?", "-h", "--help"}]) {
+            return Status::Help;
+        }
+
+        // Positional argument after "jobreport status"
+        parser(2) >> target;
+
+        return Status::Success;
+    }
+
+    void help() {
+        std::cout 
+            << "Usage: jobreport status [-h] [<job id> | <directory> | <socket>]" << std::endl
+            << std::endl
+            << "Options:" << std::endl
+            << "  -h, --help                     Show this help message" << std::endl
+            << std::endl
+            << "Queries the collectors of the running jobs of this node, or of the given" << std::endl
+            << "job or report directory, for the power and utilization of their GPUs" << std::endl
+            << "since the step started." << std::endl
+            << std::endl
+            << "Example:" << std::endl
+            << "  jobreport status 1234" << std::endl;
+    }
+
+    std::string target = "";
+
+private:
+    argh::parser parser;
+};
+
+/*
+jobreport watch: Follow a running job
+    -r, --refresh: Refresh period of the view in seconds
+    <directory>: Job or step directory
+*/
+class WatchCmdArgs {
+public:
+    WatchCmdArgs() {
+        // Preregister the optional arguments which accept values
+        parser.add_params({
+            "-r", "--refresh"
+        });
+    }
+
+    Status parse(int argc, char** argv) {
+        parser.parse(argc, argv);
+
+        // Check if -h or --help is present
+        if(parser[{"-?", "-h", "--help"}]) {
+            return Status::Help;
+        }
+
+        parser({"-r", "--refresh"}, refresh) >> refresh;
+        parser(2) >> input;
+
+        if (input.empty()) {
+            return Status::MissingArgument;
+        }
+
+        if (refresh < 0.1) {
+            std::cout << "Invalid value for -r, --refresh" << std::endl
+                      << "Expected at least 0.1 seconds, got: \"" << refresh << "\"" << std::endl;
+            return Status::InvalidValue;
+        }
+
+        return Status::Success;
+    }
+
+    void help() {
+        std::cout 
+            << "Usage: jobreport watch [-h -r <seconds>] <directory>" << std::endl
+            << std::endl
+            << "Options:" << std::endl
+            << "  -h, --help                     Show this help message" << std::endl
+            << "  -r, --refresh <seconds>        Refresh period of the view (default: 2)" << std::endl
+            << std::endl
+            << "Shows the power and utilization of the nodes and GPUs of a running job," << std::endl
+            << "and flags the idle and stalled GPUs. Press Ctrl-C to quit." << std::endl
+            << std::endl
+            << "Example:" << std::endl
+            << "  jobreport watch jobreport_1234" << std::endl;
+    }
+
+    std::string input = "";
+    double refresh = 2.0;                 // -r, --refresh
+
+private:
+    argh::parser parser;
+};
+
+/*
+jobreport diff: Compare the steps of two job reports
+    -o, --output: Output file (default: stdout)
+    <A> <B>: Job or step directories
+*/
+class DiffCmdArgs {
+public:
+    DiffCmdArgs() {
+        // Preregister the optional arguments which accept values
+        parser.add_params({
+            "-o", "--output"
+        });
+    }
+
+    Status parse(int argc, char** argv) {
+        parser.parse(argc, argv);
+
+        // Check if -h or --help is present
+        if(parser[{"-?", "-h", "--help"}]) {
+            return Status::Help;
+        }
+
+        parser({"-o", "--output"}) >> output;
+
+        // Positional arguments after "jobreport diff"
+        parser(2) >> inputA;
+        parser(3) >> inputB;
+
+        if (inputA.empty() || inputB.empty()) {
+            return Status::MissingArgument;
+        }
+        if (parser.pos_args().size() > 4) {
+            std::cout << "Expected two directories, got " << parser.pos_args().size() - 2 << std::endl;
+            return Status::InvalidValue;
+        }
+
+        return Status::Success;
+    }
+
+    void help() {
+        std::cout 
+            << "Usage: jobreport diff [-h -o <output>] <A> <B>" << std::endl
+            << std::endl
+            << "Options:" << std::endl
+            << "  -h, --help                     Show this help message" << std::endl
+            << "  -o, --output <path>            Output file (default: stdout)" << std::endl
+            << std::endl
+            << "Compares the steps of job or step directory B with the same steps of A." << std::endl
+            << "GPUs are aligned by host and GPU id, or by node order and GPU id when" << std::endl
+            << "the runs used different nodes." << std::endl
+            << std::endl
+            << "Example:" << std::endl
+            << "  jobreport diff jobreport_1234 jobreport_1300" << std::endl;
+    }
+
+    std::string inputA = "";
+    std::string inputB = "";
+    std::string output = "";              // -o, --output
+
+private:
+    argh::parser parser;
+};
+
+/*
+jobreport export: Export the stats in a machine-readable format
+    -f, --format: ndjson, json or csv
+    -o, --output: Output file (default: stdout)
+    [directories]: Job or step directories
+*/
+class ExportCmdArgs {
+public:
+    ExportCmdArgs() {
+        // Preregister the optional arguments which accept values
+        parser.add_params({
+            "-o", "--output",
+            "-f", "--format"
+        });
+    }
+
+    Status parse(int argc, char** argv) {
+        parser.parse(argc, argv);
+
+        // Check if -h or --help is present
+        if(parser[{"-?", "-h", "--help"}]) {
+            return Status::Help;
+        }
+
+        parser({"-o", "--output"}, output) >> output;
+        parser({"-f", "--format"}, format) >> format;
+
+        // Positional arguments after "jobreport export"
+        const auto &pos = parser.pos_args();
+        for (size_t i = 2; i < pos.size(); ++i) {
+            inputs.push_back(pos[i]);
+        }
+
+        if (inputs.empty()) {
+            return Status::MissingArgument;
+        }
+
+        if (format != "ndjson" && format != "json" && format != "csv") {
+            std::cout << "Invalid value for -f, --format" << std::endl
+                      << "Expected one of ndjson, json, csv, got: \"" << format << "\"" << std::endl;
+            return Status::InvalidValue;
+        }
+
+        return Status::Success;
+    }
+
+    void help() {
+        std::cout 
+            << "Usage: jobreport export [-h -f <format> -o <path>] <directory>..." << std::endl
+            << std::endl
+            << "Options:" << std::endl
+            << "  -h, --help                     Show this help message" << std::endl
+            << "  -f, --format <format>          ndjson, json or csv (default: ndjson)" << std::endl
+            << "  -o, --output <path>            Output file (default: stdout)" << std::endl
+            << std::endl
+            << "Every step of every directory is exported, as a step summary record" << std::endl
+            << "followed by one record per GPU." << std::endl
+            << std::endl
+            << "Example:" << std::endl
+            << "  jobreport export jobreport_1234" << std::endl
+            << "  jobreport export -f csv -o jobs.csv jobreport_*" << std::endl;
+    }
+
+    std::vector<std::string> inputs;
+    std::string output = "";
+    std::string format = "ndjson";
 
 private:
     argh::parser parser;
@@ -253,6 +736,263 @@ public:
 
     std::string output = "";
 
+private:
+    argh::parser parser;
+};
+
+/*
+jobreport synth: Write a synthetic job report, without GPUs
+*/
+class SynthCmdArgs {
+public:
+    SynthCmdArgs() {
+        // Preregister the optional arguments which accept values
+        parser.add_params({
+            "-o", "--output",
+            "-n", "--nodes",
+            "-g", "--gpus-per-node",
+            "-r", "--ranks-per-node",
+            "-s", "--steps",
+            "-j", "--threads",
+            "--duration",
+            "--sampling-time",
+            "--idle",
+            "--stragglers",
+            "--throttled",
+            "--nan-power",
+            "--seed",
+            "--job-id"
+        });
+    }
+
+    Status parse(int argc, char** argv) {
+        parser.parse(argc, argv);
+
+        // Check if -h or --help is present
+        if(parser[{"-?", "-h", "--help"}]) {
+            return Status::Help;
+        }
+
+        parser({"-o", "--output"}, output) >> output;
+        parser({"-n", "--nodes"}, nodes) >> nodes;
+        parser({"-g", "--gpus-per-node"}, gpus_per_node) >> gpus_per_node;
+        parser({"-r", "--ranks-per-node"}, ranks_per_node) >> ranks_per_node;
+        parser({"-s", "--steps"}, steps) >> steps;
+        parser({"-j", "--threads"}, threads) >> threads;
+        parser({"--duration"}, duration) >> duration;
+        parser({"--sampling-time"}, sampling_time) >> sampling_time;
+        parser({"--idle"}, idle) >> idle;
+        parser({"--stragglers"}, stragglers) >> stragglers;
+        parser({"--throttled"}, throttled) >> throttled;
+        parser({"--nan-power"}, nan_power) >> nan_power;
+        parser({"--seed"}, seed) >> seed;
+        parser({"--job-id"}, job_id) >> job_id;
+        timeseries = parser[{"--timeseries"}];
+        consolidate = parser[{"--consolidate"}];
+        no_manifest = parser[{"--no-manifest"}];
+
+        if (nodes < 1 || gpus_per_node < 1 || ranks_per_node < 1 || steps < 1 || threads < 0) {
+            std::cout << "Invalid value for -n, -g, -r, -s or -j" << std::endl
+                      << "Expected positive numbers" << std::endl;
+            return Status::InvalidValue;
+        }
+
+        if (gpus_per_node % ranks_per_node != 0) {
+            std::cout << "Invalid value for -r, --ranks-per-node" << std::endl
+                      << "Expected a divisor of the " << gpus_per_node << " GPUs per node, got: " << ranks_per_node << std::endl;
+            return Status::InvalidValue;
+        }
+
+        if (duration < 1 || sampling_time < 1) {
+            std::cout << "Invalid value for --duration or --sampling-time" << std::endl
+                      << "Expected a positive number of seconds" << std::endl;
+            return Status::InvalidValue;
+        }
+
+        for (double fraction : {idle, stragglers, throttled, nan_power}) {
+            if (!(fraction >= 0 && fraction <= 1)) {
+                std::cout << "Invalid value for --idle, --stragglers, --throttled or --nan-power" << std::endl
+                          << "Expected a fraction of the GPUs from 0 to 1, got: " << fraction << std::endl;
+                return Status::InvalidValue;
+            }
+        }
+        if (idle + stragglers + throttled > 1) {
+            std::cout << "Invalid value for --idle, --stragglers and --throttled" << std::endl
+                      << "Expected fractions of the GPUs summing up to at most 1" << std::endl;
+            return Status::InvalidValue;
+        }
+
+        if (output.empty()) {
+            output = "jobreport_" + std::to_string(job_id);
+        }
+
+        return Status::Success;
+    }
+
+    void help() {
+        std::cout
+            << "Usage: jobreport synth [-h -o <dir> -n <nodes> -g <gpus> -r <ranks> -s <steps> -j <threads>]" << std::endl
+            << "                       [--timeseries --duration <s> --sampling-time <s>]" << std::endl
+            << "                       [--idle <f> --stragglers <f> --throttled <f> --nan-power <f>]" << std::endl
+            << "                       [--seed <n> --job-id <id> --consolidate --no-manifest]" << std::endl
+            << std::endl
+            << "Options:" << std::endl
+            << "  -h, --help                     Show this help message" << std::endl
+            << "  -o, --output <dir>             Job directory (default: jobreport_<job id>)" << std::endl
+            << "  -n, --nodes <n>                Number of nodes (default: 1)" << std::endl
+            << "  -g, --gpus-per-node <n>        GPUs of each node (default: 4)" << std::endl
+            << "  -r, --ranks-per-node <n>       Ranks of each node, sharing its GPUs evenly (default: 4)" << std::endl
+            << "  -s, --steps <n>                Number of steps (default: 1)" << std::endl
+            << "  -j, --threads <n>              Writing threads (default: one per core)" << std::endl
+            << "  --timeseries                   Also write the time series of each rank" << std::endl
+            << "  --duration <s>                 Duration of each step in seconds (default: 3600)" << std::endl
+            << "  --sampling-time <s>            Seconds between time series samples (default: 1)" << std::endl
+            << "  --idle <f>                     Fraction of the GPUs without load (default: 0)" << std::endl
+            << "  --stragglers <f>               Fraction of the GPUs busier and finishing later (default: 0)" << std::endl
+            << "  --throttled <f>                Fraction of the GPUs capped in power (default: 0)" << std::endl
+            << "  --nan-power <f>                Fraction of the GPUs whose power was not read (default: 0)" << std::endl
+            << "  --seed <n>                     Seed of the values, the same seed writes the same job (default: 1)" << std::endl
+            << "  --job-id <id>                  Job id (default: 1000000)" << std::endl
+            << "  --consolidate                  One CSV file per node and step, as jobreport --consolidate" << std::endl
+            << "  --no-manifest                  Leave the job manifest empty, as earlier versions did" << std::endl
+            << std::endl
+            << "The job is written in the layout of the monitor, to test print and the" << std::endl
+            << "tools reading reports at scale without GPUs." << std::endl
+            << std::endl
+            << "Example:" << std::endl
+            << "  jobreport synth -n 2500 -o synth_job" << std::endl
+            << "  jobreport synth -n 16 -s 3 --timeseries --duration 600 --stragglers 0.05 --nan-power 0.01" << std::endl;
+    }
+
+    std::string output = "";
+    int nodes = 1;
+    int gpus_per_node = 4;
+    int ranks_per_node = 4;
+    int steps = 1;
+    int threads = 0;
+    long long duration = 3600;
+    long long sampling_time = 1;
+    double idle = 0;
+    double stragglers = 0;
+    double throttled = 0;
+    double nan_power = 0;
+    unsigned long long seed = 1;
+    unsigned int job_id = 1000000;
+    bool timeseries = false;
+    bool consolidate = false;
+    bool no_manifest = false;
+
+private:
+    argh::parser parser;
+};
+
+/*
+jobreport_bench: Benchmark of the analysis pipeline on synthetic jobs
+*/
+class BenchCmdArgs {
+public:
+    BenchCmdArgs() {
+        // Preregister the optional arguments which accept values
+        parser.add_params({
+            "-c", "--cases",
+            "-r", "--repeat",
+            "-f", "--format",
+            "-o", "--output",
+            "-d", "--dir"
+        });
+    }
+
+    Status parse(int argc, char** argv) {
+        parser.parse(argc, argv);
+
+        // Check if -h or --help is present
+        if(parser[{"-?", "-h", "--help"}]) {
+            return Status::Help;
+        }
+
+        std::string cases_str;
+        parser({"-c", "--cases"}, "1x1000,100x100,10000x1,100000x1") >> cases_str;
+        parser({"-r", "--repeat"}, repeat) >> repeat;
+        parser({"-f", "--format"}, format) >> format;
+        parser({"-o", "--output"}, output) >> output;
+        parser({"-d", "--dir"}, dir) >> dir;
+        consolidate = parser[{"--consolidate"}];
+        no_manifest = parser[{"--no-manifest"}];
+        keep = parser[{"--keep"}];
+
+        // Cases as <ranks>x<steps>, separated by commas
+        std::stringstream ss(cases_str);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            unsigned int ranks = 0, steps = 0;
+            char x = 0, extra = 0;
+            if (std::sscanf(item.c_str(), "%u%c%u%c", &ranks, &x, &steps, &extra) != 3 || x != 'x'
+                || ranks == 0 || steps == 0) {
+                std::cout << "Invalid value for -c, --cases" << std::endl
+                          << "Expected <ranks>x<steps>[,...], got: \"" << item << "\"" << std::endl;
+                return Status::InvalidValue;
+            }
+            cases.push_back({ranks, steps});
+        }
+        if (cases.empty()) {
+            return Status::MissingArgument;
+        }
+
+        if (repeat < 1) {
+            std::cout << "Invalid value for -r, --repeat" << std::endl
+                      << "Expected a positive number, got: " << repeat << std::endl;
+            return Status::InvalidValue;
+        }
+
+        if (format != "table" && format != "json" && format != "csv") {
+            std::cout << "Invalid value for -f, --format" << std::endl
+                      << "Expected one of table, json, csv, got: \"" << format << "\"" << std::endl;
+            return Status::InvalidValue;
+        }
+
+        return Status::Success;
+    }
+
+    void help() {
+        std::cout
+            << "Usage: jobreport_bench [-h -c <cases> -r <n> -f <format> -o <path> -d <dir>]" << std::endl
+            << "                       [--consolidate --no-manifest --keep]" << std::endl
+            << std::endl
+            << "Options:" << std::endl
+            << "  -h, --help                     Show this help message" << std::endl
+            << "  -c, --cases <cases>            Jobs to benchmark, as <ranks>x<steps> separated by commas" << std::endl
+            << "                                 (default: 1x1000,100x100,10000x1,100000x1)" << std::endl
+            << "  -r, --repeat <n>               Runs of each case, the fastest is reported (default: 1)" << std::endl
+            << "  -f, --format <format>          table, json or csv (default: table)" << std::endl
+            << "  -o, --output <path>            Output file (default: stdout)" << std::endl
+            << "  -d, --dir <dir>                Directory of the synthetic jobs (default: temporary directory)" << std::endl
+            << "  --consolidate                  One CSV file per node and step" << std::endl
+            << "  --no-manifest                  Jobs without manifest, whose directories are scanned" << std::endl
+            << "  --keep                         Keep the synthetic jobs" << std::endl
+            << std::endl
+            << "Each case is a synthetic job of 4 ranks per node with one GPU each, loaded as" << std::endl
+            << "print loads it, with the time, throughput and peak memory of each stage:" << std::endl
+            << "scan, parse, sort, reduce and render." << std::endl
+            << std::endl
+            << "Example:" << std::endl
+            << "  jobreport_bench" << std::endl
+            << "  jobreport_bench -c 10000x1 -r 5 -f json -o bench.json" << std::endl;
+    }
+
+    struct Case {
+        unsigned int ranks;
+        unsigned int steps;
+    };
+
+    std::vector<Case> cases;
+    int repeat = 1;
+    std::string format = "table";
+    std::string output = "";
+    std::string dir = "";
+    bool consolidate = false;
+    bool no_manifest = false;
+    bool keep = false;
+
 private:
     argh::parser parser;
 };
@@ -18,12 +18,21 @@ public:
 
     void permute(const std::vector<size_t>& indices) {
         DFColumn<T> temp(this->size());
+        // Each row is taken once, strings are moved rather than copied
         for (size_t i = 0; i < indices.size(); ++i) {
-            temp[i] = (*this)[indices[i]];
+            temp[i] = std::move((*this)[indices[i]]);
         }
         *this = std::move(temp);
     }
 
+    DFColumn<T> take(const std::vector<size_t>& indices) const {
+        DFColumn<T> result(indices.size());
+        for (size_t i = 0; i < indices.size(); ++i) {
+            result[i] = (*this)[indices[i]];
+        }
+        return result;
+    }
+
     void write(std::ofstream& os, size_t index) const {
         os.write(reinterpret_cast<const char*>(&(*this)[index]), sizeof(T));
     }
@@ -0,0 +1,505 @@
+/*
+    Control socket of the node root.
+
+    While the workload runs, the node root serves a Unix-domain socket
+    answering `jobreport status` with the statistics the sampler has
+    gathered so far. The socket lives in /run/user/<uid>/jobreport, which
+    is node-local and short enough for the sun_path limit, or in the step
+    directory when there is no runtime directory.
+
+    The server is a single thread blocked in epoll_wait on the listening
+    socket, its clients and an eventfd used to stop it. All sockets are
+    non-blocking, the thread runs at the lowest priority and only copies
+    the published sampler statistics, so a query never calls into DCGM
+    nor waits on the sampling thread. Clients that do not complete their
+    request within CONTROL_CLIENT_TIMEOUT are dropped.
+
+    Protocol, one request line and a response of text lines:
+
+        -> stats
+        <- jobreport-status 1
+        <- step job=<id> step=<id> proc=<id> host=<name> start_us=<t> now_us=<t>
+        <- channel id=<gpu|node> power_w=<w> power_avg_w=<w> energy_j=<j> sm_pct=<p> ...
+        <- end
+
+    Fields are key=value pairs, so that fields can be added without
+    breaking older clients. Unknown requests get "error <message>".
+*/
+
+#ifndef JOBREPORT_CONTROL_SOCKET_HPP
+#define JOBREPORT_CONTROL_SOCKET_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <sstream>
+#include <iostream>
+#include <filesystem>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+#include "third_party/tabulate/tabulate.hpp"
+#include "macros.hpp"
+#include "utils.hpp"
+#include "sampler.hpp"
+#include "dataframe_io.hpp"
+
+#define CONTROL_PROTOCOL "jobreport-status 1"
+#define CONTROL_SOCKET_EXTENSION ".sock"
+#define CONTROL_MAX_CLIENTS 16
+#define CONTROL_MAX_REQUEST 256
+#define CONTROL_CLIENT_TIMEOUT 5 // s
+#define CONTROL_QUERY_TIMEOUT 2000 // ms
+
+// Directory of the control sockets of the jobs of the current user on this node
+std::filesystem::path control_socket_dir()
+{
+    return std::filesystem::path("/run/user") / std::to_string(getuid()) / "jobreport";
+}
+
+// Socket of a rank: in the runtime directory if there is one, in `step_dir` otherwise.
+// Empty if the path does not fit in a sockaddr_un.
+std::filesystem::path control_socket_path(const std::string &job, const std::string &step,
+                                          const std::string &proc, const std::filesystem::path &step_dir)
+{
+    std::string name = job + "." + step + "." + proc + CONTROL_SOCKET_EXTENSION;
+    std::filesystem::path path;
+
+    std::error_code ec;
+    if (std::filesystem::is_directory(control_socket_dir().parent_path(), ec))
+    {
+        std::filesystem::create_directories(control_socket_dir(), ec);
+        path = control_socket_dir() / name;
+    }
+    if (path.empty() || ec)
+        path = step_dir / ("status_" + get_hostname() + "." + proc + CONTROL_SOCKET_EXTENSION);
+
+    if (path.string().size() >= sizeof(sockaddr_un::sun_path))
+        return {};
+    return path;
+}
+
+class ControlServer
+{
+public:
+    // Maps a request line to its response
+    using Handler = std::function<std::string(const std::string &)>;
+
+    ~ControlServer() { stop(); }
+
+    bool start(const std::filesystem::path &path, Handler handler);
+    void stop();
+
+private:
+    struct Client
+    {
+        std::string in;
+        std::string out;
+        size_t written = 0;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    std::filesystem::path path;
+    Handler handler;
+    int listenFd = -1;
+    int epollFd = -1;
+    int wakeFd = -1;
+    std::thread thread;
+    std::map<int, Client> clients;
+
+    void loop();
+    void accept_clients();
+    void read_request(int fd, Client &client);
+    bool write_response(int fd, Client &client);
+    void drop(int fd);
+};
+
+bool ControlServer::start(const std::filesystem::path &path, Handler handler)
+{
+    this->path = path;
+    this->handler = std::move(handler);
+
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    // All descriptors are close-on-exec, the workload must not inherit them
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (listenFd < 0 || epollFd < 0 || wakeFd < 0)
+    {
+        stop();
+        return false;
+    }
+
+    // A socket left behind by a killed collector of a previous run
+    unlink(path.c_str());
+    if (bind(listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0
+        || listen(listenFd, CONTROL_MAX_CLIENTS) != 0)
+    {
+        LOG("Unable to listen on " << path << ": " << std::strerror(errno));
+        stop();
+        return false;
+    }
+
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = listenFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev);
+    ev.data.fd = wakeFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev);
+
+    thread = std::thread(&ControlServer::loop, this);
+    return true;
+}
+
+void ControlServer::stop()
+{
+    if (thread.joinable())
+    {
+        uint64_t one = 1;
+        if (write(wakeFd, &one, sizeof(one)) != sizeof(one))
+        {
+            LOG("Unable to wake up the control socket thread");
+        }
+        thread.join();
+    }
+
+    for (const auto &[fd, client] : clients)
+        close(fd);
+    clients.clear();
+
+    if (listenFd >= 0)
+    {
+        close(listenFd);
+        unlink(path.c_str());
+    }
+    if (epollFd >= 0)
+        close(epollFd);
+    if (wakeFd >= 0)
+        close(wakeFd);
+    listenFd = epollFd = wakeFd = -1;
+}
+
+void ControlServer::loop()
+{
+    // Only this thread: the nice value of a thread is its own on Linux
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+
+    epoll_event events[CONTROL_MAX_CLIENTS + 2];
+    while (true)
+    {
+        int n = epoll_wait(epollFd, events, CONTROL_MAX_CLIENTS + 2, clients.empty() ? -1 : 1000);
+        if (n < 0 && errno != EINTR)
+            return;
+
+        for (int i = 0; i < n; ++i)
+        {
+            int fd = events[i].data.fd;
+            if (fd == wakeFd)
+                return;
+            if (fd == listenFd)
+            {
+                accept_clients();
+                continue;
+            }
+
+            auto it = clients.find(fd);
+            if (it == clients.end())
+                continue;
+            if (events[i].events & (EPOLLERR | EPOLLHUP))
+            {
+                drop(fd);
+                continue;
+            }
+            if (events[i].events & EPOLLIN)
+                read_request(fd, it->second);
+            else if ((events[i].events & EPOLLOUT) && write_response(fd, it->second))
+                drop(fd);
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        std::vector<int> expired;
+        for (const auto &[fd, client] : clients)
+        {
+            if (now - client.since > std::chrono::seconds(CONTROL_CLIENT_TIMEOUT))
+                expired.push_back(fd);
+        }
+        for (int fd : expired)
+            drop(fd);
+    }
+}
+
+void ControlServer::accept_clients()
+{
+    while (true)
+    {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return;
+        if (clients.size() >= CONTROL_MAX_CLIENTS)
+        {
+            close(fd);
+            continue;
+        }
+
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+        clients[fd].since = std::chrono::steady_clock::now();
+    }
+}
+
+void ControlServer::read_request(int fd, Client &client)
+{
+    char buffer[CONTROL_MAX_REQUEST];
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    if (n <= 0)
+    {
+        if (n == 0 || (errno != EAGAIN && errno != EINTR))
+            drop(fd);
+        return;
+    }
+    client.in.append(buffer, n);
+
+    size_t eol = client.in.find('\n');
+    if (eol == std::string::npos)
+    {
+        if (client.in.size() > CONTROL_MAX_REQUEST)
+            drop(fd);
+        return;
+    }
+
+    std::string request = client.in.substr(0, eol);
+    if (!request.empty() && request.back() == '\r')
+        request.pop_back();
+    client.out = handler(request);
+
+    if (write_response(fd, client))
+    {
+        drop(fd);
+        return;
+    }
+    // The rest is written as the client reads it
+    epoll_event ev = {};
+    ev.events = EPOLLOUT;
+    ev.data.fd = fd;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+// Writes what the socket accepts, true once the response is complete or the client is gone
+bool ControlServer::write_response(int fd, Client &client)
+{
+    while (client.written < client.out.size())
+    {
+        ssize_t n = send(fd, client.out.data() + client.written, client.out.size() - client.written, MSG_NOSIGNAL);
+        if (n < 0)
+            return errno != EAGAIN && errno != EINTR;
+        client.written += n;
+    }
+    return true;
+}
+
+void ControlServer::drop(int fd)
+{
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    clients.erase(fd);
+}
+
+// Response to a "stats" request, from the statistics published by the sampler
+std::string control_stats_response(const std::string &job, const std::string &step, const std::string &proc,
+                                   long long start_us, const std::vector<ChannelStats> &stats)
+{
+    long long now_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::system_clock::now().time_since_epoch()).count();
+
+    std::ostringstream oss;
+    oss << CONTROL_PROTOCOL << '\n'
+        << "step job=" << job << " step=" << step << " proc=" << proc << " host=" << get_hostname()
+        << " start_us=" << start_us << " now_us=" << now_us << '\n';
+
+    for (const ChannelStats &s : stats)
+    {
+        oss << "channel id=";
+        if (s.channel == NODE_CHANNEL)
+            oss << "node";
+        else
+            oss << s.channel;
+        oss << " power_w=" << s.latest[0] << " power_avg_w=" << s.mean(0) << " energy_j=" << s.energy
+            << " sm_pct=" << s.latest[1] << " sm_avg_pct=" << s.mean(1)
+            << " mem_pct=" << s.latest[2] << " mem_avg_pct=" << s.mean(2)
+            << " samples=" << s.count[0] << " last_us=" << s.lastTimestamp << '\n';
+    }
+    oss << "end\n";
+    return oss.str();
+}
+
+// Sends `request` to the socket at `path`, false if the collector does not answer
+bool control_query(const std::filesystem::path &path, const std::string &request, std::string &response)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    std::string line = request + "\n";
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0
+        || send(fd, line.data(), line.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(line.size()))
+    {
+        close(fd);
+        return false;
+    }
+
+    response.clear();
+    char buffer[4096];
+    while (true)
+    {
+        pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, CONTROL_QUERY_TIMEOUT) <= 0)
+            break;
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n <= 0)
+            break;
+        response.append(buffer, n);
+    }
+    close(fd);
+    return response.rfind(CONTROL_PROTOCOL, 0) == 0 && response.size() >= 4
+        && response.compare(response.size() - 4, 4, "end\n") == 0;
+}
+
+// Key-value fields of a response line, the first word being the record kind
+std::map<std::string, std::string> parse_control_line(const std::string &line, std::string &kind)
+{
+    std::map<std::string, std::string> fields;
+    std::istringstream iss(line);
+    iss >> kind;
+    std::string field;
+    while (iss >> field)
+    {
+        size_t eq = field.find('=');
+        if (eq != std::string::npos)
+            fields[field.substr(0, eq)] = field.substr(eq + 1);
+    }
+    return fields;
+}
+
+void print_control_stats(const std::string &response)
+{
+    auto number = [](const std::map<std::string, std::string> &fields, const std::string &key) {
+        auto it = fields.find(key);
+        return it == fields.end() ? NAN : std::strtod(it->second.c_str(), nullptr);
+    };
+    auto percent = [](double v) { return std::isnan(v) ? std::string("-") : std::to_string(static_cast<int>(std::round(v))) + " %"; };
+
+    std::istringstream iss(response);
+    std::string line, kind;
+    std::getline(iss, line); // protocol
+
+    std::map<std::string, std::string> step;
+    tabulate::Table table;
+    table.add_row({"GPU", "Power", "Avg. Power", "Energy", "SM Util.", "Avg. SM Util.", "Mem BW Util.", "Avg. Mem BW Util.", "Last Sample"});
+    while (std::getline(iss, line))
+    {
+        std::map<std::string, std::string> fields = parse_control_line(line, kind);
+        if (kind == "step")
+        {
+            step = fields;
+        }
+        else if (kind == "channel")
+        {
+            double now = number(step, "now_us");
+            double last = number(fields, "last_us");
+            table.add_row(tabulate::Table::Row_t{
+                fields["id"],
+                std::isnan(number(fields, "power_w")) ? "-" : format_power(number(fields, "power_w")),
+                std::isnan(number(fields, "power_avg_w")) ? "-" : format_power(number(fields, "power_avg_w")),
+                format_energy(number(fields, "energy_j") / 3600.),
+                percent(number(fields, "sm_pct")),
+                percent(number(fields, "sm_avg_pct")),
+                percent(number(fields, "mem_pct")),
+                percent(number(fields, "mem_avg_pct")),
+                last > 0 ? format_elapsed(static_cast<long long>((now - last) / 1e6)) + " ago" : "never"});
+        }
+    }
+
+    table.format()
+        .border_top("-")
+        .border_bottom("-")
+        .border_left("|")
+        .border_right("|")
+        .corner("+");
+
+    std::cout << "Job " << step["job"] << ", step " << step["step"] << ", rank " << step["proc"] << " on " << step["host"]
+              << ": running for " << format_elapsed(static_cast<long long>((number(step, "now_us") - number(step, "start_us")) / 1e6))
+              << std::endl
+              << table << std::endl
+              << std::endl;
+}
+
+// Prints the status of the running jobs of this node: `target` is a socket, a report
+// directory, a job id, or empty for all
+void query_status(const std::string &target)
+{
+    std::vector<std::filesystem::path> sockets;
+    std::error_code ec;
+    if (!target.empty() && std::filesystem::is_socket(target, ec))
+    {
+        sockets.push_back(target);
+    }
+    else if (!target.empty() && std::filesystem::is_directory(target, ec))
+    {
+        // Sockets created in the step directories, on nodes without a runtime directory
+        for (const auto &entry : std::filesystem::recursive_directory_iterator(target, ec))
+        {
+            if (entry.path().extension() == CONTROL_SOCKET_EXTENSION && entry.is_socket(ec))
+                sockets.push_back(entry.path());
+        }
+        std::sort(sockets.begin(), sockets.end());
+    }
+    else
+    {
+        for (const auto &entry : std::filesystem::directory_iterator(control_socket_dir(), ec))
+        {
+            std::string name = entry.path().filename().string();
+            if (entry.path().extension() == CONTROL_SOCKET_EXTENSION && (target.empty() || name.rfind(target + ".", 0) == 0))
+                sockets.push_back(entry.path());
+        }
+        std::sort(sockets.begin(), sockets.end());
+    }
+
+    if (sockets.empty())
+    {
+        raise_error(target.empty() ? "Error: No running job found on this node"
+                                   : "Error: No running job found on this node for \"" + target + "\"");
+    }
+
+    for (const auto &socket : sockets)
+    {
+        std::string response;
+        if (!control_query(socket, "stats", response))
+        {
+            std::cerr << "WARNING: No answer from " << socket << ", the collector may have been killed" << std::endl;
+            continue;
+        }
+        print_control_stats(response);
+    }
+}
+
+#endif // JOBREPORT_CONTROL_SOCKET_HPP
@@ -10,9 +10,16 @@
 #include <algorithm>
 #include <numeric>
 #include <iomanip>
+#include <map>
+#include <set>
+#include <queue>
+#include <string_view>
 
+#ifdef JOBREPORT_WITH_DCGM
 #include "dcgm_structs.h"
+#endif
 #include "column.hpp"
+#include "profile.hpp"
 #include "slurm_job.hpp"
 #include "utils.hpp"
 
@@ -31,17 +38,31 @@ struct DataFrameAvg
     int smUtilizationAvg;
     int memoryUtilizationAvg;
     double maxAllocatedMemory;
+    double loadImbalance; // max/mean - 1 of the per-GPU SM utilization
 
     DataFrameAvg() = default;
 };
 
+// Rows appended to a DataFrame from one file
+struct DataFrameBlock
+{
+    size_t first = 0;     // first row
+    size_t size = 0;      // number of rows
+    std::string host;     // host of all its rows
+    bool sorted = false;  // rows are ordered by GPU id
+};
+
 
 class DataFrame
 {
 public:
     // Constructors
     DataFrame() = default;
-    DataFrame(const dcgmJobInfo_t &jobInfo, const SlurmJob &job);
+#ifdef JOBREPORT_WITH_DCGM
+    DataFrame(const dcgmJobInfo_t &jobInfo, const SlurmJob &job,
+              const std::map<unsigned int, double> &energyCounters = {},
+              const std::map<unsigned int, double> &integratedEnergy = {});
+#endif
 
     // Columns
     DFColumn<std::string> user;
@@ -63,17 +84,25 @@ public:
     DFColumn<int> memoryUtilizationMax;
     DFColumn<int> memoryUtilizationAvg;
     DFColumn<long long> maxAllocatedMemory;
+    DFColumn<double> energyConsumed; // in Joules
 
     // Input/Output functions
-    void dump(std::ofstream &os);
-    void load(std::ifstream &is);
+    void dump(std::ostream &os);
+    void load(std::istream &is);
 
     // Data manipulation functions
     void sort_by_gpu_id();
+    void sort_by_gpu_id(std::vector<DataFrameBlock> blocks);
+    void reorder(const std::vector<size_t> &indices);
+    DataFrame take(const std::vector<size_t> &indices) const;
+    size_t drop_superseded(size_t first);
     DataFrameAvg average();
 };
 
-DataFrame::DataFrame(const dcgmJobInfo_t &jobInfo, const SlurmJob &job)
+#ifdef JOBREPORT_WITH_DCGM
+DataFrame::DataFrame(const dcgmJobInfo_t &jobInfo, const SlurmJob &job,
+                     const std::map<unsigned int, double> &energyCounters,
+                     const std::map<unsigned int, double> &integratedEnergy)
 {
     unsigned int n = jobInfo.numGpus;
 
@@ -82,8 +111,15 @@ DataFrame::DataFrame(const dcgmJobInfo_t &jobInfo, const SlurmJob &job)
     unsigned int _job_id = std::stoul(job.job_id);
     unsigned int _step_id = std::stoul(job.step_id);
 
+    // DCGM reports unavailable values as blank sentinels rather than failing
+    auto fp64 = [](double x) {
+        return DCGM_FP64_IS_BLANK(x) ? std::numeric_limits<double>::quiet_NaN() : x;
+    };
+
     for (unsigned int id = 0; id < n; ++id)
     {
+        const dcgmGpuUsageInfo_t &gpu = jobInfo.gpus[id];
+
         user.push_back(job.user);
         account.push_back(job.account);
         jobId.push_back(_job_id);
@@ -92,30 +128,51 @@ DataFrame::DataFrame(const dcgmJobInfo_t &jobInfo, const SlurmJob &job)
         host.push_back(hostName);
         gpuId.push_back(job.step_gpus.empty() ? id : job.step_gpus[id]);
         
-        // This is a hack to handle the case where the power usage is not available
-        constexpr double thrsh = 1.5e3;
-        double tmp;
-        tmp = jobInfo.gpus[id].powerUsage.minValue;
-        powerUsageMin.push_back(tmp < thrsh ? tmp : std::numeric_limits<double>::quiet_NaN());
-        tmp = jobInfo.gpus[id].powerUsage.maxValue;
-        powerUsageMax.push_back(tmp < thrsh ? tmp : std::numeric_limits<double>::quiet_NaN());
-        tmp = jobInfo.gpus[id].powerUsage.average;
-        powerUsageAvg.push_back(tmp < thrsh ? tmp : std::numeric_limits<double>::quiet_NaN());
-
-        startTime.push_back(jobInfo.gpus[id].startTime);
-        endTime.push_back(jobInfo.gpus[id].endTime);
-        smUtilizationMin.push_back(jobInfo.gpus[id].smUtilization.minValue);
-        smUtilizationMax.push_back(jobInfo.gpus[id].smUtilization.maxValue);
-        smUtilizationAvg.push_back(jobInfo.gpus[id].smUtilization.average);
-        memoryUtilizationMin.push_back(jobInfo.gpus[id].memoryUtilization.minValue);
-        memoryUtilizationMax.push_back(jobInfo.gpus[id].memoryUtilization.maxValue);
-        memoryUtilizationAvg.push_back(jobInfo.gpus[id].memoryUtilization.average);
-        maxAllocatedMemory.push_back(jobInfo.gpus[id].maxGpuMemoryUsed);
+        powerUsageMin.push_back(fp64(gpu.powerUsage.minValue));
+        powerUsageMax.push_back(fp64(gpu.powerUsage.maxValue));
+        powerUsageAvg.push_back(fp64(gpu.powerUsage.average));
+
+        startTime.push_back(gpu.startTime);
+        endTime.push_back(gpu.endTime);
+        smUtilizationMin.push_back(gpu.smUtilization.minValue);
+        smUtilizationMax.push_back(gpu.smUtilization.maxValue);
+        smUtilizationAvg.push_back(gpu.smUtilization.average);
+        memoryUtilizationMin.push_back(gpu.memoryUtilization.minValue);
+        memoryUtilizationMax.push_back(gpu.memoryUtilization.maxValue);
+        memoryUtilizationAvg.push_back(gpu.memoryUtilization.average);
+        maxAllocatedMemory.push_back(gpu.maxGpuMemoryUsed);
+
+        // Energy, from the most to the least accurate source:
+        //  1. the DCGM total energy counter read at start and stop: `energyCounters`, in J
+        //  2. the energy of the job stats, which DCGM integrates from its own power samples, in mJ
+        //  3. the power samples of the jobreport sampler integrated over the step: `integratedEnergy`, in J
+        //  4. the average power over the elapsed time of this GPU
+        auto counter = energyCounters.find(gpu.gpuId);
+        auto integrated = integratedEnergy.find(gpu.gpuId);
+        if (counter != energyCounters.end() && !std::isnan(counter->second))
+        {
+            energyConsumed.push_back(counter->second);
+        }
+        else if (!DCGM_INT64_IS_BLANK(gpu.energyConsumed) && gpu.energyConsumed > 0)
+        {
+            energyConsumed.push_back(gpu.energyConsumed / 1e3); // mJ to J
+        }
+        else if (integrated != integratedEnergy.end() && !std::isnan(integrated->second))
+        {
+            energyConsumed.push_back(integrated->second);
+        }
+        else
+        {
+            energyConsumed.push_back(powerUsageAvg.back() * (gpu.endTime - gpu.startTime) / 1e6);
+        }
     }
 }
+#endif // JOBREPORT_WITH_DCGM
 
 void DataFrame::sort_by_gpu_id()
 {
+    PROFILE_SCOPE("sort_by_gpu_id");
+
     // Create a vector of indices
     std::vector<size_t> indices(gpuId.size());
     std::iota(indices.begin(), indices.end(), 0); // Fill with 0, 1, ..., n-1
@@ -129,6 +186,83 @@ void DataFrame::sort_by_gpu_id()
                   return host[i1] < host[i2];
               });
 
+    reorder(indices);
+}
+
+// Same order as sort_by_gpu_id(), without comparing rows when every block holds
+// the rows of one host ordered by GPU id: hosts are compared once per block,
+// and the blocks of a host, one per rank, are merged by GPU id
+void DataFrame::sort_by_gpu_id(std::vector<DataFrameBlock> blocks)
+{
+    PROFILE_SCOPE("merge_by_gpu_id");
+
+    size_t n = 0;
+    for (const auto &block : blocks)
+    {
+        if (!block.sorted)
+        {
+            sort_by_gpu_id();
+            return;
+        }
+        n += block.size;
+    }
+    if (n != gpuId.size())
+    {
+        sort_by_gpu_id();
+        return;
+    }
+
+    std::sort(blocks.begin(), blocks.end(),
+              [](const DataFrameBlock &a, const DataFrameBlock &b) { return a.host < b.host; });
+
+    std::vector<size_t> indices;
+    indices.reserve(n);
+
+    // GPU id of the next row of a block, and the block
+    using Head = std::pair<unsigned int, size_t>;
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heap;
+    std::vector<size_t> next(blocks.size(), 0);
+
+    for (size_t first = 0, last = 0; first < blocks.size(); first = last)
+    {
+        for (last = first + 1; last < blocks.size() && blocks[last].host == blocks[first].host; ++last)
+            ;
+
+        if (last - first == 1)
+        {
+            for (size_t i = 0; i < blocks[first].size; ++i)
+                indices.push_back(blocks[first].first + i);
+            continue;
+        }
+
+        // k-way merge of the blocks of the host
+        for (size_t b = first; b < last; ++b)
+        {
+            if (blocks[b].size > 0)
+                heap.push({gpuId[blocks[b].first], b});
+        }
+        while (!heap.empty())
+        {
+            size_t b = heap.top().second;
+            heap.pop();
+            indices.push_back(blocks[b].first + next[b]);
+            if (++next[b] < blocks[b].size)
+                heap.push({gpuId[blocks[b].first + next[b]], b});
+        }
+    }
+
+    reorder(indices);
+}
+
+// Moves the rows into the order of `indices`, a permutation of the rows
+void DataFrame::reorder(const std::vector<size_t> &indices)
+{
+    bool identity = true;
+    for (size_t i = 0; i < indices.size() && identity; ++i)
+        identity = indices[i] == i;
+    if (identity)
+        return;
+
     // Apply the sorted order to each DFColumn
     user.permute(indices);
     account.permute(indices);
@@ -149,10 +283,63 @@ void DataFrame::sort_by_gpu_id()
     memoryUtilizationMax.permute(indices);
     memoryUtilizationAvg.permute(indices);
     maxAllocatedMemory.permute(indices);
+    energyConsumed.permute(indices);
+}
+
+// New DataFrame with the given rows, in the given order
+DataFrame DataFrame::take(const std::vector<size_t> &indices) const
+{
+    DataFrame df;
+    df.user = user.take(indices);
+    df.account = account.take(indices);
+    df.jobId = jobId.take(indices);
+    df.stepId = stepId.take(indices);
+    df.nNodes = nNodes.take(indices);
+    df.host = host.take(indices);
+    df.gpuId = gpuId.take(indices);
+    df.powerUsageMin = powerUsageMin.take(indices);
+    df.powerUsageMax = powerUsageMax.take(indices);
+    df.powerUsageAvg = powerUsageAvg.take(indices);
+    df.startTime = startTime.take(indices);
+    df.endTime = endTime.take(indices);
+    df.smUtilizationMin = smUtilizationMin.take(indices);
+    df.smUtilizationMax = smUtilizationMax.take(indices);
+    df.smUtilizationAvg = smUtilizationAvg.take(indices);
+    df.memoryUtilizationMin = memoryUtilizationMin.take(indices);
+    df.memoryUtilizationMax = memoryUtilizationMax.take(indices);
+    df.memoryUtilizationAvg = memoryUtilizationAvg.take(indices);
+    df.maxAllocatedMemory = maxAllocatedMemory.take(indices);
+    df.energyConsumed = energyConsumed.take(indices);
+    return df;
+}
+
+// Drops the rows from `first` on whose host and GPU id appear again in a later row, as
+// left in a consolidated file by a rerun with --force appending to it; the rows of the
+// last run are kept. Returns the number of rows dropped.
+size_t DataFrame::drop_superseded(size_t first)
+{
+    std::set<std::pair<std::string_view, unsigned int>> seen;
+    std::vector<size_t> keep;
+    for (size_t i = gpuId.size(); i-- > first;)
+    {
+        if (seen.insert({host[i], gpuId[i]}).second)
+            keep.push_back(i);
+    }
+    size_t dropped = gpuId.size() - first - keep.size();
+    if (dropped == 0)
+        return 0;
+
+    std::vector<size_t> indices(first);
+    std::iota(indices.begin(), indices.end(), 0);
+    indices.insert(indices.end(), keep.rbegin(), keep.rend());
+    *this = take(indices);
+    return dropped;
 }
 
 DataFrameAvg DataFrame::average()
 {
+    PROFILE_SCOPE("average");
+
     // Safety check
     // This should ideally never trigger.
     if (gpuId.empty())  
@@ -171,7 +358,7 @@ DataFrameAvg DataFrame::average()
     avg.powerUsageAvg = powerUsageAvg.sum();
     avg.startTime = startTime.average();
     avg.endTime = endTime.average();
-    avg.energyConsumed = avg.powerUsageAvg/3600. * (avg.endTime - avg.startTime) / 1e6;
+    avg.energyConsumed = energyConsumed.sum() / 3600.; // J to Wh
     
     // Round up integer percentages
     auto round_up = [](double x) { return static_cast<int>(x + 0.5); };
@@ -179,10 +366,15 @@ DataFrameAvg DataFrame::average()
     avg.memoryUtilizationAvg = round_up(memoryUtilizationAvg.average());
     
     avg.maxAllocatedMemory = maxAllocatedMemory.max();
+
+    // Imbalance: how much higher the SM utilization of the busiest GPU is than the mean,
+    // taken in double as average() would truncate it to an integer percentage
+    double smMean = std::accumulate(smUtilizationAvg.begin(), smUtilizationAvg.end(), 0.) / smUtilizationAvg.size();
+    avg.loadImbalance = smMean > 0 ? smUtilizationAvg.max() / smMean - 1. : std::numeric_limits<double>::quiet_NaN();
     return avg;
 }
 
-void DataFrame::dump(std::ofstream &os)
+void DataFrame::dump(std::ostream &os)
 {
     size_t numRows = gpuId.size();
 
@@ -193,7 +385,8 @@ void DataFrame::dump(std::ofstream &os)
        << "powerUsageMin,powerUsageMax,powerUsageAvg,"
        << "startTime,endTime,"
        << "smUtilizationMin,smUtilizationMax,smUtilizationAvg,"
-       << "memoryUtilizationMin,memoryUtilizationMax,memoryUtilizationAvg,maxAllocatedMemory" << std::endl;
+       << "memoryUtilizationMin,memoryUtilizationMax,memoryUtilizationAvg,maxAllocatedMemory,"
+       << "energyConsumed" << std::endl;
 
     // Disable scientific notation
     os << std::fixed << std::setprecision(6);
@@ -219,17 +412,30 @@ void DataFrame::dump(std::ofstream &os)
            << memoryUtilizationMin[i] << ',' 
            << memoryUtilizationMax[i] << ',' 
            << memoryUtilizationAvg[i] << ','
-           << maxAllocatedMemory[i] << std::endl;
+           << maxAllocatedMemory[i] << ','
+           << energyConsumed[i] << std::endl;
     }
 }
 
-void DataFrame::load(std::ifstream &is)
+void DataFrame::load(std::istream &is)
 {
+    PROFILE_SCOPE("DataFrame::load");
+
     std::string line;
-    std::getline(is, line); // Skip header line
+    std::getline(is, line); // Header line
+
+    // Files written before energy was recorded per GPU lack the column
+    bool hasEnergy = line.find(",energyConsumed") != std::string::npos;
 
     while (std::getline(is, line))
     {
+        // Consolidated node files hold one block, with its header, per rank
+        if (line.compare(0, 6, "jobId,") == 0)
+        {
+            hasEnergy = line.find(",energyConsumed") != std::string::npos;
+            continue;
+        }
+
         std::stringstream ss(line);
         std::string value;
 
@@ -290,6 +496,17 @@ void DataFrame::load(std::ifstream &is)
 
         std::getline(ss, value, ',');
         maxAllocatedMemory.push_back(std::stoll(value));
+
+        if (hasEnergy)
+        {
+            std::getline(ss, value, ',');
+            energyConsumed.push_back(std::stod(value));
+        }
+        else
+        {
+            energyConsumed.push_back(powerUsageAvg.back() * (endTime.back() - startTime.back()) / 1e6);
+        }
+        PROFILE_COUNT(ProfileRows, 1);
     }
 }
 
@@ -9,10 +9,21 @@
 #include <iomanip>
 #include <sstream>
 #include <cmath>
-#include <regex>
+#include <cctype>
+#include <map>
 #include "third_party/tabulate/tabulate.hpp"
 #include "dataframe.hpp"
+#include "power_timeline.hpp"
+#include "phases.hpp"
+#include "regions.hpp"
+#include "imbalance.hpp"
+#include "table_writer.hpp"
+#include "heatmap.hpp"
+#include "selection.hpp"
+#include "summary_cache.hpp"
+#include "manifest.hpp"
 #include "macros.hpp"
+#include "profile.hpp"
 
 std::string format_percent_alignment(unsigned int p)
 {
@@ -143,6 +154,101 @@ std::string format_elapsed(long long val)
     return oss.str();
 }
 
+// Allocation-free versions of the per-GPU formats above, for large tables
+
+void format_percent(Cell &cell, unsigned int avg, unsigned int min, unsigned int max)
+{
+    cell.integer(avg, 3).append(" / ").integer(min, 3).append(" / ").integer(max, 3);
+}
+
+void format_bytes(Cell &cell, long long val)
+{
+    static const char *suffixes[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    int suffix_index = 0;
+    double size = static_cast<double>(val);
+
+    while (size >= 1024 && suffix_index < 4)
+    {
+        size /= 1024;
+        suffix_index++;
+    }
+
+    cell.fixed(size, 1).append(" ").append(suffixes[suffix_index]);
+}
+
+void format_elapsed(Cell &cell, long long val)
+{
+    long long days = val / 86400;
+    long long hours = (val % 86400) / 3600;
+    long long minutes = (val % 3600) / 60;
+    long long seconds = val % 60;
+
+    if (days > 0)
+    {
+        cell.integer(days).append("d ");
+    }
+
+    if (hours > 0 || days > 0)
+    {
+        cell.integer(hours).append("h ");
+    }
+
+    if (minutes > 0 || hours > 0 || days > 0)
+    {
+        cell.integer(minutes).append("m ");
+    }
+
+    cell.integer(seconds).append("s");
+}
+
+std::string format_ratio_percent(double val)
+{
+    if (std::isnan(val))
+    {
+        return "N/A";
+    }
+
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(1) << 100. * val << " %";
+    return oss.str();
+}
+
+std::string format_ratio(double val)
+{
+    if (std::isnan(val))
+    {
+        return "N/A";
+    }
+
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(2) << val;
+    return oss.str();
+}
+
+std::string format_gpu_hours(double val)
+{
+    std::ostringstream oss;
+    if (val >= 1)
+    {
+        oss << std::fixed << std::setprecision(2) << val << " GPU-h";
+    }
+    else
+    {
+        oss << std::fixed << std::setprecision(1) << val * 60 << " GPU-min";
+    }
+    return oss.str();
+}
+
+std::string format_elapsed_us(long long val)
+{
+    // Sub-second durations, e.g. sampling periods, are shown in ms
+    if (val < 1000000)
+    {
+        return std::to_string(val / 1000) + "ms";
+    }
+    return format_elapsed(val / 1000000);
+}
+
 std::string format_date(long long timestamp)
 {
     // Convert the timestamp to a time_point (assuming the input is in microseconds)
@@ -200,6 +306,10 @@ std::ostream &operator<<(std::ostream &os, const DataFrameAvg &df)
                                             format_bytes(df.maxAllocatedMemory)
                                             });
 
+        table.add_row(tabulate::Table::Row_t{"Load Imbalance (SM Utilization)",
+                                            format_ratio_percent(df.loadImbalance)
+                                            });
+
         table.format()
             .border_top("-")
             .border_bottom("-")
@@ -219,9 +329,306 @@ std::ostream &operator<<(std::ostream &os, const DataFrameAvg &df)
     }
 }
 
+// Output stream operator for PowerTimeline
+std::ostream &operator<<(std::ostream &os, const PowerTimeline &tl)
+{
+    try{
+        tabulate::Table table;
+
+        auto add_curve = [&](const std::string &name, const PowerCurve &curve) {
+            size_t peak = curve.peak_index();
+            long long peak_offset = peak * tl.step;
+
+            table.add_row(tabulate::Table::Row_t{"Peak " + name + " Power", format_power(curve.power[peak])});
+
+            // Means of aggregated buckets smooth the peak, their maxima bound it
+            if (tl.aggregated)
+            {
+                double bound = *std::max_element(curve.envelope.begin(), curve.envelope.end());
+                table.add_row(tabulate::Table::Row_t{"Upper Bound on Peak " + name + " Power", format_power(bound)});
+            }
+
+            table.add_row(tabulate::Table::Row_t{"Time at Peak " + name + " Power",
+                                                format_date(tl.origin + peak_offset) +
+                                                " (+" + format_elapsed(peak_offset / 1000000) + ")"});
+
+            table.add_row(tabulate::Table::Row_t{"P95 / P99 " + name + " Power",
+                                                format_power(curve.percentile(95)) + " / " + format_power(curve.percentile(99))});
+
+            table.add_row(tabulate::Table::Row_t{"Average " + name + " Power", format_power(curve.average())});
+
+            table.add_row(tabulate::Table::Row_t{name + " Power over Time", curve.sparkline()});
+        };
+
+        if (!tl.gpu.empty())
+        {
+            add_curve("GPU", tl.gpu);
+        }
+
+        if (!tl.node.empty())
+        {
+            add_curve("Node", tl.node);
+        }
+
+        table.add_row(tabulate::Table::Row_t{"Timeline Resolution", format_elapsed_us(tl.step)});
+
+        table.format()
+            .border_top("-")
+            .border_bottom("-")
+            .border_left("|")
+            .border_right("|")
+            .corner("+");
+
+        // Same total width as the summary table, wide enough for the sparkline
+        table[0][0].format().width(40);
+        table[0][1].format().width(68);
+
+        os << table << std::endl;
+
+        return os;
+    } catch (const std::exception &e) {
+        raise_error("Error: " + std::string(e.what()));
+        return os; // Suppress warning
+    }
+}
+
+// Output stream operator for PhaseReport
+std::ostream &operator<<(std::ostream &os, const PhaseReport &phases)
+{
+    // Number of nodes listed with their idle time
+    constexpr size_t max_nodes = 10;
+
+    try{
+        tabulate::Table table;
+
+        double total = phases.total_hours();
+        auto hours = [total](double h) {
+            std::ostringstream oss;
+            oss << std::fixed << std::setprecision(1) << 100. * h / total << " %";
+            return format_gpu_hours(h) + " (" + oss.str() + ")";
+        };
+
+        table.add_row(tabulate::Table::Row_t{"Idle GPU Hours", hours(phases.idle_hours())});
+
+        const IdleInterval &idle = phases.longestIdle;
+        if (idle.duration > 0)
+        {
+            table.add_row(tabulate::Table::Row_t{"Longest Idle Interval",
+                                                format_elapsed(idle.duration / 1000000) + " on " +
+                                                idle.host + " GPU " + std::to_string(idle.gpuId) +
+                                                " from " + format_date(idle.start)});
+        }
+
+        for (int p = static_cast<int>(Phase::Idle) + 1; p < static_cast<int>(Phase::Count); ++p)
+        {
+            table.add_row(tabulate::Table::Row_t{std::string("Time ") + phase_name(static_cast<Phase>(p)),
+                                                hours(phases.gpuHours[p])});
+        }
+
+        // Nodes with the most idle time first
+        std::vector<std::pair<std::string, double>> nodes(phases.idleHoursPerNode.begin(), phases.idleHoursPerNode.end());
+        size_t n = std::min(max_nodes, nodes.size());
+        std::partial_sort(nodes.begin(), nodes.begin() + n, nodes.end(),
+                          [](const auto &a, const auto &b) { return a.second > b.second; });
+        for (size_t i = 0; i < n; ++i)
+        {
+            table.add_row(tabulate::Table::Row_t{"Idle on " + nodes[i].first, hours(nodes[i].second)});
+        }
+        if (nodes.size() > n)
+        {
+            table.add_row(tabulate::Table::Row_t{"Idle on other nodes", std::to_string(nodes.size() - n) + " nodes not shown"});
+        }
+
+        table.format()
+            .border_top("-")
+            .border_bottom("-")
+            .border_left("|")
+            .border_right("|")
+            .corner("+");
+
+        table[0][0].format().width(40);
+        table[0][1].format().width(68);
+
+        os << table << std::endl;
+
+        return os;
+    } catch (const std::exception &e) {
+        raise_error("Error: " + std::string(e.what()));
+        return os; // Suppress warning
+    }
+}
+
+// Output stream operator for RegionReport
+std::ostream &operator<<(std::ostream &os, const RegionReport &report)
+{
+    try{
+        tabulate::Table table;
+
+        auto percent = [](double sum, double weight) {
+            return weight > 0 ? std::to_string(static_cast<int>(std::round(sum / weight))) + " %" : std::string("-");
+        };
+
+        table.add_row({"Region", "Instances", "Time per Node", "SM Util.", "Mem BW Util.", "Avg. Power per GPU", "Energy"});
+        for (const auto &[name, s] : report.regions)
+        {
+            table.add_row(tabulate::Table::Row_t{
+                name,
+                std::to_string(s.instances),
+                format_elapsed(std::llround(s.time / std::max<size_t>(s.nNodes, 1))),
+                percent(s.sm, s.smWeight),
+                percent(s.mem, s.memWeight),
+                s.gpuSeconds > 0 ? format_power(s.energy / s.gpuSeconds) : "-",
+                s.gpuSeconds > 0 ? format_energy(s.energy / 3600.) : "-"});
+        }
+
+        table.format()
+            .border_top("-")
+            .border_bottom("-")
+            .border_left("|")
+            .border_right("|")
+            .corner("+");
+
+        os << table << std::endl;
+        if (report.dropped > 0)
+        {
+            os << "* " << report.dropped << " region events were dropped, the workload marked regions faster than they were collected" << std::endl;
+        }
+
+        return os;
+    } catch (const std::exception &e) {
+        raise_error("Error: " + std::string(e.what()));
+        return os; // Suppress warning
+    }
+}
+
+// Output stream operator for ImbalanceReport
+std::ostream &operator<<(std::ostream &os, const ImbalanceReport &imb)
+{
+    try{
+        tabulate::Table table;
+
+        table.add_row({"Metric",
+                       "CV\n(GPUs)",
+                       "Max/Mean\n(GPUs)",
+                       "Outlier\nGPUs",
+                       "CV\n(Nodes)",
+                       "Max/Mean\n(Nodes)",
+                       "Outlier\nNodes"});
+
+        for (size_t m = 0; m < imb.gpus.size(); ++m)
+        {
+            table.add_row(tabulate::Table::Row_t{
+                imb.gpus[m].metric,
+                format_ratio(imb.gpus[m].cv),
+                format_ratio(imb.gpus[m].maxOverMean),
+                std::to_string(imb.gpus[m].nOutliers),
+                format_ratio(imb.nodes[m].cv),
+                format_ratio(imb.nodes[m].maxOverMean),
+                std::to_string(imb.nodes[m].nOutliers)});
+        }
+
+        table.format()
+            .border_top("-")
+            .border_bottom("-")
+            .border_left("|")
+            .border_right("|")
+            .corner("+");
+
+        table[0][0].format().width(25);
+
+        os << table << std::endl;
+
+        auto outlier_table = [&os](const std::string &title, const std::vector<Outlier> &outliers, bool gpus) {
+            if (outliers.empty())
+                return;
+
+            tabulate::Table t;
+            if (gpus)
+                t.add_row({"Host", "GPU", "Robust z", "Outlier", "Outlying Metrics"});
+            else
+                t.add_row({"Host", "Robust z", "Outlier", "Outlying Metrics"});
+
+            for (const auto &o : outliers)
+            {
+                std::string outlier = o.outlier ? "yes" : "no";
+                if (gpus)
+                    t.add_row(tabulate::Table::Row_t{o.host, std::to_string(o.gpuId), format_ratio(o.score), outlier, o.metrics});
+                else
+                    t.add_row(tabulate::Table::Row_t{o.host, format_ratio(o.score), outlier, o.metrics});
+            }
+
+            t.format()
+                .border_top("-")
+                .border_bottom("-")
+                .border_left("|")
+                .border_right("|")
+                .corner("+");
+
+            t[0][0].format().width(15);
+            t[0][gpus ? 4 : 3].format().width(60);
+
+            os << title << std::endl
+               << t << std::endl;
+        };
+
+        outlier_table("Worst Nodes", imb.worstNodes, false);
+        outlier_table("Worst GPUs", imb.worstGpus, true);
+
+        return os;
+    } catch (const std::exception &e) {
+        raise_error("Error: " + std::string(e.what()));
+        return os; // Suppress warning
+    }
+}
+
+// Per-GPU table streamed row by row, with the layout of the tabulate one
+void write_gpu_table(std::ostream &os, const DataFrame &df)
+{
+    OutputBuffer out(os);
+    FixedWidthTable table(out, {15, 6, 18, 18, 25, 22});
+
+    table.rule();
+    table.header({"Host",
+                  "GPU",
+                  "Elapsed",
+                  "SM Utilization %\n(avg/min/max)",
+                  "Memory BW Utilization %\n(avg/min/max)",
+                  "Max Memory Allocated"});
+    table.rule();
+
+    Cell gpu, elapsed, sm, mem, memory;
+    size_t num_rows = df.gpuId.size();
+    for (size_t i = 0; i < num_rows; ++i)
+    {
+        gpu.clear();
+        elapsed.clear();
+        sm.clear();
+        mem.clear();
+        memory.clear();
+
+        gpu.integer(df.gpuId[i]);
+        format_elapsed(elapsed, (df.endTime[i] - df.startTime[i]) / 1000000);
+        format_percent(sm, df.smUtilizationAvg[i], df.smUtilizationMin[i], df.smUtilizationMax[i]);
+        format_percent(mem, df.memoryUtilizationAvg[i], df.memoryUtilizationMin[i], df.memoryUtilizationMax[i]);
+        format_bytes(memory, df.maxAllocatedMemory[i]);
+
+        std::string_view cells[] = {df.host[i], gpu.view(), elapsed.view(), sm.view(), mem.view(), memory.view()};
+        table.row(cells);
+    }
+
+    table.rule();
+}
+
 // Output stream operator for DataFrame
 std::ostream &operator<<(std::ostream &os, const DataFrame &df)
 {
+    // Tabulate keeps every formatted cell around, which is slow for large jobs
+    if (df.gpuId.size() > TABLE_STREAMING_THRESHOLD)
+    {
+        write_gpu_table(os, df);
+        return os;
+    }
+
     try{
         tabulate::Table table;
 
@@ -284,13 +691,96 @@ std::ostream &operator<<(std::ostream &os, const DataFrame &df)
     }
 }
 
-DataFrame load_dataframe(const std::filesystem::path &target)
+// CSV files of a step directory, other files hold e.g. time series
+std::vector<std::filesystem::path> list_step_files(const std::filesystem::path &dir)
+{
+    PROFILE_SCOPE("list_step_files");
+
+    std::vector<std::filesystem::path> files;
+    for (const auto &entry : std::filesystem::directory_iterator(dir))
+    {
+        if (entry.is_regular_file() && entry.path().extension() == ".csv")
+        {
+            files.push_back(entry.path());
+        }
+    }
+    return files;
+}
+
+// Appends the rows of `files` to a DataFrame, one block per file, without sorting them.
+// Unless `required`, a directory without any readable file gives an empty DataFrame instead of an error.
+DataFrame read_step_files(const std::filesystem::path &dir, const std::vector<std::filesystem::path> &files,
+                          std::vector<DataFrameBlock> &blocks, bool required = true)
+{
+    DataFrame df;
+    bool found_valid_file = false;
+    for (const auto &file : files)
+    {
+        // Read file into DataFrame
+        std::ifstream ifs(file);
+
+        // Check if file was opened successfully
+        if (!ifs.is_open())
+        {
+            std::cerr << "WARNING: Could not open file. Skipping: " << file << std::endl;
+            continue;
+        }
+
+        // Load the data from the file into the DataFrame
+        // this operation will append the data to the existing DataFrame
+        size_t first = df.gpuId.size();
+        try
+        {
+            df.load(ifs);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Warning: error reading file. Is the file corrupted?" << std::endl
+                      << "Skipping file: " + file.string() << std::endl;
+            continue;
+        }
+
+        ifs.close();
+        PROFILE_COUNT(ProfileFiles, 1);
+        PROFILE_COUNT(ProfileBytes, std::filesystem::file_size(file));
+
+        size_t dropped = df.drop_superseded(first);
+        if (dropped > 0)
+        {
+            std::cerr << "WARNING: Ignoring " << dropped << " GPUs written again by a later run in: " << file << std::endl;
+        }
+
+        // Files of earlier versions carry no sortedness flag, check the rows
+        DataFrameBlock block;
+        block.first = first;
+        block.size = df.gpuId.size() - first;
+        block.host = block.size > 0 ? df.host[first] : std::string();
+        block.sorted = std::is_sorted(df.gpuId.begin() + first, df.gpuId.end())
+            && std::all_of(df.host.begin() + first, df.host.end(), [&](const std::string &h) { return h == block.host; });
+        blocks.push_back(std::move(block));
+
+        found_valid_file = true;
+    }
+
+    if (!found_valid_file && required)
+    {
+        raise_error("No valid CSV files found in directory: \"" + dir.string() + "\"");
+    }
+    return df;
+}
+
+DataFrame load_dataframe(const std::filesystem::path &target, bool required = true)
 {
+    PROFILE_SCOPE("load_dataframe");
     DataFrame df;
 
     // Check if the target exists
     if (!std::filesystem::exists(target))
     {
+        if (!required)
+        {
+            return df;
+        }
         raise_error("File not found: \"" + target.string() + "\"");
     }
 
@@ -303,68 +793,307 @@ DataFrame load_dataframe(const std::filesystem::path &target)
     }
 
     // Target is a directory
-    // Iterate over all files in the directory
+    std::vector<DataFrameBlock> blocks;
+    df = read_step_files(target, list_step_files(target), blocks, required);
+
+    // Sort DataFrame by GPU ID
+    df.sort_by_gpu_id(std::move(blocks));
+
+    return df;
+}
+
+// A step directory, with its files as listed in the job manifest
+struct StepFiles
+{
+    std::filesystem::path dir;
+    std::vector<ManifestRecord> records; // empty if the directory has to be scanned
+};
+
+// Appends the rows of the files listed in the manifest to a DataFrame without listing
+// the directory or sorting them, skipping the ranks whose data is missing or does not
+// match their record
+DataFrame read_step_files(const StepFiles &step, std::vector<DataFrameBlock> &blocks, bool required = true)
+{
+    DataFrame df;
+    std::filesystem::path root = step.dir.parent_path();
+
+    // Group the records by file, the ranks of a node share one when consolidated
+    std::vector<const ManifestRecord *> order;
+    for (const auto &record : step.records)
+    {
+        order.push_back(&record);
+    }
+    std::sort(order.begin(), order.end(), [](const ManifestRecord *a, const ManifestRecord *b) {
+        int c = std::strncmp(a->file, b->file, sizeof(a->file));
+        return c != 0 ? c < 0 : a->offset < b->offset;
+    });
+
     bool found_valid_file = false;
-    for (const auto &entry : std::filesystem::directory_iterator(target))
+    std::string data;
+    for (size_t first = 0, last = 0; first < order.size(); first = last)
     {
-        // Check if the entry is a regular file
-        if (entry.is_regular_file())
+        // Each file is opened and read once, up to the end of its last block
+        uint64_t size = 0;
+        for (last = first; last < order.size() && std::strncmp(order[last]->file, order[first]->file, sizeof(order[first]->file)) == 0; ++last)
+        {
+            size = std::max(size, order[last]->offset + order[last]->fileSize);
+        }
+
+        std::filesystem::path file = root / read_field(order[first]->file);
+        std::ifstream ifs(file, std::ios::binary);
+        if (!ifs.is_open())
         {
-            // Read file into DataFrame
-            std::ifstream ifs(entry.path());
+            std::cerr << "WARNING: File listed in the job manifest is missing. Skipping: " << file << std::endl;
+            continue;
+        }
 
-            // Check if file was opened successfully
-            if (!ifs.is_open())
+        data.resize(size);
+        ifs.read(data.data(), data.size());
+        data.resize(ifs.gcount());
+        ifs.close();
+        PROFILE_COUNT(ProfileFiles, 1);
+        PROFILE_COUNT(ProfileBytes, data.size());
+
+        for (size_t k = first; k < last; ++k)
+        {
+            const ManifestRecord &record = *order[k];
+            uint64_t end = record.offset + record.fileSize;
+            if (data.size() < end)
+            {
+                std::cerr << "WARNING: File is truncated (" << data.size() << " of " << end
+                          << " bytes). Skipping rank " << record.proc << " in: " << file << std::endl;
+                continue;
+            }
+            if (manifest_checksum(data.data() + record.offset, record.fileSize) != record.checksum)
             {
-                std::cerr << "WARNING: Could not open file. Skipping: " << entry.path() << std::endl;
+                std::cerr << "WARNING: File does not match the job manifest. Skipping rank " << record.proc
+                          << " in: " << file << std::endl;
                 continue;
             }
 
-            // Load the data from the file into the DataFrame
-            // this operation will append the data to the existing DataFrame
+            std::istringstream iss(data.substr(record.offset, record.fileSize));
+            size_t nRows = df.gpuId.size();
             try
             {
-                df.load(ifs);
+                df.load(iss);
             }
             catch (const std::exception &e)
             {
                 std::cerr << "Warning: error reading file. Is the file corrupted?" << std::endl
-                          << "Skipping file: " + entry.path().string() << std::endl;
+                          << "Skipping rank " << record.proc << " in file: " + file.string() << std::endl;
                 continue;
             }
 
-            ifs.close();
-
+            if (df.gpuId.size() - nRows != record.rows)
+            {
+                std::cerr << "WARNING: Read " << df.gpuId.size() - nRows << " GPUs instead of " << record.rows
+                          << " from " << file << std::endl;
+            }
             found_valid_file = true;
+
+            // The sortedness flag is the writer's, the checksum only covers the CSV data. The
+            // host is taken from the rows, the record truncates long host names to nothing.
+            size_t size = df.gpuId.size() - nRows;
+            blocks.push_back({nRows, size, size > 0 ? df.host[nRows] : std::string(), record.sorted != 0});
         }
     }
 
-    if (!found_valid_file)
+    if (!found_valid_file && required)
+    {
+        raise_error("No valid CSV files found in directory: \"" + step.dir.string() + "\"");
+    }
+    return df;
+}
+
+// Loads the files listed in the manifest, or those of the directory if there are none
+DataFrame load_dataframe(const StepFiles &step, bool required = true)
+{
+    if (step.records.empty())
     {
-        raise_error("No valid CSV files found in directory: \"" + target.string() + "\"");
+        return load_dataframe(step.dir, required);
     }
 
+    PROFILE_SCOPE("load_dataframe");
+    std::vector<DataFrameBlock> blocks;
+    DataFrame df = read_step_files(step, blocks, required);
+
     // Sort DataFrame by GPU ID
-    df.sort_by_gpu_id();
+    df.sort_by_gpu_id(std::move(blocks));
+
+    return df;
+}
+
+// Loads the DataFrame of a step and its averages, from the summary cache if it
+// is up to date, otherwise from the CSV files, refreshing the cache. Unless
+// `required`, a step without data gives an empty DataFrame instead of an error.
+DataFrame load_step(const StepFiles &step, DataFrameAvg &avg, bool required = true)
+{
+    PROFILE_SCOPE("load_step");
+
+    // Fingerprint the sources before reading them, so that a change while
+    // they are read invalidates the cache
+    uint64_t nFiles = step.records.size();
+    uint64_t fingerprint = 0;
+    size_t nRows = 0;
+    if (!step.records.empty())
+    {
+        fingerprint = manifest_fingerprint(step.records);
+
+        uint32_t nExpected = 0;
+        for (const auto &record : step.records)
+        {
+            nExpected = std::max(nExpected, record.nExpected);
+            nRows += record.rows;
+        }
+        if (step.records.size() < nExpected)
+        {
+            std::cerr << "WARNING: The job manifest lists " << step.records.size() << " of " << nExpected
+                      << " files of " << step.dir << ", some nodes did not report" << std::endl;
+        }
+    }
+    else if (std::filesystem::is_directory(step.dir))
+    {
+        fingerprint = source_fingerprint(step.dir, nFiles);
+    }
+
+    DataFrame df;
+    if (nFiles > 0 && read_summary_cache(step.dir, fingerprint, nFiles, df, avg))
+    {
+        return df;
+    }
+
+    df = load_dataframe(step, required);
+    if (df.gpuId.empty() && !required)
+    {
+        return df;
+    }
+    avg = df.average();
 
+    // Files skipped as missing or damaged are reported again next time rather than cached
+    if (nFiles > 0 && (step.records.empty() || df.gpuId.size() == nRows))
+    {
+        write_summary_cache(step.dir, fingerprint, nFiles, df, avg);
+    }
     return df;
 }
 
-void print_job_stats(const std::filesystem::path &input, const std::string &output)
+// Options of the print command that affect the report content
+struct PrintOptions
+{
+    long long resolution = 0; // us between power timeline points, 0 for automatic
+    HeatmapMetric heatmap = HeatmapMetric::None; // replaces the per-GPU table if set
+    HeatmapStyle heatmapStyle;
+    RowSelection selection; // rows of the per-GPU table
+};
+
+// Everything reported for one step
+struct StepReport
+{
+    DataFrame df;
+    DataFrameAvg avg;
+    PowerTimeline timeline;
+    PhaseReport phases;
+    RegionReport regions;
+    ImbalanceReport imbalance;
+    Heatmap heatmap;
+};
+
+StepReport analyze_step(const StepFiles &input, const PrintOptions &options)
 {
-    // Load the DataFrame from the input directory
-    DataFrame df = load_dataframe(input);
+    PROFILE_SCOPE("analyze_step");
+    StepReport report;
+
+    // Load the DataFrame and its averages from the input directory
+    report.df = load_step(input, report.avg);
+
+    // Dispersion and outliers across GPUs and nodes
+    report.imbalance = compute_imbalance(report.df);
+
+    report.heatmap = compute_heatmap(report.df, options.heatmap);
+
+    // Resample the recorded power samples, if any, into a job-wide timeline
+    report.timeline = compute_power_timeline(input.dir, report.df, options.resolution);
+
+    // Segment the utilization of each GPU at the resolution of the timeline
+    if (!report.timeline.empty())
+    {
+        report.phases = compute_phases(input.dir, report.timeline.step);
+        report.regions = compute_regions(input.dir, report.timeline.step);
+    }
+
+    return report;
+}
+
+void write_job_stats(std::ostream &os, const StepReport &report, const PrintOptions &options = PrintOptions())
+{
+    os << "Summary of Job Statistics" << std::endl
+       << report.avg << std::endl;
+
+    if (!report.timeline.empty())
+    {
+        os << "Job Power Timeline" << std::endl
+           << report.timeline << std::endl;
+    }
+
+    if (!report.phases.empty())
+    {
+        os << "GPU Phases and Idle Time" << std::endl
+           << report.phases << std::endl;
+    }
+
+    if (!report.regions.empty())
+    {
+        os << "Workload Regions" << std::endl
+           << report.regions << std::endl;
+    }
+
+    if (!report.imbalance.empty())
+    {
+        os << "Load Imbalance" << std::endl
+           << report.imbalance << std::endl;
+    }
 
-    // Compute averages
-    DataFrameAvg avg = df.average();
+    if (!report.heatmap.empty())
+    {
+        os << "GPU Heatmap" << std::endl;
+        write_heatmap(os, report.heatmap, options.heatmapStyle);
+        os << std::endl;
+        return;
+    }
+
+    if (options.selection.empty())
+    {
+        os << "GPU Specific Values" << std::endl
+           << report.df << std::endl;
+        return;
+    }
+
+    std::vector<size_t> rows = select_rows(report.df, options.selection);
+    os << "GPU Specific Values (" << rows.size() << " of " << report.df.gpuId.size() << " GPUs)" << std::endl;
+    if (rows.empty())
+    {
+        os << "No GPU matches the selection" << std::endl
+           << std::endl;
+        return;
+    }
+    os << report.df.take(rows) << std::endl;
+}
+
+void print_job_stats(const StepFiles &input, const std::string &output, const PrintOptions &options)
+{
+    PROFILE_SCOPE("print_job_stats");
+    StepReport report = analyze_step(input, options);
+    PROFILE_SCOPE("render");
 
     // Print summary
     if(output.empty())
     {
-        std::cout << "Summary of Job Statistics" << std::endl
-              << avg << std::endl
-              << "GPU Specific Values" << std::endl
-              << df << std::endl;    
+        // Shade with colors and fit the heatmap to the screen on a terminal
+        PrintOptions terminal = options;
+        size_t height = get_terminal_height();
+        terminal.heatmapStyle.color = height > 0;
+        terminal.heatmapStyle.maxRows = height > 8 ? height - 8 : height;
+        write_job_stats(std::cout, report, terminal);
     } else {
         // Check if the output file already exists
         if (std::filesystem::exists(output))
@@ -377,41 +1106,67 @@ void print_job_stats(const std::filesystem::path &input, const std::string &outp
         {
             raise_error("Error: Unable to open output file: \"" + output + "\"");
         }
-        ofs << "Summary of Job Statistics" << std::endl
-            << avg << std::endl
-            << "GPU Specific Values" << std::endl
-            << df << std::endl;
+        write_job_stats(ofs, report, options);
         ofs.close();
 
         std::cout << "Report written to: \"" << output  << "\"" << std::endl;
     }
 }
 
-bool natural_order_comparator(const std::filesystem::directory_entry& a, const std::filesystem::directory_entry& b) {
-    std::regex regex("step_(\\d+)");
-    std::smatch match_a, match_b;
+// Number of a "step_<n>" name, -1 for other names
+long long step_number(const std::string &name)
+{
+    for (size_t pos = name.find("step_"); pos != std::string::npos; pos = name.find("step_", pos + 1))
+    {
+        size_t begin = pos + 5;
+        size_t end = begin;
+        while (end < name.size() && std::isdigit(static_cast<unsigned char>(name[end])))
+            end++;
+        if (end > begin)
+            return std::stoll(name.substr(begin, std::min<size_t>(end - begin, 18)));
+    }
+    return -1;
+}
 
+bool natural_order_comparator(const std::filesystem::directory_entry& a, const std::filesystem::directory_entry& b) {
     std::string filename_a = a.path().filename().string();
     std::string filename_b = b.path().filename().string();
 
-    bool is_a_match = std::regex_search(filename_a, match_a, regex);
-    bool is_b_match = std::regex_search(filename_b, match_b, regex);
+    long long num_a = step_number(filename_a);
+    long long num_b = step_number(filename_b);
 
-    if (is_a_match && is_b_match) {
-        int num_a = std::stoi(match_a[1].str());
-        int num_b = std::stoi(match_b[1].str());
+    if (num_a >= 0 && num_b >= 0) {
         return num_a < num_b;
     }
     // If only one matches the schema, that one comes first
-    if (is_a_match != is_b_match) {
-        return is_a_match;
+    if ((num_a >= 0) != (num_b >= 0)) {
+        return num_a >= 0;
     }
     // If neither matches, sort lexicographically
     return filename_a < filename_b;
 }
 
-void process_stats(const std::string &input, const std::string &output)
+// Steps of the job directory `root` listed in its manifest, in step order
+std::vector<StepFiles> manifest_steps(const JobManifest &manifest, const std::filesystem::path &root)
+{
+    // The records are sorted by step
+    std::vector<StepFiles> steps;
+    for (const auto &record : manifest.records)
+    {
+        if (steps.empty() || steps.back().records.front().step != record.step)
+        {
+            steps.push_back({root / ("step_" + std::to_string(record.step)), {}});
+        }
+        steps.back().records.push_back(record);
+    }
+    return steps;
+}
+
+// Step directories of `input`, which is either a job directory or a step directory
+std::vector<StepFiles> list_steps(const std::string &input)
 {
+    PROFILE_SCOPE("list_steps");
+
     std::filesystem::path target(input);
 
     // Check if the target exists
@@ -428,7 +1183,19 @@ void process_stats(const std::string &input, const std::string &output)
 
     // Target is a directory
     // Check if target contains file
-    if (std::filesystem::exists(target / ROOT_METADATA_FILE)) {
+    std::vector<StepFiles> steps;
+    JobManifest manifest;
+    if (std::filesystem::exists(target / ROOT_METADATA_FILE) && manifest.read(target)) {
+        // The manifest lists the steps and their files, the directory is not scanned
+        for (auto &step : manifest_steps(manifest, target)) {
+            if (!std::filesystem::is_directory(step.dir)) {
+                std::cerr << "WARNING: Step directory of the job manifest not found, skipping it: " << step.dir << std::endl;
+                continue;
+            }
+            steps.push_back(std::move(step));
+        }
+    } else if (std::filesystem::exists(target / ROOT_METADATA_FILE)) {
+        // Reports of earlier versions have an empty root file and are scanned
         // Collect all directory entries into a vector
         std::vector<std::filesystem::directory_entry> entries;
         for (const auto &entry : std::filesystem::directory_iterator(target)) {
@@ -441,12 +1208,35 @@ void process_stats(const std::string &input, const std::string &output)
         // Sort the entries by natural numerical order
         std::sort(entries.begin(), entries.end(), natural_order_comparator);
 
-        // Iterate over the sorted entries
         for (const auto &entry : entries) {
-            print_job_stats(entry.path(), output);
+            steps.push_back({entry.path(), {}});
         }
     } else { // The folder is a step folder already
-        print_job_stats(target, output);
+        // Take its files from the manifest of the job, if any
+        std::filesystem::path dir = std::filesystem::absolute(target).lexically_normal();
+        if (!dir.has_filename()) {
+            dir = dir.parent_path();
+        }
+        long long step = step_number(dir.filename().string());
+        if (step >= 0 && dir.filename() == "step_" + std::to_string(step) && manifest.read(dir.parent_path())) {
+            std::vector<ManifestRecord> records = manifest.step_records(static_cast<unsigned int>(step));
+            if (!records.empty()) {
+                steps.push_back({dir, std::move(records)});
+                return steps;
+            }
+        }
+        steps.push_back({target, {}});
+    }
+    return steps;
+}
+
+void process_stats(const std::string &input, const std::string &output, const PrintOptions &options = PrintOptions())
+{
+    PROFILE_SCOPE("process_stats");
+
+    // Iterate over the sorted steps
+    for (const auto &step : list_steps(input)) {
+        print_job_stats(step, output, options);
     }
 }
 
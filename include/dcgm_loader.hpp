@@ -0,0 +1,109 @@
+/*
+    Run-time loading of libdcgm.
+
+    jobreport does not link libdcgm: the library and the modules it loads
+    are only opened when the monitor starts, so that the analysis commands
+    start fast and run on machines without DCGM. The entry points used by
+    the monitor are resolved once into a table of function pointers, which
+    the monitor calls as dcgm().Init(), dcgm().Connect(...), and so on.
+*/
+
+#ifndef JOBREPORT_DCGM_LOADER_HPP
+#define JOBREPORT_DCGM_LOADER_HPP
+
+#include <string>
+#include <dlfcn.h>
+
+#include "dcgm_agent.h"
+#include "dcgm_fields.h"
+#include "dcgm_structs.h"
+#include "utils.hpp"
+#include "macros.hpp"
+
+// Tried in order, the versioned names first as only they exist without the development package
+#define DCGM_LIBRARY_NAMES {"libdcgm.so.4", "libdcgm.so.3", "libdcgm.so"}
+
+struct DcgmApi
+{
+    decltype(&::dcgmInit) Init;
+    decltype(&::dcgmShutdown) Shutdown;
+    decltype(&::dcgmConnect) Connect;
+    decltype(&::dcgmDisconnect) Disconnect;
+    decltype(&::dcgmGroupCreate) GroupCreate;
+    decltype(&::dcgmGroupDestroy) GroupDestroy;
+    decltype(&::dcgmGroupAddDevice) GroupAddDevice;
+    decltype(&::dcgmWatchJobFields) WatchJobFields;
+    decltype(&::dcgmJobStartStats) JobStartStats;
+    decltype(&::dcgmJobStopStats) JobStopStats;
+    decltype(&::dcgmJobGetStats) JobGetStats;
+    decltype(&::dcgmJobRemove) JobRemove;
+    decltype(&::dcgmFieldGroupCreate) FieldGroupCreate;
+    decltype(&::dcgmFieldGroupDestroy) FieldGroupDestroy;
+    decltype(&::dcgmWatchFields) WatchFields;
+    decltype(&::dcgmUnwatchFields) UnwatchFields;
+    decltype(&::dcgmUpdateAllFields) UpdateAllFields;
+    decltype(&::dcgmGetLatestValuesForFields) GetLatestValuesForFields;
+    decltype(&::dcgmGetValuesSince) GetValuesSince;
+    decltype(&::dcgmGetAllSupportedDevices) GetAllSupportedDevices;
+};
+
+// Opens libdcgm and resolves the table, raises an error if DCGM is not installed
+DcgmApi load_dcgm()
+{
+    void *library = nullptr;
+    std::string errors;
+    for (const char *name : DCGM_LIBRARY_NAMES)
+    {
+        // Never closed: DCGM keeps threads running until the process exits
+        library = dlopen(name, RTLD_NOW | RTLD_LOCAL);
+        if (library != nullptr)
+        {
+            LOG("Loaded " << name);
+            break;
+        }
+        errors += std::string("\n  ") + dlerror();
+    }
+    if (library == nullptr)
+    {
+        raise_error("Error: Could not load libdcgm, is DCGM installed on this node?" + errors);
+    }
+
+    DcgmApi api;
+    auto resolve = [library](auto &function, const char *symbol) {
+        function = reinterpret_cast<std::remove_reference_t<decltype(function)>>(dlsym(library, symbol));
+        if (function == nullptr)
+        {
+            raise_error("Error: Symbol " + std::string(symbol) + " not found in libdcgm");
+        }
+    };
+    resolve(api.Init, "dcgmInit");
+    resolve(api.Shutdown, "dcgmShutdown");
+    resolve(api.Connect, "dcgmConnect");
+    resolve(api.Disconnect, "dcgmDisconnect");
+    resolve(api.GroupCreate, "dcgmGroupCreate");
+    resolve(api.GroupDestroy, "dcgmGroupDestroy");
+    resolve(api.GroupAddDevice, "dcgmGroupAddDevice");
+    resolve(api.WatchJobFields, "dcgmWatchJobFields");
+    resolve(api.JobStartStats, "dcgmJobStartStats");
+    resolve(api.JobStopStats, "dcgmJobStopStats");
+    resolve(api.JobGetStats, "dcgmJobGetStats");
+    resolve(api.JobRemove, "dcgmJobRemove");
+    resolve(api.FieldGroupCreate, "dcgmFieldGroupCreate");
+    resolve(api.FieldGroupDestroy, "dcgmFieldGroupDestroy");
+    resolve(api.WatchFields, "dcgmWatchFields");
+    resolve(api.UnwatchFields, "dcgmUnwatchFields");
+    resolve(api.UpdateAllFields, "dcgmUpdateAllFields");
+    resolve(api.GetLatestValuesForFields, "dcgmGetLatestValuesForFields");
+    resolve(api.GetValuesSince, "dcgmGetValuesSince");
+    resolve(api.GetAllSupportedDevices, "dcgmGetAllSupportedDevices");
+    return api;
+}
+
+// The table, loaded on first use
+const DcgmApi &dcgm()
+{
+    static const DcgmApi api = load_dcgm();
+    return api;
+}
+
+#endif // JOBREPORT_DCGM_LOADER_HPP
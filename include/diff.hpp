@@ -0,0 +1,508 @@
+/*
+    Run-to-run comparison of two job reports.
+
+    Steps are matched by step id. Within a step, GPUs are aligned by host
+    and GPU id when both runs used the same nodes, and by node order and
+    GPU id otherwise, so that rank i of one run faces rank i of the
+    other. Both DataFrames are sorted by host and GPU id, which makes the
+    alignment a single merge pass rather than a search per GPU.
+
+    A change of a metric is flagged as significant when a paired t-test
+    over the aligned GPUs rejects a zero mean difference at p < 0.01.
+    Power timelines, when recorded in both runs, are compared by the
+    correlation of their shapes on a normalized time axis, so that a
+    faster run with the same phases still correlates.
+*/
+
+#ifndef JOBREPORT_DIFF_HPP
+#define JOBREPORT_DIFF_HPP
+
+#include <ostream>
+#include <sstream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+#include <functional>
+#include <filesystem>
+
+#include "third_party/tabulate/tabulate.hpp"
+#include "dataframe.hpp"
+#include "dataframe_io.hpp"
+#include "power_timeline.hpp"
+#include "export.hpp"
+
+#define DIFF_SHAPE_POINTS 100 // points of the normalized power curves compared
+#define DIFF_TOP_GPUS 10      // GPUs listed with their largest changes
+
+struct PairedTest
+{
+    size_t n = 0;           // aligned GPUs with both values
+    double meanDelta = 0;   // mean of B - A
+    double t = 0;
+    bool significant = false;
+};
+
+// Two-sided critical value of Student's t at p = 0.01
+double t_critical_99(size_t df)
+{
+    static const double table[] = {63.657, 9.925, 5.841, 4.604, 4.032, 3.707, 3.499, 3.355, 3.250, 3.169,
+                                   3.106, 3.055, 3.012, 2.977, 2.947, 2.921, 2.898, 2.878, 2.861, 2.845,
+                                   2.831, 2.819, 2.807, 2.797, 2.787, 2.779, 2.771, 2.763, 2.756, 2.750};
+    if (df == 0)
+        return std::numeric_limits<double>::infinity();
+    if (df <= 30)
+        return table[df - 1];
+    // Tends to the normal quantile
+    return 2.576 + (2.750 - 2.576) * 30. / df;
+}
+
+// Paired t-test of the differences b - a, NaN pairs skipped
+PairedTest paired_test(const std::vector<double> &a, const std::vector<double> &b)
+{
+    PairedTest test;
+    double sum = 0, sum2 = 0;
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        double d = b[i] - a[i];
+        if (std::isnan(d))
+            continue;
+        test.n++;
+        sum += d;
+        sum2 += d * d;
+    }
+    if (test.n < 2)
+        return test;
+
+    test.meanDelta = sum / test.n;
+    double var = std::max(0.0, (sum2 - sum * test.meanDelta) / (test.n - 1));
+    double se = std::sqrt(var / test.n);
+    if (se == 0)
+        test.t = test.meanDelta == 0 ? 0 : std::copysign(std::numeric_limits<double>::infinity(), test.meanDelta);
+    else
+        test.t = test.meanDelta / se;
+    test.significant = std::abs(test.t) > t_critical_99(test.n - 1);
+    return test;
+}
+
+struct GpuAlignment
+{
+    std::vector<std::pair<size_t, size_t>> pairs; // aligned rows of A and B
+    bool byHost = false; // both runs used the same nodes
+    size_t unmatchedA = 0;
+    size_t unmatchedB = 0;
+};
+
+// Index of the node of every row, rows of a node being contiguous
+std::vector<size_t> node_ordinals(const DataFrame &df, std::vector<std::string> &hosts)
+{
+    std::vector<size_t> ordinals(df.gpuId.size());
+    for (size_t i = 0; i < df.gpuId.size(); ++i)
+    {
+        if (i == 0 || df.host[i] != df.host[i - 1])
+            hosts.push_back(df.host[i]);
+        ordinals[i] = hosts.size() - 1;
+    }
+    return ordinals;
+}
+
+// Merge join of two DataFrames sorted by host and GPU id, on (node, GPU id)
+GpuAlignment align_gpus(const DataFrame &a, const DataFrame &b)
+{
+    GpuAlignment alignment;
+    std::vector<std::string> hostsA, hostsB;
+    std::vector<size_t> nodeA = node_ordinals(a, hostsA);
+    std::vector<size_t> nodeB = node_ordinals(b, hostsB);
+
+    // With the same nodes, node ordinals are the same hosts; otherwise the i-th nodes face each other
+    alignment.byHost = hostsA == hostsB;
+
+    size_t i = 0, j = 0;
+    while (i < nodeA.size() && j < nodeB.size())
+    {
+        auto ka = std::make_pair(nodeA[i], a.gpuId[i]);
+        auto kb = std::make_pair(nodeB[j], b.gpuId[j]);
+        if (ka == kb)
+        {
+            alignment.pairs.push_back({i++, j++});
+        }
+        else if (ka < kb)
+        {
+            i++;
+            alignment.unmatchedA++;
+        }
+        else
+        {
+            j++;
+            alignment.unmatchedB++;
+        }
+    }
+    alignment.unmatchedA += nodeA.size() - i;
+    alignment.unmatchedB += nodeB.size() - j;
+    return alignment;
+}
+
+using GpuMetric = std::function<double(const DataFrame &, size_t)>;
+
+struct MetricDiff
+{
+    std::string name;
+    double a = 0;           // step values
+    double b = 0;
+    std::string textA;
+    std::string textB;
+    bool points = false;    // change in percentage points rather than relative
+    PairedTest test;
+};
+
+struct ShapeDiff
+{
+    double correlation = std::numeric_limits<double>::quiet_NaN();
+    double peakA = 0;
+    double peakB = 0;
+    std::string sparklineA; // on a common time and power scale
+    std::string sparklineB;
+
+    bool empty() const { return sparklineA.empty(); }
+};
+
+struct GpuChange
+{
+    size_t rowA;
+    size_t rowB;
+    double delta;
+};
+
+struct StepDiff
+{
+    unsigned int stepId = 0;
+    GpuAlignment alignment;
+    std::vector<MetricDiff> metrics;
+    ShapeDiff shape;
+    std::vector<GpuChange> largestSmChanges;
+};
+
+// Mean of `curve` over n equal parts of its duration
+std::vector<double> resample(const std::vector<double> &curve, size_t n)
+{
+    std::vector<double> out(n, 0.0);
+    if (curve.empty())
+        return out;
+    for (size_t k = 0; k < n; ++k)
+    {
+        size_t first = k * curve.size() / n;
+        size_t last = std::max(first + 1, (k + 1) * curve.size() / n);
+        out[k] = std::accumulate(curve.begin() + first, curve.begin() + std::min(last, curve.size()), 0.0) / (last - first);
+    }
+    return out;
+}
+
+double correlation(const std::vector<double> &x, const std::vector<double> &y)
+{
+    size_t n = x.size();
+    double mx = std::accumulate(x.begin(), x.end(), 0.0) / n;
+    double my = std::accumulate(y.begin(), y.end(), 0.0) / n;
+    double sxy = 0, sxx = 0, syy = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        sxy += (x[i] - mx) * (y[i] - my);
+        sxx += (x[i] - mx) * (x[i] - mx);
+        syy += (y[i] - my) * (y[i] - my);
+    }
+    return sxx > 0 && syy > 0 ? sxy / std::sqrt(sxx * syy) : std::numeric_limits<double>::quiet_NaN();
+}
+
+ShapeDiff compare_shapes(const PowerTimeline &a, const PowerTimeline &b)
+{
+    ShapeDiff shape;
+    if (a.gpu.empty() || b.gpu.empty())
+        return shape;
+
+    shape.correlation = correlation(resample(a.gpu.power, DIFF_SHAPE_POINTS), resample(b.gpu.power, DIFF_SHAPE_POINTS));
+    shape.peakA = a.gpu.power[a.gpu.peak_index()];
+    shape.peakB = b.gpu.power[b.gpu.peak_index()];
+
+    // Both curves on the time axis of the longer run and the scale of the higher peak
+    static const std::string levels = " .:-=+*#%@";
+    double durationA = a.step * static_cast<double>(a.gpu.power.size());
+    double durationB = b.step * static_cast<double>(b.gpu.power.size());
+    double duration = std::max(durationA, durationB);
+    double peak = std::max(shape.peakA, shape.peakB);
+    auto sparkline = [&](const std::vector<double> &curve, double length) {
+        size_t width = static_cast<size_t>(SPARKLINE_WIDTH * length / duration + 0.5);
+        std::string line;
+        for (double v : resample(curve, std::max<size_t>(width, 1)))
+            line += levels[peak > 0 ? static_cast<size_t>(v / peak * (levels.size() - 1) + 0.5) : 0];
+        return line;
+    };
+    shape.sparklineA = sparkline(a.gpu.power, durationA);
+    shape.sparklineB = sparkline(b.gpu.power, durationB);
+    return shape;
+}
+
+StepDiff diff_step(const StepFiles &stepA, const DataFrame &a, const DataFrameAvg &avgA,
+                   const StepFiles &stepB, const DataFrame &b, const DataFrameAvg &avgB)
+{
+    StepDiff diff;
+    diff.stepId = avgA.stepId;
+    diff.alignment = align_gpus(a, b);
+    const auto &pairs = diff.alignment.pairs;
+
+    std::vector<double> va(pairs.size()), vb(pairs.size());
+    auto add = [&](const std::string &name, double sa, double sb, std::string ta, std::string tb,
+                   bool points, const GpuMetric &metric) {
+        for (size_t k = 0; k < pairs.size(); ++k)
+        {
+            va[k] = metric(a, pairs[k].first);
+            vb[k] = metric(b, pairs[k].second);
+        }
+        diff.metrics.push_back({name, sa, sb, std::move(ta), std::move(tb), points, paired_test(va, vb)});
+    };
+
+    double elapsedA = (avgA.endTime - avgA.startTime) / 1e6;
+    double elapsedB = (avgB.endTime - avgB.startTime) / 1e6;
+    add("Elapsed Time", elapsedA, elapsedB,
+        format_elapsed(static_cast<long long>(elapsedA)), format_elapsed(static_cast<long long>(elapsedB)), false,
+        [](const DataFrame &df, size_t i) { return (df.endTime[i] - df.startTime[i]) / 1e6; });
+    add("Total Energy Consumed", avgA.energyConsumed, avgB.energyConsumed,
+        format_energy(avgA.energyConsumed), format_energy(avgB.energyConsumed), false,
+        [](const DataFrame &df, size_t i) { return df.energyConsumed[i]; });
+    add("Average Power Usage", avgA.powerUsageAvg, avgB.powerUsageAvg,
+        format_power(avgA.powerUsageAvg), format_power(avgB.powerUsageAvg), false,
+        [](const DataFrame &df, size_t i) { return df.powerUsageAvg[i]; });
+    add("Average SM Utilization", avgA.smUtilizationAvg, avgB.smUtilizationAvg,
+        std::to_string(avgA.smUtilizationAvg) + " %", std::to_string(avgB.smUtilizationAvg) + " %", true,
+        [](const DataFrame &df, size_t i) { return static_cast<double>(df.smUtilizationAvg[i]); });
+    add("Average Memory BW Utilization", avgA.memoryUtilizationAvg, avgB.memoryUtilizationAvg,
+        std::to_string(avgA.memoryUtilizationAvg) + " %", std::to_string(avgB.memoryUtilizationAvg) + " %", true,
+        [](const DataFrame &df, size_t i) { return static_cast<double>(df.memoryUtilizationAvg[i]); });
+    add("Maximum Memory Allocated", avgA.maxAllocatedMemory, avgB.maxAllocatedMemory,
+        format_bytes(static_cast<long long>(avgA.maxAllocatedMemory)), format_bytes(static_cast<long long>(avgB.maxAllocatedMemory)), false,
+        [](const DataFrame &df, size_t i) { return static_cast<double>(df.maxAllocatedMemory[i]); });
+
+    // GPUs whose SM utilization changed the most
+    for (const auto &[i, j] : pairs)
+    {
+        diff.largestSmChanges.push_back({i, j, static_cast<double>(b.smUtilizationAvg[j] - a.smUtilizationAvg[i])});
+    }
+    size_t top = std::min<size_t>(DIFF_TOP_GPUS, diff.largestSmChanges.size());
+    std::partial_sort(diff.largestSmChanges.begin(), diff.largestSmChanges.begin() + top, diff.largestSmChanges.end(),
+                      [](const GpuChange &x, const GpuChange &y) { return std::abs(x.delta) > std::abs(y.delta); });
+    diff.largestSmChanges.resize(top);
+    while (!diff.largestSmChanges.empty() && diff.largestSmChanges.back().delta == 0)
+    {
+        diff.largestSmChanges.pop_back();
+    }
+
+    diff.shape = compare_shapes(compute_power_timeline(stepA.dir, a), compute_power_timeline(stepB.dir, b));
+    return diff;
+}
+
+std::string format_change(const MetricDiff &m)
+{
+    if (std::isnan(m.a) || std::isnan(m.b))
+        return "N/A";
+
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(1) << std::showpos;
+    if (m.points)
+    {
+        oss << m.b - m.a << " pts";
+    }
+    else
+    {
+        if (m.a == 0)
+            return m.b == 0 ? "+0.0 %" : "N/A";
+        oss << 100. * (m.b - m.a) / m.a << " %";
+    }
+    return oss.str();
+}
+
+std::string format_significance(const PairedTest &test)
+{
+    if (test.n < 2)
+        return "N/A";
+
+    std::ostringstream oss;
+    oss << (test.significant ? "* " : "  ") << "t = ";
+    if (std::isinf(test.t))
+        oss << (test.t > 0 ? "+inf" : "-inf");
+    else
+        oss << std::fixed << std::setprecision(1) << std::showpos << test.t;
+    oss << std::noshowpos << " (" << test.n << " GPUs)";
+    return oss.str();
+}
+
+void write_step_diff(std::ostream &os, const StepDiff &diff, const DataFrame &a, const DataFrame &b)
+{
+    try{
+        tabulate::Table table;
+        table.add_row({"Metric", "A", "B", "Change", "Per-GPU Change"});
+        for (const auto &m : diff.metrics)
+        {
+            table.add_row(tabulate::Table::Row_t{m.name, m.textA, m.textB, format_change(m), format_significance(m.test)});
+        }
+
+        table.format()
+            .border_top("-")
+            .border_bottom("-")
+            .border_left("|")
+            .border_right("|")
+            .corner("+");
+
+        table[0][0].format().width(32);
+        table[0][1].format().width(20);
+        table[0][2].format().width(20);
+        table[0][3].format().width(12);
+        table[0][4].format().width(30);
+
+        os << "Step " << diff.stepId << std::endl
+           << table << std::endl
+           << "* significant at p < 0.01, paired t-test over the aligned GPUs" << std::endl
+           << diff.alignment.pairs.size() << " GPUs aligned by "
+           << (diff.alignment.byHost ? "host and GPU id" : "node order and GPU id, the runs used different nodes");
+        if (diff.alignment.unmatchedA > 0 || diff.alignment.unmatchedB > 0)
+        {
+            os << ", " << diff.alignment.unmatchedA << " only in A and " << diff.alignment.unmatchedB << " only in B";
+        }
+        os << std::endl << std::endl;
+
+        if (!diff.shape.empty())
+        {
+            tabulate::Table shape;
+            shape.add_row(tabulate::Table::Row_t{"GPU Power over Time (A)", diff.shape.sparklineA});
+            shape.add_row(tabulate::Table::Row_t{"GPU Power over Time (B)", diff.shape.sparklineB});
+            shape.add_row(tabulate::Table::Row_t{"Peak GPU Power (A / B)",
+                                                 format_power(diff.shape.peakA) + " / " + format_power(diff.shape.peakB)});
+            shape.add_row(tabulate::Table::Row_t{"Shape Correlation", format_ratio(diff.shape.correlation)});
+            shape.format()
+                .border_top("-")
+                .border_bottom("-")
+                .border_left("|")
+                .border_right("|")
+                .corner("+");
+            shape[0][0].format().width(32);
+            shape[0][1].format().width(64);
+
+            os << "Power Timeline Shape" << std::endl
+               << shape << std::endl
+               << std::endl;
+        }
+
+        if (!diff.largestSmChanges.empty())
+        {
+            tabulate::Table gpus;
+            gpus.add_row({"Host (A)", "Host (B)", "GPU", "SM Util. (A)", "SM Util. (B)", "Change"});
+            for (const auto &c : diff.largestSmChanges)
+            {
+                std::ostringstream delta;
+                delta << std::showpos << c.delta << " pts";
+                gpus.add_row(tabulate::Table::Row_t{a.host[c.rowA], b.host[c.rowB], std::to_string(a.gpuId[c.rowA]),
+                                                    std::to_string(a.smUtilizationAvg[c.rowA]) + " %",
+                                                    std::to_string(b.smUtilizationAvg[c.rowB]) + " %", delta.str()});
+            }
+            gpus.format()
+                .border_top("-")
+                .border_bottom("-")
+                .border_left("|")
+                .border_right("|")
+                .corner("+");
+            gpus[0][0].format().width(15);
+            gpus[0][1].format().width(15);
+
+            os << "Largest Per-GPU SM Utilization Changes" << std::endl
+               << gpus << std::endl
+               << std::endl;
+        }
+    } catch (const std::exception &e) {
+        raise_error("Error: " + std::string(e.what()));
+    }
+}
+
+void diff_runs(const std::string &inputA, const std::string &inputB, const std::string &output)
+{
+    std::vector<StepFiles> stepsA = list_steps(inputA);
+    std::vector<StepFiles> stepsB = list_steps(inputB);
+
+    struct LoadedStep
+    {
+        const StepFiles *files;
+        DataFrame df;
+        DataFrameAvg avg;
+    };
+    auto load = [](const std::vector<StepFiles> &steps) {
+        std::map<unsigned int, LoadedStep> loaded;
+        for (const auto &step : steps)
+        {
+            if (step.records.empty() && !has_dataframe(step.dir))
+            {
+                std::cerr << "WARNING: No data in step directory. Skipping: " << step.dir << std::endl;
+                continue;
+            }
+            LoadedStep s{&step, DataFrame(), DataFrameAvg()};
+            s.df = load_step(step, s.avg);
+            loaded[s.avg.stepId] = std::move(s);
+        }
+        return loaded;
+    };
+    std::map<unsigned int, LoadedStep> a = load(stepsA);
+    std::map<unsigned int, LoadedStep> b = load(stepsB);
+
+    std::ofstream ofs;
+    if (!output.empty())
+    {
+        // Check if the output file already exists
+        if (std::filesystem::exists(output))
+        {
+            raise_error("Error: Output file already exists: \"" + output + "\"");
+        }
+
+        ofs.open(output);
+        if (!ofs.is_open())
+        {
+            raise_error("Error: Unable to open output file: \"" + output + "\"");
+        }
+    }
+    std::ostream &os = output.empty() ? std::cout : ofs;
+
+    os << "A: " << inputA << std::endl
+       << "B: " << inputB << std::endl
+       << std::endl;
+
+    size_t nCompared = 0;
+    for (const auto &[id, stepA] : a)
+    {
+        auto it = b.find(id);
+        if (it == b.end())
+        {
+            std::cerr << "WARNING: Step " << id << " is only in A" << std::endl;
+            continue;
+        }
+        const LoadedStep &stepB = it->second;
+        StepDiff diff = diff_step(*stepA.files, stepA.df, stepA.avg, *stepB.files, stepB.df, stepB.avg);
+        write_step_diff(os, diff, stepA.df, stepB.df);
+        nCompared++;
+    }
+    for (const auto &[id, stepB] : b)
+    {
+        if (a.find(id) == a.end())
+            std::cerr << "WARNING: Step " << id << " is only in B" << std::endl;
+    }
+
+    if (nCompared == 0)
+    {
+        raise_error("Error: No step in common between \"" + inputA + "\" and \"" + inputB + "\"");
+    }
+
+    if (!output.empty())
+    {
+        std::cout << "Report written to: \"" << output << "\"" << std::endl;
+    }
+}
+
+#endif // JOBREPORT_DIFF_HPP
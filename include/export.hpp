@@ -0,0 +1,366 @@
+/*
+    Machine-readable export of the step summaries and per-GPU rows.
+
+    Records are streamed through an OutputBuffer with numbers formatted
+    by to_chars, so the writer does not allocate per field or per row.
+    Field names are part of the versioned schema "jobreport/<version>",
+    named in each ndjson or csv record and once in a json document, and
+    carry their unit as a suffix (_us, _s, _w, _j, _pct, _bytes). Fields are only ever added to a schema
+    version; renaming or removing one bumps EXPORT_SCHEMA_VERSION.
+
+    Formats:
+        ndjson  one JSON object per line, a "step" record followed by
+                one "gpu" record per GPU
+        json    a single document, {"schema": ..., "steps": [...]} with
+                the GPUs of each step nested in it
+        csv     one row per record, with the union of the step and GPU
+                fields as columns, left empty where they do not apply
+*/
+
+#ifndef JOBREPORT_EXPORT_HPP
+#define JOBREPORT_EXPORT_HPP
+
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <fstream>
+#include <filesystem>
+
+#include "dataframe.hpp"
+#include "dataframe_io.hpp"
+#include "table_writer.hpp"
+
+#define EXPORT_SCHEMA_VERSION 1
+#define EXPORT_SCHEMA "jobreport/1"
+
+enum class ExportFormat
+{
+    Ndjson,
+    Json,
+    Csv
+};
+
+// Columns of the csv format, in order
+const char *EXPORT_CSV_COLUMNS[] = {
+    "schema", "record",
+    "job_id", "step_id", "user", "account", "n_nodes", "n_gpus",
+    "host", "gpu_id",
+    "start_time_us", "end_time_us", "elapsed_s",
+    "power_total_avg_w", "power_avg_w", "power_min_w", "power_max_w", "energy_j",
+    "sm_util_avg_pct", "sm_util_min_pct", "sm_util_max_pct",
+    "mem_bw_util_avg_pct", "mem_bw_util_min_pct", "mem_bw_util_max_pct",
+    "max_memory_bytes", "load_imbalance_ratio"};
+
+class ExportWriter
+{
+public:
+    ExportWriter(std::ostream &os, ExportFormat format) : out(os), format(format) {}
+
+    void begin();
+    void step(const DataFrameAvg &avg, const DataFrame &df);
+    void end();
+
+private:
+    OutputBuffer out;
+    ExportFormat format;
+    size_t nSteps = 0;
+    size_t nFields = 0; // fields written in the current record
+    size_t column = 0;  // next csv column
+
+    void begin_record(const char *kind);
+    void end_record();
+    void key(const char *name);
+    void string(std::string_view v);
+    void field(const char *name, std::string_view v);
+    void field(const char *name, long long v);
+    void field(const char *name, double v, int precision);
+};
+
+void ExportWriter::begin()
+{
+    if (format == ExportFormat::Json)
+    {
+        out.write("{\"schema\":\"" EXPORT_SCHEMA "\",\"steps\":[");
+    }
+    else if (format == ExportFormat::Csv)
+    {
+        for (size_t c = 0; c < std::size(EXPORT_CSV_COLUMNS); ++c)
+        {
+            if (c > 0)
+                out.put(',');
+            out.write(EXPORT_CSV_COLUMNS[c]);
+        }
+        out.put('\n');
+    }
+}
+
+void ExportWriter::end()
+{
+    if (format == ExportFormat::Json)
+    {
+        out.write("]}\n");
+    }
+    out.flush();
+}
+
+void ExportWriter::step(const DataFrameAvg &avg, const DataFrame &df)
+{
+    if (format == ExportFormat::Json && nSteps > 0)
+        out.put(',');
+    nSteps++;
+
+    begin_record("step");
+    field("job_id", static_cast<long long>(avg.jobId));
+    field("step_id", static_cast<long long>(avg.stepId));
+    field("user", avg.user);
+    field("account", avg.account);
+    field("n_nodes", static_cast<long long>(avg.nNodes));
+    field("n_gpus", static_cast<long long>(avg.nGpus));
+    field("start_time_us", avg.startTime);
+    field("end_time_us", avg.endTime);
+    field("elapsed_s", (avg.endTime - avg.startTime) / 1e6, 3);
+    field("power_total_avg_w", avg.powerUsageAvg, 3);
+    field("energy_j", avg.energyConsumed * 3600., 3);
+    field("sm_util_avg_pct", static_cast<long long>(avg.smUtilizationAvg));
+    field("mem_bw_util_avg_pct", static_cast<long long>(avg.memoryUtilizationAvg));
+    field("max_memory_bytes", static_cast<long long>(avg.maxAllocatedMemory));
+    field("load_imbalance_ratio", avg.loadImbalance, 4);
+
+    if (format == ExportFormat::Json)
+    {
+        key("gpus");
+        out.put('[');
+    }
+    else
+    {
+        end_record();
+    }
+
+    for (size_t i = 0; i < df.gpuId.size(); ++i)
+    {
+        if (format == ExportFormat::Json && i > 0)
+            out.put(',');
+
+        begin_record("gpu");
+        if (format != ExportFormat::Json)
+        {
+            // Nested in the step otherwise
+            field("job_id", static_cast<long long>(df.jobId[i]));
+            field("step_id", static_cast<long long>(df.stepId[i]));
+        }
+        field("host", df.host[i]);
+        field("gpu_id", static_cast<long long>(df.gpuId[i]));
+        field("start_time_us", df.startTime[i]);
+        field("end_time_us", df.endTime[i]);
+        field("elapsed_s", (df.endTime[i] - df.startTime[i]) / 1e6, 3);
+        field("power_avg_w", df.powerUsageAvg[i], 3);
+        field("power_min_w", df.powerUsageMin[i], 3);
+        field("power_max_w", df.powerUsageMax[i], 3);
+        field("energy_j", df.energyConsumed[i], 3);
+        field("sm_util_avg_pct", static_cast<long long>(df.smUtilizationAvg[i]));
+        field("sm_util_min_pct", static_cast<long long>(df.smUtilizationMin[i]));
+        field("sm_util_max_pct", static_cast<long long>(df.smUtilizationMax[i]));
+        field("mem_bw_util_avg_pct", static_cast<long long>(df.memoryUtilizationAvg[i]));
+        field("mem_bw_util_min_pct", static_cast<long long>(df.memoryUtilizationMin[i]));
+        field("mem_bw_util_max_pct", static_cast<long long>(df.memoryUtilizationMax[i]));
+        field("max_memory_bytes", df.maxAllocatedMemory[i]);
+        end_record();
+    }
+
+    if (format == ExportFormat::Json)
+    {
+        out.put(']');
+        end_record();
+    }
+}
+
+void ExportWriter::begin_record(const char *kind)
+{
+    nFields = 0;
+    column = 0;
+    if (format == ExportFormat::Json)
+    {
+        out.put('{');
+        if (std::strcmp(kind, "gpu") == 0)
+            return; // the kind is implied by the nesting
+    }
+    else if (format == ExportFormat::Ndjson)
+    {
+        out.put('{');
+        field("schema", EXPORT_SCHEMA);
+    }
+    else
+    {
+        field("schema", EXPORT_SCHEMA);
+    }
+    field("record", kind);
+}
+
+void ExportWriter::end_record()
+{
+    if (format == ExportFormat::Csv)
+    {
+        for (; column < std::size(EXPORT_CSV_COLUMNS); ++column)
+        {
+            if (column > 0)
+                out.put(',');
+        }
+        out.put('\n');
+        return;
+    }
+
+    out.put('}');
+    if (format == ExportFormat::Ndjson)
+        out.put('\n');
+}
+
+void ExportWriter::key(const char *name)
+{
+    if (format == ExportFormat::Csv)
+    {
+        // Fields are written in column order, skip the ones this record does not have
+        while (column < std::size(EXPORT_CSV_COLUMNS) && std::strcmp(EXPORT_CSV_COLUMNS[column], name) != 0)
+        {
+            if (column > 0)
+                out.put(',');
+            column++;
+        }
+        if (column > 0)
+            out.put(',');
+        column++;
+        return;
+    }
+
+    if (nFields++ > 0)
+        out.put(',');
+    out.put('"');
+    out.write(name);
+    out.write("\":");
+}
+
+void ExportWriter::string(std::string_view v)
+{
+    if (format == ExportFormat::Csv)
+    {
+        if (v.find_first_of(",\"\n") == std::string_view::npos)
+        {
+            out.write(v);
+            return;
+        }
+
+        out.put('"');
+        for (char c : v)
+        {
+            if (c == '"')
+                out.put('"');
+            out.put(c);
+        }
+        out.put('"');
+        return;
+    }
+
+    static const char hex[] = "0123456789abcdef";
+    out.put('"');
+    for (char c : v)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out.put('\\');
+            out.put(c);
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            out.write("\\u00");
+            out.put(hex[(c >> 4) & 0xf]);
+            out.put(hex[c & 0xf]);
+        }
+        else
+        {
+            out.put(c);
+        }
+    }
+    out.put('"');
+}
+
+void ExportWriter::field(const char *name, std::string_view v)
+{
+    key(name);
+    string(v);
+}
+
+void ExportWriter::field(const char *name, long long v)
+{
+    key(name);
+    out.integer(v);
+}
+
+// NaN, e.g. a power DCGM failed to measure, is written as null or an empty cell
+void ExportWriter::field(const char *name, double v, int precision)
+{
+    key(name);
+    if (std::isnan(v))
+    {
+        if (format != ExportFormat::Csv)
+            out.write("null");
+        return;
+    }
+    out.fixed(v, precision);
+}
+
+// True if the step directory holds per-GPU data
+bool has_dataframe(const std::filesystem::path &step)
+{
+    for (const auto &entry : std::filesystem::directory_iterator(step))
+    {
+        if (entry.is_regular_file() && entry.path().extension() == ".csv")
+            return true;
+    }
+    return false;
+}
+
+// Exports all steps of all `inputs`, each a job or a step directory
+void export_stats(const std::vector<std::string> &inputs, const std::string &output, ExportFormat format)
+{
+    std::ofstream ofs;
+    if (!output.empty())
+    {
+        // Check if the output file already exists
+        if (std::filesystem::exists(output))
+        {
+            raise_error("Error: Output file already exists: \"" + output + "\"");
+        }
+
+        ofs.open(output);
+        if (!ofs.is_open())
+        {
+            raise_error("Error: Unable to open output file: \"" + output + "\"");
+        }
+    }
+
+    ExportWriter writer(output.empty() ? std::cout : ofs, format);
+    writer.begin();
+    for (const auto &input : inputs)
+    {
+        for (const auto &step : list_steps(input))
+        {
+            // Steps that failed before writing any data are skipped rather than
+            // aborting a whole batch
+            if (step.records.empty() && !has_dataframe(step.dir))
+            {
+                std::cerr << "WARNING: No data in step directory. Skipping: " << step.dir << std::endl;
+                continue;
+            }
+
+            DataFrameAvg avg;
+            DataFrame df = load_step(step, avg);
+            writer.step(avg, df);
+        }
+    }
+    writer.end();
+}
+
+#endif // JOBREPORT_EXPORT_HPP
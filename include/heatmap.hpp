@@ -0,0 +1,316 @@
+/*
+    Node x GPU heatmap.
+
+    One row per node, in the order of the DataFrame, and one column per
+    GPU index, each cell shaded by the value of the selected metric. The
+    grid is filled in a single pass over the metric column. When there
+    are more nodes than rows available, nodes are sorted by their mean
+    value and folded into percentile bands; each band shows the minimum
+    of its GPUs, so that a bad node remains visible, along with the node
+    of its lowest GPU.
+*/
+
+#ifndef JOBREPORT_HEATMAP_HPP
+#define JOBREPORT_HEATMAP_HPP
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <numeric>
+
+#include "dataframe.hpp"
+#include "table_writer.hpp"
+
+#define HEATMAP_HOST_WIDTH 32 // Longer host names are truncated
+#define HEATMAP_MIN_ROWS 4    // Fewest node rows shown when folding
+
+enum class HeatmapMetric
+{
+    None = 0,
+    SmUtilization,
+    MemoryUtilization,
+    Power,
+    MaxMemory
+};
+
+// Parses the name given on the command line, None if unknown
+HeatmapMetric parse_heatmap_metric(const std::string &name)
+{
+    if (name == "sm")
+        return HeatmapMetric::SmUtilization;
+    if (name == "membw")
+        return HeatmapMetric::MemoryUtilization;
+    if (name == "power")
+        return HeatmapMetric::Power;
+    if (name == "memory")
+        return HeatmapMetric::MaxMemory;
+    return HeatmapMetric::None;
+}
+
+struct Heatmap
+{
+    HeatmapMetric metric = HeatmapMetric::None;
+    std::vector<std::string> hosts;
+    size_t nGpus = 0;            // columns, largest GPU index + 1
+    std::vector<double> values;  // hosts.size() x nGpus, NaN where there is no GPU
+    double low = 0;              // value of the lightest shade
+    double high = 0;             // value of the darkest shade
+
+    bool empty() const { return hosts.empty(); }
+    double at(size_t node, size_t gpu) const { return values[node * nGpus + gpu]; }
+};
+
+Heatmap compute_heatmap(const DataFrame &df, HeatmapMetric metric)
+{
+    Heatmap map;
+    map.metric = metric;
+
+    size_t n = df.gpuId.size();
+    if (n == 0 || metric == HeatmapMetric::None)
+        return map;
+
+    PROFILE_SCOPE("compute_heatmap");
+
+    map.nGpus = *std::max_element(df.gpuId.begin(), df.gpuId.end()) + 1;
+
+    // Rows of a node are contiguous
+    size_t nNodes = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (i == 0 || df.host[i] != df.host[i - 1])
+            nNodes++;
+    }
+    map.hosts.reserve(nNodes);
+    map.values.assign(nNodes * map.nGpus, std::numeric_limits<double>::quiet_NaN());
+
+    double max = 0;
+    size_t node = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (i == 0 || df.host[i] != df.host[i - 1])
+        {
+            node = map.hosts.size();
+            map.hosts.push_back(df.host[i]);
+        }
+
+        double v;
+        switch (metric)
+        {
+        case HeatmapMetric::SmUtilization:
+            v = df.smUtilizationAvg[i];
+            break;
+        case HeatmapMetric::MemoryUtilization:
+            v = df.memoryUtilizationAvg[i];
+            break;
+        case HeatmapMetric::Power:
+            v = df.powerUsageAvg[i];
+            break;
+        default:
+            v = static_cast<double>(df.maxAllocatedMemory[i]);
+            break;
+        }
+
+        map.values[node * map.nGpus + df.gpuId[i]] = v;
+        if (v > max)
+            max = v;
+    }
+
+    // Utilizations are shaded on their absolute scale, the rest relative to the largest value
+    map.high = metric == HeatmapMetric::SmUtilization || metric == HeatmapMetric::MemoryUtilization ? 100. : max;
+    return map;
+}
+
+const char *heatmap_metric_name(HeatmapMetric metric)
+{
+    switch (metric)
+    {
+    case HeatmapMetric::SmUtilization:
+        return "SM Utilization";
+    case HeatmapMetric::MemoryUtilization:
+        return "Memory BW Utilization";
+    case HeatmapMetric::Power:
+        return "Power";
+    case HeatmapMetric::MaxMemory:
+        return "Max Memory Allocated";
+    default:
+        return "";
+    }
+}
+
+struct HeatmapStyle
+{
+    bool color = false;  // 256-color background instead of block characters
+    size_t maxRows = 0;  // rows available for nodes, 0 for unlimited
+};
+
+// Draws the shade of `v` as a two characters wide cell
+void write_heatmap_cell(OutputBuffer &out, double v, const Heatmap &map, const HeatmapStyle &style)
+{
+    // Shades from low (red, light) to high (green, dark)
+    static const int colors[] = {196, 202, 208, 214, 220, 226, 190, 154, 118, 82, 46};
+    static const char *blocks[] = {"  ", "░░", "▒▒", "▓▓", "██"};
+
+    if (std::isnan(v))
+    {
+        out.write(" ·");
+        return;
+    }
+
+    double range = map.high - map.low;
+    double x = range > 0 ? std::clamp((v - map.low) / range, 0.0, 1.0) : 1.0;
+
+    if (style.color)
+    {
+        out.write("\033[48;5;");
+        out.integer(colors[static_cast<size_t>(x * 10 + 0.5)]);
+        out.write("m  \033[0m");
+    }
+    else
+    {
+        out.write(blocks[static_cast<size_t>(x * 4 + 0.5)]);
+    }
+}
+
+void write_heatmap(std::ostream &os, const Heatmap &map, const HeatmapStyle &style = HeatmapStyle())
+{
+    OutputBuffer out(os);
+    size_t nNodes = map.hosts.size();
+
+    size_t label = 4;
+    for (const auto &host : map.hosts)
+        label = std::max(label, std::min<size_t>(host.size(), HEATMAP_HOST_WIDTH));
+
+    // Fold nodes into bands if they do not fit, ordered by their mean value
+    bool fold = style.maxRows > 0 && nNodes > style.maxRows;
+    size_t nRows = fold ? std::max<size_t>(style.maxRows, HEATMAP_MIN_ROWS) : nNodes;
+    std::vector<size_t> order(nNodes);
+    std::iota(order.begin(), order.end(), 0);
+    if (fold)
+    {
+        std::vector<double> mean(nNodes, 0.0);
+        for (size_t node = 0; node < nNodes; ++node)
+        {
+            size_t count = 0;
+            for (size_t g = 0; g < map.nGpus; ++g)
+            {
+                double v = map.at(node, g);
+                if (!std::isnan(v))
+                {
+                    mean[node] += v;
+                    count++;
+                }
+            }
+            mean[node] = count > 0 ? mean[node] / count : std::numeric_limits<double>::infinity();
+        }
+        std::sort(order.begin(), order.end(), [&mean](size_t a, size_t b) { return mean[a] < mean[b]; });
+        label = std::max<size_t>(label, 11); // "P100-P100"
+    }
+
+    // Header with the GPU indices, cells wider than two characters to fit three digit indices apart
+    auto digits = [](size_t v) {
+        size_t n = 1;
+        for (; v >= 10; v /= 10)
+            n++;
+        return n;
+    };
+    size_t largest = digits(map.nGpus > 0 ? map.nGpus - 1 : 0);
+    size_t width = largest > 2 ? largest + 1 : 2;
+    out.fill(' ', label + 1);
+    for (size_t g = 0; g < map.nGpus; ++g)
+    {
+        out.fill(' ', width - digits(g));
+        out.integer(g);
+    }
+    out.put('\n');
+
+    std::vector<double> band(map.nGpus);
+    for (size_t r = 0; r < nRows; ++r)
+    {
+        size_t first = r * nNodes / nRows;
+        size_t last = (r + 1) * nNodes / nRows;
+        if (first == last)
+            continue;
+
+        std::fill(band.begin(), band.end(), std::numeric_limits<double>::quiet_NaN());
+        size_t lowest = order[first];
+        double lowest_value = std::numeric_limits<double>::infinity();
+        for (size_t k = first; k < last; ++k)
+        {
+            for (size_t g = 0; g < map.nGpus; ++g)
+            {
+                double v = map.at(order[k], g);
+                if (!std::isnan(v) && !(v >= band[g]))
+                    band[g] = v;
+                if (v < lowest_value)
+                {
+                    lowest_value = v;
+                    lowest = order[k];
+                }
+            }
+        }
+
+        Cell name;
+        if (fold)
+        {
+            name.append("P").integer(100 * first / nNodes).append("-P").integer(100 * last / nNodes);
+        }
+        else
+        {
+            name.append(std::string_view(map.hosts[order[first]]).substr(0, HEATMAP_HOST_WIDTH));
+        }
+        out.write(name.view());
+        out.fill(' ', label + 1 - name.size);
+
+        for (size_t g = 0; g < map.nGpus; ++g)
+        {
+            out.fill(' ', width - 2);
+            write_heatmap_cell(out, band[g], map, style);
+        }
+
+        if (fold)
+        {
+            out.write("  ");
+            out.integer(last - first);
+            out.write(last - first == 1 ? " node, lowest GPU on " : " nodes, lowest GPU on ");
+            out.write(map.hosts[lowest]);
+        }
+        out.put('\n');
+    }
+
+    // Legend
+    out.put('\n');
+    out.write(heatmap_metric_name(map.metric));
+    out.write(": ");
+    for (double x : {0.0, 0.25, 0.5, 0.75, 1.0})
+    {
+        double v = map.low + x * (map.high - map.low);
+        write_heatmap_cell(out, v, map, style);
+        out.put(' ');
+        if (map.metric == HeatmapMetric::Power)
+        {
+            out.fixed(v, 0);
+            out.write(" W");
+        }
+        else if (map.metric == HeatmapMetric::MaxMemory)
+        {
+            out.fixed(v / (1 << 30), 1);
+            out.write(" GiB");
+        }
+        else
+        {
+            out.fixed(v, 0);
+            out.write(" %");
+        }
+        out.write("  ");
+    }
+    out.put('\n');
+    if (fold)
+    {
+        out.write("Nodes sorted by mean value and folded into percentile bands, showing the minimum of each GPU index\n");
+    }
+}
+
+#endif // JOBREPORT_HEATMAP_HPP
@@ -0,0 +1,1050 @@
+/*
+    Cross-job history store.
+
+    An opt-in, append-only store of step summaries: one row per step,
+    with the averages of the step and aggregates over its GPUs. Rows are
+    partitioned by the month their step started in, one file per month,
+    each a sequence of columnar chunks appended by `jobreport archive`,
+    or by the monitor at the end of each step when it is given a store
+    (--history or JOBREPORT_HISTORY).
+    All columns are arrays of doubles, which hold the integer ids and
+    microsecond timestamps exactly; the user and account columns hold
+    indices into the string dictionary of their chunk.
+
+    The index file lists every chunk with its time range and 64-bit
+    Bloom filters of its users and accounts. A query reads the index,
+    skips the chunks that cannot match its time range, user or account,
+    reads each remaining chunk with a single pread and evaluates its
+    filters one column at a time into a row mask, before aggregating the
+    selected rows by group.
+
+    A chunk is appended before its index entry, each in a single
+    O_APPEND write, so concurrent archives do not interleave and a crash
+    in between leaves an unindexed chunk that is never read.
+
+    The monitor appends a chunk of one row per step, without reading the
+    index: the .archived marker of the step directory already keeps it
+    from archiving a step twice. Every HISTORY_COMPACT_EVERY index
+    entries it compacts the store, as `jobreport archive` does after
+    appending: the chunks of a month with fewer than HISTORY_COMPACT_ROWS
+    rows are merged into one chunk appended to the partition, and the
+    index is replaced by one without them. The merged chunks stay in the
+    partition, unreferenced, so a query reading the previous index still
+    finds them. Appends share the lock file of the store, a compaction
+    holds it alone.
+
+    Layout, native endianness:
+        <store>/index           HistoryIndexEntry...
+        <store>/lock            empty, locked with flock
+        <store>/<YYYY-MM>.jrh   chunks of HistoryChunkHeader, the
+                                dictionary (u32 length + bytes per
+                                string, padded to 8 bytes), then the
+                                columns of nRows doubles each
+*/
+
+#ifndef JOBREPORT_HISTORY_HPP
+#define JOBREPORT_HISTORY_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <limits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include "dataframe.hpp"
+#include "dataframe_io.hpp"
+#include "export.hpp"
+#include "manifest.hpp"
+#include "selection.hpp"
+#include "table_writer.hpp"
+
+#define HISTORY_INDEX_FILE "index"
+#define HISTORY_LOCK_FILE "lock"
+#define HISTORY_MARKER_FILE ".archived" // in a step directory the monitor has archived
+#define HISTORY_EXTENSION ".jrh"
+#define HISTORY_CHUNK_MAGIC "JRHC"
+#define HISTORY_INDEX_MAGIC "JRHI"
+#define HISTORY_VERSION 1
+#define HISTORY_COMPACT_ROWS 64  // chunks with fewer rows are merged by a compaction
+#define HISTORY_COMPACT_EVERY 32 // index entries between two compactions by the monitor
+
+// Columns of the store; only ever append to this list
+enum HistoryColumn
+{
+    HistoryJob,
+    HistoryStep,
+    HistoryUser,
+    HistoryAccount,
+    HistoryStart,     // us
+    HistoryEnd,       // us
+    HistoryNodes,
+    HistoryGpus,
+    HistoryGpuHours,
+    HistoryEnergy,    // J
+    HistoryPower,     // W, average of the step
+    HistorySm,        // %, average over the GPUs
+    HistoryMembw,     // %
+    HistoryMemory,    // bytes, largest over the GPUs
+    HistoryImbalance, // max/mean - 1 of the SM utilization of the GPUs
+    HistorySmGpuMin,  // %, least utilized GPU
+    HistorySmGpuMax,  // %, most utilized GPU
+    HistoryIdleGpus,  // GPUs with 0 % SM utilization
+    HistoryColumnCount
+};
+
+const char *HISTORY_COLUMNS[HistoryColumnCount] = {
+    "job", "step", "user", "account", "start", "end", "nodes", "gpus",
+    "gpu_hours", "energy", "power", "sm", "membw", "memory", "imbalance",
+    "sm_gpu_min", "sm_gpu_max", "idle_gpus"};
+
+struct HistoryChunkHeader
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t nColumns;
+    uint32_t nRows;
+    uint32_t nStrings;
+    uint32_t dictionarySize; // bytes, padded to 8
+    uint32_t reserved;
+};
+
+struct HistoryIndexEntry
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t size;
+    uint32_t month;     // partition, as YYYYMM
+    uint32_t nRows;
+    uint64_t offset;    // of the chunk in the partition file
+    uint64_t bytes;
+    int64_t minStart;   // us
+    int64_t maxStart;   // us
+    uint64_t users;     // Bloom filters of the strings of the chunk
+    uint64_t accounts;
+};
+
+static_assert(sizeof(HistoryIndexEntry) == 64, "Index entries have a fixed size");
+
+// One row of the store; the user and account columns are set when encoded
+struct HistoryRow
+{
+    std::string user;
+    std::string account;
+    double values[HistoryColumnCount] = {};
+};
+
+uint64_t history_bloom(std::string_view s)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (char c : s)
+    {
+        h ^= static_cast<unsigned char>(c);
+        h *= 0x100000001b3ULL;
+    }
+    return (1ULL << (h & 63)) | (1ULL << ((h >> 32) & 63));
+}
+
+// Partition of a start time, as YYYYMM in UTC
+uint32_t history_month(long long start)
+{
+    std::time_t t = static_cast<std::time_t>(start / 1000000);
+    std::tm tm;
+    gmtime_r(&t, &tm);
+    return (tm.tm_year + 1900) * 100 + tm.tm_mon + 1;
+}
+
+std::filesystem::path history_partition(const std::filesystem::path &store, uint32_t month)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%04u-%02u" HISTORY_EXTENSION, month / 100, month % 100);
+    return store / name;
+}
+
+int history_column(const std::string &name)
+{
+    for (int c = 0; c < HistoryColumnCount; ++c)
+    {
+        if (name == HISTORY_COLUMNS[c])
+            return c;
+    }
+    return -1;
+}
+
+bool is_history_string_column(int c)
+{
+    return c == HistoryUser || c == HistoryAccount;
+}
+
+// Summary row of a loaded step
+HistoryRow history_row(const DataFrameAvg &avg, const DataFrame &df)
+{
+    HistoryRow row;
+    row.user = avg.user;
+    row.account = avg.account;
+
+    double *v = row.values;
+    v[HistoryJob] = avg.jobId;
+    v[HistoryStep] = avg.stepId;
+    v[HistoryStart] = static_cast<double>(avg.startTime);
+    v[HistoryEnd] = static_cast<double>(avg.endTime);
+    v[HistoryNodes] = avg.nNodes;
+    v[HistoryGpus] = avg.nGpus;
+    v[HistoryEnergy] = avg.energyConsumed * 3600.; // Wh to J
+    v[HistoryPower] = avg.powerUsageAvg;
+    v[HistorySm] = avg.smUtilizationAvg;
+    v[HistoryMembw] = avg.memoryUtilizationAvg;
+    v[HistoryMemory] = avg.maxAllocatedMemory;
+    v[HistoryImbalance] = avg.loadImbalance;
+
+    double gpu_hours = 0;
+    int sm_min = std::numeric_limits<int>::max();
+    int sm_max = 0;
+    size_t idle = 0;
+    for (size_t i = 0; i < df.gpuId.size(); ++i)
+    {
+        gpu_hours += (df.endTime[i] - df.startTime[i]) / 3.6e9;
+        sm_min = std::min(sm_min, df.smUtilizationAvg[i]);
+        sm_max = std::max(sm_max, df.smUtilizationAvg[i]);
+        idle += df.smUtilizationAvg[i] == 0;
+    }
+    v[HistoryGpuHours] = gpu_hours;
+    v[HistorySmGpuMin] = df.gpuId.empty() ? std::numeric_limits<double>::quiet_NaN() : sm_min;
+    v[HistorySmGpuMax] = df.gpuId.empty() ? std::numeric_limits<double>::quiet_NaN() : sm_max;
+    v[HistoryIdleGpus] = static_cast<double>(idle);
+    return row;
+}
+
+// Encodes rows of one partition as a chunk, and fills its index entry
+std::string encode_history_chunk(std::vector<HistoryRow> &rows, HistoryIndexEntry &entry)
+{
+    std::memset(&entry, 0, sizeof(entry));
+    std::memcpy(entry.magic, HISTORY_INDEX_MAGIC, 4);
+    entry.version = HISTORY_VERSION;
+    entry.size = sizeof(HistoryIndexEntry);
+    entry.nRows = rows.size();
+    entry.minStart = std::numeric_limits<int64_t>::max();
+    entry.maxStart = std::numeric_limits<int64_t>::min();
+
+    std::vector<std::string> strings;
+    std::unordered_map<std::string, uint32_t> ids;
+    auto intern = [&](const std::string &s) {
+        auto it = ids.emplace(s, strings.size());
+        if (it.second)
+            strings.push_back(s);
+        return static_cast<double>(it.first->second);
+    };
+
+    for (auto &row : rows)
+    {
+        row.values[HistoryUser] = intern(row.user);
+        row.values[HistoryAccount] = intern(row.account);
+        entry.users |= history_bloom(row.user);
+        entry.accounts |= history_bloom(row.account);
+
+        int64_t start = static_cast<int64_t>(row.values[HistoryStart]);
+        entry.minStart = std::min(entry.minStart, start);
+        entry.maxStart = std::max(entry.maxStart, start);
+    }
+
+    std::string dictionary;
+    for (const auto &s : strings)
+    {
+        uint32_t size = s.size();
+        dictionary.append(reinterpret_cast<const char *>(&size), sizeof(size));
+        dictionary.append(s);
+    }
+    dictionary.resize((dictionary.size() + 7) / 8 * 8, '\0');
+
+    HistoryChunkHeader header = {};
+    std::memcpy(header.magic, HISTORY_CHUNK_MAGIC, 4);
+    header.version = HISTORY_VERSION;
+    header.nColumns = HistoryColumnCount;
+    header.nRows = rows.size();
+    header.nStrings = strings.size();
+    header.dictionarySize = dictionary.size();
+
+    std::string chunk(reinterpret_cast<const char *>(&header), sizeof(header));
+    chunk.append(dictionary);
+    for (int c = 0; c < HistoryColumnCount; ++c)
+    {
+        for (const auto &row : rows)
+            chunk.append(reinterpret_cast<const char *>(&row.values[c]), sizeof(double));
+    }
+
+    entry.bytes = chunk.size();
+    return chunk;
+}
+
+// A chunk read back: its header and dictionary, then only the columns used
+class HistoryChunk
+{
+public:
+    size_t nRows = 0;
+    std::vector<std::string_view> strings;
+
+    bool read(int fd, const HistoryIndexEntry &entry);
+    bool load(int c);
+    const double *column(int c) const { return columns[c].data(); }
+
+    // Index of `s` in the dictionary, -1 if the chunk does not have it
+    double find(const std::string &s) const
+    {
+        for (size_t i = 0; i < strings.size(); ++i)
+        {
+            if (strings[i] == s)
+                return static_cast<double>(i);
+        }
+        return -1;
+    }
+
+private:
+    int fd = -1;
+    uint64_t columnsOffset = 0;
+    std::string dictionary;
+    std::vector<double> columns[HistoryColumnCount];
+};
+
+bool HistoryChunk::read(int fd, const HistoryIndexEntry &entry)
+{
+    this->fd = fd;
+    for (auto &column : columns)
+        column.clear();
+
+    HistoryChunkHeader header;
+    if (entry.bytes < sizeof(header)
+        || pread(fd, &header, sizeof(header), entry.offset) != static_cast<ssize_t>(sizeof(header)))
+        return false;
+
+    if (std::memcmp(header.magic, HISTORY_CHUNK_MAGIC, 4) != 0 || header.version != HISTORY_VERSION
+        || header.nRows != entry.nRows || header.nColumns < HistoryColumnCount
+        || sizeof(header) + header.dictionarySize + uint64_t(header.nColumns) * header.nRows * sizeof(double) != entry.bytes)
+        return false;
+
+    nRows = header.nRows;
+    columnsOffset = entry.offset + sizeof(header) + header.dictionarySize;
+
+    dictionary.resize(header.dictionarySize);
+    if (pread(fd, dictionary.data(), dictionary.size(), entry.offset + sizeof(header)) != static_cast<ssize_t>(dictionary.size()))
+        return false;
+
+    strings.clear();
+    const char *s = dictionary.data();
+    const char *end = s + dictionary.size();
+    for (uint32_t i = 0; i < header.nStrings; ++i)
+    {
+        uint32_t size;
+        if (static_cast<size_t>(end - s) < sizeof(size))
+            return false;
+        std::memcpy(&size, s, sizeof(size));
+        s += sizeof(size);
+        if (static_cast<size_t>(end - s) < size)
+            return false;
+        strings.emplace_back(s, size);
+        s += size;
+    }
+    return true;
+}
+
+// Reads column `c` of the chunk, if not read yet
+bool HistoryChunk::load(int c)
+{
+    if (columns[c].size() == nRows && nRows > 0)
+        return true;
+
+    columns[c].resize(nRows);
+    ssize_t bytes = nRows * sizeof(double);
+    return pread(fd, columns[c].data(), bytes, columnsOffset + c * bytes) == bytes;
+}
+
+std::vector<HistoryIndexEntry> read_history_index(const std::filesystem::path &store)
+{
+    std::vector<HistoryIndexEntry> entries;
+    std::ifstream ifs(store / HISTORY_INDEX_FILE, std::ios::binary);
+    if (!ifs.is_open())
+        return entries;
+
+    std::string data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    for (size_t offset = 0; offset + sizeof(HistoryIndexEntry) <= data.size(); offset += sizeof(HistoryIndexEntry))
+    {
+        HistoryIndexEntry entry;
+        std::memcpy(&entry, data.data() + offset, sizeof(entry));
+        if (std::memcmp(entry.magic, HISTORY_INDEX_MAGIC, 4) != 0 || entry.size != sizeof(HistoryIndexEntry))
+        {
+            std::cerr << "WARNING: Corrupted history index, ignoring the rest of it: " << store / HISTORY_INDEX_FILE << std::endl;
+            break;
+        }
+        if (entry.version == HISTORY_VERSION)
+            entries.push_back(entry);
+    }
+    return entries;
+}
+
+// True if the store already has the step; only the chunks whose time range
+// covers the start of the step are read
+bool history_contains(const std::filesystem::path &store, const std::vector<HistoryIndexEntry> &entries,
+                      const HistoryRow &row)
+{
+    int64_t start = static_cast<int64_t>(row.values[HistoryStart]);
+    HistoryChunk chunk;
+    for (const auto &entry : entries)
+    {
+        if (start < entry.minStart || start > entry.maxStart || !(entry.users & history_bloom(row.user)))
+            continue;
+
+        int fd = open(history_partition(store, entry.month).c_str(), O_RDONLY);
+        if (fd < 0)
+            continue;
+        bool ok = chunk.read(fd, entry) && chunk.load(HistoryJob) && chunk.load(HistoryStep);
+        close(fd);
+        if (!ok)
+            continue;
+
+        const double *job = chunk.column(HistoryJob);
+        const double *step = chunk.column(HistoryStep);
+        for (size_t i = 0; i < chunk.nRows; ++i)
+        {
+            if (job[i] == row.values[HistoryJob] && step[i] == row.values[HistoryStep])
+                return true;
+        }
+    }
+    return false;
+}
+
+// Takes the lock of the store, shared by appends and exclusive for a compaction;
+// returns its descriptor, which releases it when closed, or -1
+int lock_history(const std::filesystem::path &store, int operation)
+{
+    int fd = open((store / HISTORY_LOCK_FILE).c_str(), O_RDONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd >= 0 && flock(fd, operation) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Appends the rows of each month as one chunk, then its index entry; on failure
+// `failed` is the file that could not be written
+bool append_history_chunks(const std::filesystem::path &store, std::map<uint32_t, std::vector<HistoryRow>> &partitions,
+                           std::filesystem::path &failed)
+{
+    int lock = lock_history(store, LOCK_SH);
+    if (lock < 0)
+    {
+        failed = store / HISTORY_LOCK_FILE;
+        return false;
+    }
+    bool ok = true;
+    for (auto &[month, rows] : partitions)
+    {
+        HistoryIndexEntry entry;
+        std::string chunk = encode_history_chunk(rows, entry);
+        entry.month = month;
+
+        std::filesystem::path partition = history_partition(store, month);
+        uint64_t offset = 0;
+        if (!append_block(partition, chunk, offset))
+        {
+            failed = partition;
+            ok = false;
+            break;
+        }
+
+        entry.offset = offset;
+        std::string record(reinterpret_cast<const char *>(&entry), sizeof(entry));
+        if (!append_block(store / HISTORY_INDEX_FILE, record, offset))
+        {
+            failed = store / HISTORY_INDEX_FILE;
+            ok = false;
+            break;
+        }
+    }
+    close(lock);
+    return ok;
+}
+
+// Rows of a chunk read back, false if it cannot be read
+bool read_history_rows(int fd, const HistoryIndexEntry &entry, std::vector<HistoryRow> &rows)
+{
+    HistoryChunk chunk;
+    if (!chunk.read(fd, entry))
+        return false;
+    for (int c = 0; c < HistoryColumnCount; ++c)
+    {
+        if (!chunk.load(c))
+            return false;
+    }
+
+    for (size_t i = 0; i < chunk.nRows; ++i)
+    {
+        HistoryRow row;
+        for (int c = 0; c < HistoryColumnCount; ++c)
+            row.values[c] = chunk.column(c)[i];
+        size_t user = static_cast<size_t>(row.values[HistoryUser]);
+        size_t account = static_cast<size_t>(row.values[HistoryAccount]);
+        if (user >= chunk.strings.size() || account >= chunk.strings.size())
+            return false;
+        row.user = chunk.strings[user];
+        row.account = chunk.strings[account];
+        rows.push_back(std::move(row));
+    }
+    return true;
+}
+
+// Merges the chunks of each month with fewer than HISTORY_COMPACT_ROWS rows into one and
+// replaces the index; returns the number of chunks merged, -1 on failure. Unless `wait`,
+// it does nothing while another process uses the store.
+long compact_history(const std::filesystem::path &store, bool wait)
+{
+    int lock = lock_history(store, LOCK_EX | (wait ? 0 : LOCK_NB));
+    if (lock < 0)
+        return wait ? -1 : 0;
+
+    // Entries of other versions or a damaged index would be lost by the rewrite
+    std::vector<HistoryIndexEntry> entries = read_history_index(store);
+    std::error_code ec;
+    uint64_t size = std::filesystem::file_size(store / HISTORY_INDEX_FILE, ec);
+    if (ec || size != entries.size() * sizeof(HistoryIndexEntry))
+    {
+        close(lock);
+        return ec ? 0 : -1;
+    }
+
+    std::map<uint32_t, std::vector<size_t>> small;
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        if (entries[i].nRows < HISTORY_COMPACT_ROWS)
+            small[entries[i].month].push_back(i);
+    }
+
+    std::vector<bool> merged(entries.size(), false);
+    std::vector<HistoryIndexEntry> added;
+    long nMerged = 0;
+    bool ok = true;
+    for (const auto &[month, indices] : small)
+    {
+        if (indices.size() < 2)
+            continue;
+
+        std::filesystem::path partition = history_partition(store, month);
+        int fd = open(partition.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+        std::vector<HistoryRow> rows;
+        std::vector<size_t> read;
+        for (size_t i : indices)
+        {
+            // A chunk that cannot be read is left as it is
+            std::vector<HistoryRow> chunk;
+            if (read_history_rows(fd, entries[i], chunk))
+            {
+                rows.insert(rows.end(), std::make_move_iterator(chunk.begin()), std::make_move_iterator(chunk.end()));
+                read.push_back(i);
+            }
+        }
+        close(fd);
+        if (read.size() < 2)
+            continue;
+
+        HistoryIndexEntry entry;
+        std::string chunk = encode_history_chunk(rows, entry);
+        entry.month = month;
+        uint64_t offset = 0;
+        if (!append_block(partition, chunk, offset))
+        {
+            ok = false;
+            break;
+        }
+        entry.offset = offset;
+        added.push_back(entry);
+        for (size_t i : read)
+            merged[i] = true;
+        nMerged += read.size();
+    }
+
+    if (ok && nMerged > 0)
+    {
+        std::string index;
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            if (!merged[i])
+                index.append(reinterpret_cast<const char *>(&entries[i]), sizeof(HistoryIndexEntry));
+        }
+        for (const auto &entry : added)
+            index.append(reinterpret_cast<const char *>(&entry), sizeof(HistoryIndexEntry));
+
+        std::string name = (store / (std::string(HISTORY_INDEX_FILE) + ".tmp.XXXXXX")).string();
+        int fd = mkstemp(name.data());
+        ok = fd >= 0 && fchmod(fd, 0644) == 0
+            && write(fd, index.data(), index.size()) == static_cast<ssize_t>(index.size());
+        if (fd >= 0 && close(fd) != 0)
+            ok = false;
+        if (ok)
+        {
+            std::filesystem::rename(name, store / HISTORY_INDEX_FILE, ec);
+            ok = !ec;
+        }
+        if (!ok && fd >= 0)
+            std::filesystem::remove(name, ec);
+    }
+
+    close(lock);
+    return ok ? nMerged : -1;
+}
+
+// Appends the steps of `inputs`, each a job or a step directory, that the store does not have yet
+void archive_steps(const std::filesystem::path &store, const std::vector<std::string> &inputs)
+{
+    try {
+        std::filesystem::create_directories(store);
+    } catch (std::exception &e) {
+        raise_error("Error: Unable to create history store: \"" + store.string() + "\"");
+    }
+
+    std::vector<HistoryIndexEntry> entries = read_history_index(store);
+
+    std::map<uint32_t, std::vector<HistoryRow>> partitions;
+    std::set<std::pair<double, double>> added;
+    size_t nSkipped = 0;
+    for (const auto &input : inputs)
+    {
+        for (const auto &step : list_steps(input))
+        {
+            if (step.records.empty() && !has_dataframe(step.dir))
+            {
+                std::cerr << "WARNING: No data in step directory. Skipping: " << step.dir << std::endl;
+                continue;
+            }
+
+            DataFrameAvg avg;
+            DataFrame df = load_step(step, avg);
+            HistoryRow row = history_row(avg, df);
+
+            std::pair<double, double> key(row.values[HistoryJob], row.values[HistoryStep]);
+            if (added.count(key) || history_contains(store, entries, row))
+            {
+                nSkipped++;
+                continue;
+            }
+            added.insert(key);
+            partitions[history_month(avg.startTime)].push_back(std::move(row));
+        }
+    }
+
+    std::filesystem::path failed;
+    if (!append_history_chunks(store, partitions, failed))
+    {
+        raise_error("Error: Unable to write to history store: \"" + failed.string() + "\"");
+    }
+
+    // Also merges the chunks the monitor appended one step at a time
+    long nMerged = compact_history(store, true);
+    if (nMerged < 0)
+    {
+        std::cerr << "WARNING: Could not compact the history store: " << store << std::endl;
+    }
+
+    std::cout << "Archived " << added.size() << " steps to " << store;
+    if (nSkipped > 0)
+    {
+        std::cout << ", " << nSkipped << " already stored";
+    }
+    if (nMerged > 0)
+    {
+        std::cout << ", " << nMerged << " chunks compacted";
+    }
+    std::cout << std::endl;
+}
+
+// Appends a finished step to the store, as the monitor does at the end of a step when
+// a store is configured. The caller makes sure a step is archived once. Failures are
+// warnings, the report itself is complete; returns false on failure.
+bool archive_finished_step(const std::filesystem::path &store, const StepFiles &step)
+{
+    std::map<uint32_t, std::vector<HistoryRow>> partitions;
+    std::filesystem::path failed;
+    try {
+        std::filesystem::create_directories(store);
+
+        DataFrameAvg avg;
+        DataFrame df = load_step(step, avg, false);
+        if (df.gpuId.empty())
+        {
+            std::cerr << "WARNING: Could not archive " << step.dir << " to the history store: no data could be read" << std::endl;
+            return false;
+        }
+        partitions[history_month(avg.startTime)].push_back(history_row(avg, df));
+    } catch (std::exception &e) {
+        std::cerr << "WARNING: Could not archive " << step.dir << " to the history store: " << e.what() << std::endl;
+        return false;
+    }
+
+    if (!append_history_chunks(store, partitions, failed))
+    {
+        std::cerr << "WARNING: Could not archive " << step.dir << " to the history store " << failed << std::endl;
+        return false;
+    }
+
+    // The size of the index tells how many chunks were appended since it was last compacted
+    std::error_code ec;
+    uint64_t size = std::filesystem::file_size(store / HISTORY_INDEX_FILE, ec);
+    if (!ec && (size / sizeof(HistoryIndexEntry)) % HISTORY_COMPACT_EVERY == 0
+        && compact_history(store, false) < 0)
+    {
+        std::cerr << "WARNING: Could not compact the history store: " << store << std::endl;
+    }
+    return true;
+}
+
+// Parses a date, YYYY-MM-DD[THH:MM[:SS]] in local time, or a time before now, <N>h, <N>d or <N>w
+bool parse_history_time(const std::string &text, long long &us)
+{
+    char *end = nullptr;
+    long long n = std::strtoll(text.c_str(), &end, 10);
+    std::string unit(end);
+    if (end != text.c_str() && n >= 0 && (unit == "h" || unit == "d" || unit == "w"))
+    {
+        long long seconds = n * (unit == "h" ? 3600 : unit == "d" ? 86400 : 7 * 86400);
+        us = (static_cast<long long>(std::time(nullptr)) - seconds) * 1000000;
+        return true;
+    }
+
+    std::tm tm = {};
+    int matched = std::sscanf(text.c_str(), "%4d-%2d-%2dT%2d:%2d:%2d",
+                              &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+    if (matched != 3 && matched < 5)
+        return false;
+
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    std::time_t t = std::mktime(&tm);
+    if (t == -1)
+        return false;
+    us = static_cast<long long>(t) * 1000000;
+    return true;
+}
+
+// Parses a filter on a column of the store
+bool parse_history_filter(const std::string &expr, RowFilter &filter)
+{
+    if (!parse_comparison(expr, filter))
+        return false;
+
+    int c = history_column(filter.column);
+    if (c < 0)
+        return false;
+    if (is_history_string_column(c))
+        return filter.op == CompareOp::Equal || filter.op == CompareOp::NotEqual;
+    return parse_value(filter.text, filter.value);
+}
+
+struct HistoryQuery
+{
+    std::vector<RowFilter> where;
+    long long since = std::numeric_limits<long long>::min(); // bounds of the step start time, us
+    long long until = std::numeric_limits<long long>::max();
+    std::string groupBy; // user, account, job, month, day or empty for all steps
+};
+
+bool is_history_group(const std::string &name)
+{
+    return name.empty() || name == "user" || name == "account" || name == "job" || name == "month" || name == "day";
+}
+
+// Aggregates of the steps of a group; utilizations are weighted by GPU hours
+struct HistoryGroup
+{
+    size_t nSteps = 0;
+    size_t nJobs = 0;
+    std::vector<double> jobs;  // job of each step, made unique into nJobs
+    double gpuHours = 0;
+    double energy = 0;         // J
+    double smGpuHours = 0;     // sum of SM utilization x GPU hours
+    double membwGpuHours = 0;
+    double idleGpus = 0;
+    double gpus = 0;
+    double maxImbalance = std::numeric_limits<double>::quiet_NaN();
+};
+
+struct HistoryResult
+{
+    // Ordered by number, then label; jobs are labelled when written
+    std::map<std::pair<double, std::string>, HistoryGroup> groups;
+    size_t nChunks = 0;        // chunks in the store
+    size_t nChunksRead = 0;    // chunks not skipped through the index
+    size_t nRowsRead = 0;
+    size_t nRowsMatched = 0;
+};
+
+// Label of the month or day of a start time, in local time
+std::string history_date_label(double start, bool month)
+{
+    std::time_t t = static_cast<std::time_t>(start / 1e6);
+    std::tm tm;
+    localtime_r(&t, &tm);
+    char label[16];
+    std::strftime(label, sizeof(label), month ? "%Y-%m" : "%Y-%m-%d", &tm);
+    return label;
+}
+
+HistoryResult run_history_query(const std::filesystem::path &store, const HistoryQuery &query)
+{
+    HistoryResult result;
+    std::vector<HistoryIndexEntry> entries = read_history_index(store);
+    result.nChunks = entries.size();
+
+    // Skip the chunks outside of the time range, or without a user or account the query requires
+    uint64_t users = 0, accounts = 0;
+    for (const auto &filter : query.where)
+    {
+        if (filter.op != CompareOp::Equal)
+            continue;
+        if (filter.column == "user")
+            users |= history_bloom(filter.text);
+        else if (filter.column == "account")
+            accounts |= history_bloom(filter.text);
+    }
+
+    std::vector<HistoryIndexEntry> selected;
+    for (const auto &entry : entries)
+    {
+        if (entry.maxStart < query.since || entry.minStart > query.until
+            || (entry.users & users) != users || (entry.accounts & accounts) != accounts)
+            continue;
+        selected.push_back(entry);
+    }
+    std::sort(selected.begin(), selected.end(), [](const HistoryIndexEntry &a, const HistoryIndexEntry &b) {
+        return a.month != b.month ? a.month < b.month : a.offset < b.offset;
+    });
+
+    // Only the columns filtered, grouped or aggregated are read
+    std::vector<int> needed = {HistoryStart, HistoryJob, HistoryGpuHours, HistoryEnergy, HistorySm,
+                               HistoryMembw, HistoryIdleGpus, HistoryGpus, HistoryImbalance};
+    for (const auto &filter : query.where)
+        needed.push_back(history_column(filter.column));
+    if (query.groupBy == "user")
+        needed.push_back(HistoryUser);
+    else if (query.groupBy == "account")
+        needed.push_back(HistoryAccount);
+
+    HistoryGroup *all = nullptr;
+    std::unordered_map<long long, HistoryGroup *> dates; // groups of month or day, by quarter hour of the start time,
+                                                         // as time zones are offset by whole quarter hours
+    std::vector<HistoryGroup *> strings;                 // groups of user or account, by dictionary index
+
+    HistoryChunk chunk;
+    std::vector<uint8_t> mask;
+    int fd = -1;
+    uint32_t month = 0;
+    for (const auto &entry : selected)
+    {
+        // Each partition is opened once, its chunks read in file order
+        if (fd < 0 || entry.month != month)
+        {
+            if (fd >= 0)
+                close(fd);
+            month = entry.month;
+            fd = open(history_partition(store, month).c_str(), O_RDONLY);
+            if (fd < 0)
+            {
+                std::cerr << "WARNING: Missing history partition: " << history_partition(store, month) << std::endl;
+                continue;
+            }
+        }
+
+        if (!chunk.read(fd, entry))
+        {
+            std::cerr << "WARNING: Corrupted chunk in history partition, skipping it: " << history_partition(store, month) << std::endl;
+            continue;
+        }
+        result.nChunksRead++;
+        result.nRowsRead += chunk.nRows;
+
+        // A chunk without a string the query requires is skipped before reading its columns
+        size_t n = chunk.nRows;
+        bool empty = false;
+        std::vector<double> values;
+        for (const auto &filter : query.where)
+        {
+            int c = history_column(filter.column);
+            values.push_back(is_history_string_column(c) ? chunk.find(filter.text) : filter.value);
+            empty = empty || (is_history_string_column(c) && values.back() < 0 && filter.op == CompareOp::Equal);
+        }
+        if (empty)
+            continue;
+
+        bool loaded = true;
+        for (int c : needed)
+            loaded = loaded && chunk.load(c);
+        if (!loaded)
+        {
+            std::cerr << "WARNING: Truncated chunk in history partition, skipping it: " << history_partition(store, month) << std::endl;
+            continue;
+        }
+
+        // Filters are evaluated one column at a time
+        mask.assign(n, 1);
+        apply_filter(chunk.column(HistoryStart), n, CompareOp::GreaterEqual, static_cast<double>(query.since), mask.data());
+        apply_filter(chunk.column(HistoryStart), n, CompareOp::LessEqual, static_cast<double>(query.until), mask.data());
+        for (size_t f = 0; f < query.where.size(); ++f)
+        {
+            apply_filter(chunk.column(history_column(query.where[f].column)), n, query.where[f].op, values[f], mask.data());
+        }
+
+        strings.assign(chunk.strings.size(), nullptr);
+        auto group_of = [&](size_t i) -> HistoryGroup & {
+            if (query.groupBy == "user" || query.groupBy == "account")
+            {
+                size_t id = static_cast<size_t>(chunk.column(query.groupBy == "user" ? HistoryUser : HistoryAccount)[i]);
+                if (strings[id] == nullptr)
+                    strings[id] = &result.groups[{0, std::string(chunk.strings[id])}];
+                return *strings[id];
+            }
+            if (query.groupBy == "job")
+                return result.groups[{chunk.column(HistoryJob)[i], std::string()}];
+            if (query.groupBy == "month" || query.groupBy == "day")
+            {
+                double start = chunk.column(HistoryStart)[i];
+                HistoryGroup *&group = dates[static_cast<long long>(std::floor(start / 9e8))];
+                if (group == nullptr)
+                    group = &result.groups[{0, history_date_label(start, query.groupBy == "month")}];
+                return *group;
+            }
+            if (all == nullptr)
+                all = &result.groups[{0, "all"}];
+            return *all;
+        };
+
+        const double *job = chunk.column(HistoryJob);
+        const double *gpu_hours = chunk.column(HistoryGpuHours);
+        const double *energy = chunk.column(HistoryEnergy);
+        const double *sm = chunk.column(HistorySm);
+        const double *membw = chunk.column(HistoryMembw);
+        const double *idle = chunk.column(HistoryIdleGpus);
+        const double *gpus = chunk.column(HistoryGpus);
+        const double *imbalance = chunk.column(HistoryImbalance);
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (!mask[i])
+                continue;
+            result.nRowsMatched++;
+
+            HistoryGroup &group = group_of(i);
+            group.nSteps++;
+            group.jobs.push_back(job[i]);
+            group.gpuHours += gpu_hours[i];
+            if (!std::isnan(energy[i]))
+                group.energy += energy[i];
+            group.smGpuHours += sm[i] * gpu_hours[i];
+            group.membwGpuHours += membw[i] * gpu_hours[i];
+            group.idleGpus += idle[i];
+            group.gpus += gpus[i];
+            if (!std::isnan(imbalance[i]) && !(imbalance[i] <= group.maxImbalance))
+                group.maxImbalance = imbalance[i];
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+
+    for (auto &[key, group] : result.groups)
+    {
+        std::sort(group.jobs.begin(), group.jobs.end());
+        group.nJobs = std::unique(group.jobs.begin(), group.jobs.end()) - group.jobs.begin();
+        group.jobs = std::vector<double>();
+    }
+    return result;
+}
+
+void write_history_result(std::ostream &os, const HistoryQuery &query, const HistoryResult &result)
+{
+    if (result.groups.empty())
+    {
+        os << "No step matches the query" << std::endl;
+    }
+    else
+    {
+        OutputBuffer out(os);
+        FixedWidthTable table(out, {24, 8, 8, 18, 12, 14, 14, 11, 11});
+
+        table.rule();
+        table.header({query.groupBy.empty() ? "Group" : "Group (" + query.groupBy + ")",
+                      "Jobs",
+                      "Steps",
+                      "GPU Hours",
+                      "Energy",
+                      "SM Util.\n% (avg)",
+                      "Mem BW Util.\n% (avg)",
+                      "Idle GPUs\n(%)",
+                      "Max Load\nImbalance"});
+        table.rule();
+
+        Cell jobs, steps, sm, membw, idle;
+        for (const auto &[key, group] : result.groups)
+        {
+            jobs.clear();
+            steps.clear();
+            sm.clear();
+            membw.clear();
+            idle.clear();
+
+            jobs.integer(group.nJobs);
+            steps.integer(group.nSteps);
+            double hours = group.gpuHours > 0 ? group.gpuHours : std::numeric_limits<double>::quiet_NaN();
+            sm.fixed(group.smGpuHours / hours, 1);
+            membw.fixed(group.membwGpuHours / hours, 1);
+            idle.fixed(group.gpus > 0 ? 100. * group.idleGpus / group.gpus : 0., 1);
+
+            std::string gpu_hours = format_gpu_hours(group.gpuHours);
+            std::string energy = format_energy(group.energy / 3600.);
+            std::string imbalance = format_ratio_percent(group.maxImbalance);
+            std::string label = query.groupBy == "job" ? std::to_string(static_cast<long long>(key.first)) : key.second;
+            std::string_view cells[] = {label, jobs.view(), steps.view(), gpu_hours, energy,
+                                        sm.view(), membw.view(), idle.view(), imbalance};
+            table.row(cells);
+        }
+        table.rule();
+    }
+
+    os << result.nRowsMatched << " of " << result.nRowsRead << " steps read matched, "
+       << result.nChunksRead << " of " << result.nChunks << " chunks read" << std::endl;
+}
+
+// Store given on the command line, or in JOBREPORT_HISTORY
+std::filesystem::path history_store(const std::string &store)
+{
+    if (!store.empty())
+        return store;
+
+    const char *env = std::getenv("JOBREPORT_HISTORY");
+    if (env == nullptr || *env == '\0')
+    {
+        raise_error("Error: No history store given, use -d, --store or set JOBREPORT_HISTORY");
+    }
+    return env;
+}
+
+void query_history(const std::filesystem::path &store, const HistoryQuery &query)
+{
+    if (!std::filesystem::exists(store / HISTORY_INDEX_FILE))
+    {
+        raise_error("Error: No history store found in: \"" + store.string() + "\"");
+    }
+
+    HistoryResult result = run_history_query(store, query);
+    write_history_result(std::cout, query, result);
+}
+
+#endif // JOBREPORT_HISTORY_HPP
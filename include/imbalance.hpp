@@ -0,0 +1,248 @@
+/*
+    Load imbalance and straggler detection across GPUs and nodes.
+
+    For every per-GPU metric the dispersion is summarized with the
+    coefficient of variation and the max/mean ratio, across GPUs and
+    across nodes (mean of the GPUs of each node). Outliers are flagged
+    with the robust z-score
+
+        z = 0.6745 * (x - median) / MAD
+
+    which is not dragged along by the outliers themselves, and the GPUs
+    and nodes with the largest |z| over all metrics are listed, whether
+    or not they are outliers, which the list marks.
+*/
+
+#ifndef JOBREPORT_IMBALANCE_HPP
+#define JOBREPORT_IMBALANCE_HPP
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+
+#include "dataframe.hpp"
+
+#define IMBALANCE_OUTLIER_Z 3.5 // |robust z| above which a value is an outlier
+#define IMBALANCE_TOP_N 10
+
+struct MetricDispersion
+{
+    std::string metric;
+    double cv = 0;          // coefficient of variation
+    double maxOverMean = 0; // max / mean
+    size_t nOutliers = 0;
+};
+
+struct Outlier
+{
+    std::string host;
+    unsigned int gpuId = 0; // unused for nodes
+    double score = 0;       // largest |robust z| over all metrics
+    bool outlier = false;   // score above IMBALANCE_OUTLIER_Z
+    std::string metrics;    // metrics in which it is an outlier
+};
+
+struct ImbalanceReport
+{
+    std::vector<MetricDispersion> gpus;
+    std::vector<MetricDispersion> nodes;
+    std::vector<Outlier> worstGpus;
+    std::vector<Outlier> worstNodes;
+
+    bool empty() const { return gpus.empty(); }
+};
+
+// Robust z-scores of `values`, NaN values stay NaN
+std::vector<double> robust_z(const std::vector<double> &values)
+{
+    std::vector<double> valid;
+    valid.reserve(values.size());
+    for (double v : values)
+    {
+        if (!std::isnan(v))
+            valid.push_back(v);
+    }
+
+    std::vector<double> z(values.size(), std::numeric_limits<double>::quiet_NaN());
+    if (valid.empty())
+        return z;
+
+    auto median = [](std::vector<double> &v) {
+        auto mid = v.begin() + v.size() / 2;
+        std::nth_element(v.begin(), mid, v.end());
+        return *mid;
+    };
+
+    double med = median(valid);
+    for (double &v : valid)
+        v = std::abs(v - med);
+    double mad = median(valid);
+
+    // With more than half of the values equal the MAD is 0, fall back to
+    // the mean absolute deviation, scaled to be consistent with the MAD
+    double scale;
+    if (mad > 0)
+    {
+        scale = 0.6745 / mad;
+    }
+    else
+    {
+        double mean_ad = std::accumulate(valid.begin(), valid.end(), 0.0) / valid.size();
+        scale = mean_ad > 0 ? 0.7979 / mean_ad : 0;
+    }
+
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        if (!std::isnan(values[i]))
+            z[i] = scale * (values[i] - med);
+    }
+    return z;
+}
+
+MetricDispersion dispersion(const std::string &metric, const std::vector<double> &values, const std::vector<double> &z)
+{
+    MetricDispersion d;
+    d.metric = metric;
+
+    double sum = 0, sum2 = 0, max = -std::numeric_limits<double>::infinity();
+    size_t n = 0;
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        if (std::isnan(values[i]))
+            continue;
+        sum += values[i];
+        sum2 += values[i] * values[i];
+        max = std::max(max, values[i]);
+        n++;
+        if (std::abs(z[i]) > IMBALANCE_OUTLIER_Z)
+            d.nOutliers++;
+    }
+
+    double mean = n > 0 ? sum / n : 0;
+    double var = n > 0 ? std::max(0.0, sum2 / n - mean * mean) : 0;
+    d.cv = mean != 0 ? std::sqrt(var) / mean : std::numeric_limits<double>::quiet_NaN();
+    d.maxOverMean = mean != 0 ? max / mean : std::numeric_limits<double>::quiet_NaN();
+    return d;
+}
+
+// Scores the rows of `metrics` and keeps the top_n with the largest score
+std::vector<Outlier> worst_outliers(const std::vector<std::string> &names,
+                                    const std::vector<std::vector<double>> &metrics,
+                                    const std::vector<std::vector<double>> &z,
+                                    const std::vector<std::string> &hosts,
+                                    const std::vector<unsigned int> &gpus,
+                                    size_t top_n)
+{
+    std::vector<Outlier> outliers;
+    for (size_t i = 0; i < hosts.size(); ++i)
+    {
+        Outlier o;
+        o.host = hosts[i];
+        o.gpuId = gpus.empty() ? 0 : gpus[i];
+        bool scored = false;
+        for (size_t m = 0; m < metrics.size(); ++m)
+        {
+            double a = std::abs(z[m][i]);
+            if (std::isnan(a))
+                continue;
+            scored = true;
+            o.score = std::max(o.score, a);
+            if (a > IMBALANCE_OUTLIER_Z)
+                o.metrics += (o.metrics.empty() ? "" : ", ") + names[m] + (z[m][i] > 0 ? " high" : " low");
+        }
+        o.outlier = o.score > IMBALANCE_OUTLIER_Z;
+        if (scored)
+            outliers.push_back(o);
+    }
+
+    size_t n = std::min(top_n, outliers.size());
+    std::partial_sort(outliers.begin(), outliers.begin() + n, outliers.end(),
+                      [](const Outlier &a, const Outlier &b) { return a.score > b.score; });
+    outliers.resize(n);
+    return outliers;
+}
+
+// Expects `df` sorted by host, as returned by load_dataframe
+ImbalanceReport compute_imbalance(const DataFrame &df, size_t top_n = IMBALANCE_TOP_N)
+{
+    PROFILE_SCOPE("compute_imbalance");
+    ImbalanceReport report;
+    size_t n = df.gpuId.size();
+    if (n < 2)
+        return report;
+
+    auto to_double = [n](const auto &column) {
+        std::vector<double> v(n);
+        for (size_t i = 0; i < n; ++i)
+            v[i] = static_cast<double>(column[i]);
+        return v;
+    };
+
+    std::vector<double> elapsed(n);
+    for (size_t i = 0; i < n; ++i)
+        elapsed[i] = (df.endTime[i] - df.startTime[i]) / 1e6;
+
+    std::vector<std::string> names = {"SM Utilization", "Memory BW Utilization", "Power", "Energy", "Elapsed Time", "Max Memory"};
+    std::vector<std::vector<double>> gpu_metrics = {
+        to_double(df.smUtilizationAvg),
+        to_double(df.memoryUtilizationAvg),
+        to_double(df.powerUsageAvg),
+        to_double(df.energyConsumed),
+        elapsed,
+        to_double(df.maxAllocatedMemory)};
+
+    // Nodes are contiguous runs of rows, each reduced to the mean of its GPUs
+    std::vector<std::string> hosts;
+    std::vector<size_t> run_begin;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (i == 0 || df.host[i] != df.host[i - 1])
+        {
+            hosts.push_back(df.host[i]);
+            run_begin.push_back(i);
+        }
+    }
+    run_begin.push_back(n);
+
+    std::vector<std::vector<double>> node_metrics(names.size(), std::vector<double>(hosts.size()));
+    for (size_t m = 0; m < names.size(); ++m)
+    {
+        for (size_t h = 0; h < hosts.size(); ++h)
+        {
+            double sum = 0;
+            size_t count = 0;
+            for (size_t i = run_begin[h]; i < run_begin[h + 1]; ++i)
+            {
+                if (!std::isnan(gpu_metrics[m][i]))
+                {
+                    sum += gpu_metrics[m][i];
+                    count++;
+                }
+            }
+            node_metrics[m][h] = count > 0 ? sum / count : std::numeric_limits<double>::quiet_NaN();
+        }
+    }
+
+    std::vector<std::vector<double>> gpu_z, node_z;
+    for (size_t m = 0; m < names.size(); ++m)
+    {
+        gpu_z.push_back(robust_z(gpu_metrics[m]));
+        report.gpus.push_back(dispersion(names[m], gpu_metrics[m], gpu_z[m]));
+
+        node_z.push_back(robust_z(node_metrics[m]));
+        report.nodes.push_back(dispersion(names[m], node_metrics[m], node_z[m]));
+    }
+
+    report.worstGpus = worst_outliers(names, gpu_metrics, gpu_z, df.host, df.gpuId, top_n);
+    if (hosts.size() > 1)
+    {
+        report.worstNodes = worst_outliers(names, node_metrics, node_z, hosts, {}, top_n);
+    }
+
+    return report;
+}
+
+#endif // JOBREPORT_IMBALANCE_HPP
@@ -11,14 +11,21 @@
 #include <algorithm>
 #include <filesystem>
 #include <optional>
+#include <map>
+#include <memory>
 
-#include "dcgm_agent.h"
-#include "dcgm_fields.h"
-#include "dcgm_structs.h"
+#include "dcgm_loader.hpp"
 #include "slurm_job.hpp"
 #include "utils.hpp"
 #include "dataframe.hpp"
 #include "dataframe_io.hpp"
+#include "sampler.hpp"
+#include "manifest.hpp"
+#include "control_socket.hpp"
+#include "metrics_textfile.hpp"
+#include "regions.hpp"
+#include "markers.hpp"
+#include "history.hpp"
 #include "macros.hpp"
 
 class JobReport
@@ -30,12 +37,18 @@ public:
         const std::string &time_string,
         const bool ignore_gpu_binding,
         const bool verbose,
-        const bool force
+        const bool force,
+        const bool consolidate,
+        const std::string &metrics_textfile,
+        const std::string &history
         )
         : sampling_time(sampling_time * 1000000),
           ignore_gpu_binding(ignore_gpu_binding),
           verbose(verbose), 
-          force(force)
+          force(force),
+          consolidate(consolidate),
+          metrics_textfile(metrics_textfile),
+          history(history)
     {
         initialize(path, time_string);
     }
@@ -56,18 +69,32 @@ private:
     bool ignore_gpu_binding;
     bool verbose;
     bool force;
+    bool consolidate; // one CSV file per node and step instead of one per rank
+    std::filesystem::path metrics_textfile; // directory of the node_exporter textfile collector, if any
+    std::filesystem::path history; // history store the finished steps are appended to, if any
 
     // SLURM Variables
     SlurmJob job;
 
     // DCGM Variables
+    bool dcgm_initialized = false; // libdcgm is only loaded by the node root
     dcgmHandle_t dcgmHandle = (dcgmHandle_t)NULL;
     dcgmGpuGrp_t group = (dcgmGpuGrp_t)DCGM_GROUP_ALL_GPUS;
     dcgmJobInfo_t jobInfo;
     char job_name[64];
+    dcgmFieldGrp_t energy_field_group = (dcgmFieldGrp_t)NULL;
+    std::map<unsigned int, long long> energy_start; // in mJ
+    std::map<unsigned int, double> energy_counters; // difference of the total energy counters, in J
+    std::map<unsigned int, double> integrated_energy; // from the power samples of the sampler, in J
+    std::unique_ptr<Sampler> sampler;
+    ControlServer control;
+    std::unique_ptr<MetricsTextfile> metrics;
+    RegionCollector regions;
+    MarkerReader markers;
 
     // Process variables
-    std::filesystem::path output_path;
+    std::filesystem::path root_path;   // job directory
+    std::filesystem::path output_path; // CSV file of this rank
     pid_t child_pid = -1;
 
     // Methods
@@ -81,7 +108,23 @@ private:
     void initialize_gpu_group();
     void start_job_stats();
     void stop_job_stats();
+    std::vector<unsigned int> get_gpu_ids();
+    bool read_energy_counters(std::map<unsigned int, long long> &counters);
+    void start_energy_counters();
+    void stop_energy_counters();
+    void start_sampler();
+    void stop_sampler();
+    void start_control();
+    void stop_control();
+    void start_metrics();
+    void stop_metrics();
+    void start_regions();
+    void stop_regions();
+    void start_markers(const std::filesystem::path &fifo);
+    void stop_markers();
     void write_job_stats();
+    void archive_step();
+    std::filesystem::path side_file(const std::string &extension) const;
     void compute_time_params(const std::string &time_string);
     void print_root(const std::string &msg)
     {
@@ -133,6 +176,8 @@ void JobReport::set_output_path(const std::string &path)
         }
     }
 
+    root_path = std::filesystem::absolute(output_path);
+
     // Create the output directory
     // This should act as mkdir -p command and not throw an error if the directory already exists,
     // if the directory is not empty or if the parent directory does not exist.
@@ -208,13 +253,28 @@ void JobReport::cleanup()
 {
     print_root("Cleaning up...");
 
+    sampler.reset();
+
+    if (!dcgm_initialized)
+    {
+        return;
+    }
+
+    if (energy_field_group != (dcgmFieldGrp_t)NULL)
+    {
+        dcgm().UnwatchFields(dcgmHandle, group, energy_field_group);
+        dcgm().FieldGroupDestroy(dcgmHandle, energy_field_group);
+        energy_field_group = (dcgmFieldGrp_t)NULL;
+    }
+
     if (!job.step_gpus.empty())
     {
-        dcgmGroupDestroy(dcgmHandle, group);
+        dcgm().GroupDestroy(dcgmHandle, group);
     }
 
-    dcgmDisconnect(dcgmHandle);
-    dcgmShutdown();
+    dcgm().Disconnect(dcgmHandle);
+    dcgm().Shutdown();
+    dcgm_initialized = false;
 }
 
 void JobReport::check_error(dcgmReturn_t result, const std::string &errorMsg)
@@ -229,8 +289,9 @@ void JobReport::check_error(dcgmReturn_t result, const std::string &errorMsg)
 void JobReport::initialize_dcgm_handle()
 {
     LOG("Initializing DCGM handle.");
-    check_error(dcgmInit(), "Error initializing DCGM engine.");
-    check_error(dcgmConnect("127.0.0.1", &dcgmHandle), "Error connecting to remote DCGM engine.");
+    check_error(dcgm().Init(), "Error initializing DCGM engine.");
+    dcgm_initialized = true;
+    check_error(dcgm().Connect("127.0.0.1", &dcgmHandle), "Error connecting to remote DCGM engine.");
 }
 
 void JobReport::initialize_gpu_group()
@@ -242,13 +303,13 @@ void JobReport::initialize_gpu_group()
 
         group = (dcgmGpuGrp_t)DCGM_GROUP_ALL_GPUS;
     } else {
-        dcgmReturn_t result = dcgmGroupCreate(dcgmHandle, DCGM_GROUP_EMPTY, job_name, &group);
+        dcgmReturn_t result = dcgm().GroupCreate(dcgmHandle, DCGM_GROUP_EMPTY, job_name, &group);
         check_error(result, "A fatal error occurred while creating the GPU group.");
 
         // add the GPUs to the group
         for (auto &gpu : job.step_gpus)
         {
-            result = dcgmGroupAddDevice(dcgmHandle, group, gpu);
+            result = dcgm().GroupAddDevice(dcgmHandle, group, gpu);
             check_error(result, "A fatal error occurred while adding a GPU to the group.");
         }
     }
@@ -256,10 +317,77 @@ void JobReport::initialize_gpu_group()
 
 void JobReport::write_job_stats()
 {
-    std::ofstream ofs(output_path);
-    DataFrame df(jobInfo, job);
-    df.dump(ofs);
-    ofs.close();
+    DataFrame df(jobInfo, job, energy_counters, integrated_energy);
+    std::ostringstream oss;
+    df.dump(oss);
+    std::string csv = oss.str();
+
+    // The ranks of a node append their rows to a shared file
+    std::filesystem::path csv_path = output_path;
+    uint64_t offset = 0;
+    if (consolidate)
+    {
+        csv_path = side_file(".csv");
+        if (!append_block(csv_path, csv, offset))
+        {
+            std::cerr << "WARNING: Could not write job statistics to " << csv_path << std::endl;
+            return;
+        }
+    }
+    else
+    {
+        std::ofstream ofs(output_path);
+        ofs << csv;
+        ofs.close();
+        if (!ofs)
+        {
+            std::cerr << "WARNING: Could not write job statistics to " << output_path << std::endl;
+            return;
+        }
+    }
+
+    // Register the complete file in the job manifest
+    ManifestRecord record = make_manifest_record(
+        std::stoul(job.step_id), std::stoul(job.proc_id), job.step_gpus.empty() ? job.n_nodes : job.n_procs,
+        csv, offset, df.gpuId, get_hostname(),
+        std::filesystem::exists(side_file(TIMESERIES_EXTENSION)));
+
+    if (!copy_field(record.file, std::filesystem::relative(csv_path, root_path).string())
+        || !append_manifest_record(root_path, record))
+    {
+        std::cerr << "WARNING: Could not add " << csv_path << " to the job manifest" << std::endl;
+        return;
+    }
+
+    if (!history.empty())
+    {
+        archive_step();
+    }
+}
+
+void JobReport::archive_step()
+{
+    // The step is finished once the manifest holds the records of all its ranks
+    JobManifest manifest;
+    manifest.read(root_path);
+    unsigned int step = std::stoul(job.step_id);
+    std::vector<ManifestRecord> records = manifest.step_records(step);
+    if (records.empty() || records.size() < records.front().nExpected)
+    {
+        return;
+    }
+
+    // Several node roots may see the last record, only the one creating the marker archives the step
+    std::filesystem::path marker = output_path.parent_path() / HISTORY_MARKER_FILE;
+    int fd = open(marker.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return;
+    }
+    close(fd);
+
+    LOG("Archiving step " << step << " to " << history);
+    archive_finished_step(history, {output_path.parent_path(), records});
 }
 
 void JobReport::start_job_stats()
@@ -270,16 +398,212 @@ void JobReport::start_job_stats()
                                                             << "Sampling time: " << sampling_time << std::endl
                                                             << "Max runtime: " << max_runtime << std::endl
                                                             << "Job name: " << job_name << std::endl);
-    check_error(dcgmWatchJobFields(dcgmHandle, group, sampling_time, max_runtime, 0), "Error setting job watches.");
-    check_error(dcgmJobStartStats(dcgmHandle, group, job_name), "Error starting job stats.");
+    check_error(dcgm().WatchJobFields(dcgmHandle, group, sampling_time, max_runtime, 0), "Error setting job watches.");
+    check_error(dcgm().JobStartStats(dcgmHandle, group, job_name), "Error starting job stats.");
+    start_energy_counters();
 }
 
 void JobReport::stop_job_stats()
 {
     LOG("Stopping job stats...");
-    check_error(dcgmJobGetStats(dcgmHandle, job_name, &jobInfo), "Error getting job stats.");
-    check_error(dcgmJobStopStats(dcgmHandle, job_name), "Error stopping job stats.");
-    check_error(dcgmJobRemove(dcgmHandle, job_name), "Error removing job stats.");
+    stop_energy_counters();
+    check_error(dcgm().JobGetStats(dcgmHandle, job_name, &jobInfo), "Error getting job stats.");
+    check_error(dcgm().JobStopStats(dcgmHandle, job_name), "Error stopping job stats.");
+    check_error(dcgm().JobRemove(dcgmHandle, job_name), "Error removing job stats.");
+}
+
+std::vector<unsigned int> JobReport::get_gpu_ids()
+{
+    if (!job.step_gpus.empty())
+    {
+        return job.step_gpus;
+    }
+
+    unsigned int ids[DCGM_MAX_NUM_DEVICES];
+    int count = 0;
+    if (dcgm().GetAllSupportedDevices(dcgmHandle, ids, &count) != DCGM_ST_OK)
+    {
+        return {};
+    }
+    return std::vector<unsigned int>(ids, ids + count);
+}
+
+bool JobReport::read_energy_counters(std::map<unsigned int, long long> &counters)
+{
+    // Force a fresh sample so that the counters match the start/stop instants
+    if (dcgm().UpdateAllFields(dcgmHandle, 1) != DCGM_ST_OK)
+    {
+        return false;
+    }
+
+    unsigned short field = DCGM_FI_DEV_TOTAL_ENERGY_CONSUMPTION;
+    for (unsigned int gpu : get_gpu_ids())
+    {
+        dcgmFieldValue_v1 value;
+        if (dcgm().GetLatestValuesForFields(dcgmHandle, gpu, &field, 1, &value) == DCGM_ST_OK
+            && value.status == DCGM_ST_OK
+            && !DCGM_INT64_IS_BLANK(value.value.i64))
+        {
+            counters[gpu] = value.value.i64;
+        }
+    }
+    return true;
+}
+
+void JobReport::start_energy_counters()
+{
+    // The energy counter is optional: GPUs without it fall back to integrated power
+    unsigned short field = DCGM_FI_DEV_TOTAL_ENERGY_CONSUMPTION;
+    std::string name = std::string(job_name) + "_energy";
+    if (dcgm().FieldGroupCreate(dcgmHandle, 1, &field, name.c_str(), &energy_field_group) != DCGM_ST_OK)
+    {
+        print_root("Warning: unable to create the energy counter field group.");
+        energy_field_group = (dcgmFieldGrp_t)NULL;
+        return;
+    }
+
+    if (dcgm().WatchFields(dcgmHandle, group, energy_field_group, sampling_time, max_runtime, 0) != DCGM_ST_OK
+        || !read_energy_counters(energy_start))
+    {
+        print_root("Warning: unable to read the GPU energy counters.");
+        energy_start.clear();
+    }
+}
+
+void JobReport::stop_energy_counters()
+{
+    if (energy_start.empty())
+    {
+        return;
+    }
+
+    std::map<unsigned int, long long> energy_stop;
+    read_energy_counters(energy_stop);
+
+    for (const auto &[gpu, start] : energy_start)
+    {
+        auto stop = energy_stop.find(gpu);
+        // A counter that went backwards was reset (e.g. driver reload) and cannot be trusted
+        if (stop != energy_stop.end() && stop->second >= start)
+        {
+            energy_counters[gpu] = (stop->second - start) / 1e3; // mJ to J
+        }
+    }
+}
+
+// File of this rank next to its CSV file, or of the node when consolidated
+std::filesystem::path JobReport::side_file(const std::string &extension) const
+{
+    if (consolidate)
+    {
+        return output_path.parent_path() / ("node_" + get_hostname() + extension);
+    }
+    return std::filesystem::path(output_path).replace_extension(extension);
+}
+
+void JobReport::start_sampler()
+{
+    std::filesystem::path ts_path = side_file(TIMESERIES_EXTENSION);
+
+    sampler = std::make_unique<Sampler>(dcgmHandle, group, get_gpu_ids(), sampling_time);
+    if (!sampler->start(ts_path, std::string(job_name) + "_samples"))
+    {
+        print_root("Warning: unable to start the time series sampler.\n"
+                   "Power timelines will not be available for this step.");
+        sampler.reset();
+    }
+}
+
+void JobReport::stop_sampler()
+{
+    if (!sampler)
+    {
+        return;
+    }
+
+    sampler->stop();
+
+    // Integrated power is the fallback for GPUs without an energy counter nor DCGM energy
+    integrated_energy = sampler->integrated_energy();
+    sampler.reset();
+}
+
+void JobReport::start_control()
+{
+    std::filesystem::path path = control_socket_path(job.job_id, job.step_id, job.proc_id, output_path.parent_path());
+    long long start_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                             std::chrono::system_clock::now().time_since_epoch()).count();
+
+    // Answered from the control thread, from what the sampler published
+    auto handler = [this, start_us](const std::string &request) {
+        if (request == "stats")
+            return control_stats_response(job.job_id, job.step_id, job.proc_id, start_us,
+                                          sampler ? sampler->snapshot() : std::vector<ChannelStats>());
+        return std::string("error unknown request \"" + request + "\"\n");
+    };
+
+    if (path.empty() || !control.start(path, handler))
+    {
+        print_root("Warning: unable to create the control socket.\n"
+                   "jobreport status will not be available for this step.");
+        return;
+    }
+    LOG("Control socket: " << path);
+}
+
+void JobReport::stop_control()
+{
+    control.stop();
+}
+
+void JobReport::start_metrics()
+{
+    if (metrics_textfile.empty())
+    {
+        return;
+    }
+    if (!sampler)
+    {
+        print_root("Warning: the metrics textfile needs the time series sampler.\n"
+                   "No metrics will be written for this step.");
+        return;
+    }
+
+    metrics = std::make_unique<MetricsTextfile>(metrics_textfile, job, *sampler, sampling_time);
+    metrics->start();
+}
+
+void JobReport::stop_metrics()
+{
+    metrics.reset();
+}
+
+void JobReport::start_regions()
+{
+    if (!regions.start(region_ring_name(job.job_id, job.step_id)))
+    {
+        print_root("Warning: unable to create the region marker segment.\n"
+                   "Workload regions will not be reported for this step.");
+    }
+}
+
+void JobReport::stop_regions()
+{
+    regions.stop(side_file(REGION_FILE_EXTENSION));
+}
+
+void JobReport::start_markers(const std::filesystem::path &fifo)
+{
+    if (!markers.start(fifo, regions))
+    {
+        print_root("Warning: unable to read phase markers from " + fifo.string() + ".\n"
+                   "Markers will not be reported for this step.");
+    }
+}
+
+void JobReport::stop_markers()
+{
+    markers.stop();
 }
 
 void JobReport::start()
@@ -314,6 +638,30 @@ void JobReport::run(const std::string &cmd) {
         initialize_dcgm_handle();
         initialize_gpu_group();
         start_job_stats();
+        // The files of the node, its control socket and its markers are left to its leader when consolidated
+        if (!consolidate || job.node_leader) {
+            start_sampler();
+            start_control();
+            start_metrics();
+            start_regions();
+        }
+    }
+
+    // The region markers of every rank of the node go to the segment of the collecting node root
+    setenv(REGION_RING_ENV, region_ring_name(job.job_id, job.step_id).c_str(), 1);
+
+    // And so do the phase markers written to the FIFO of the node
+    std::filesystem::path fifo = marker_fifo_path(job.job_id, job.step_id, output_path.parent_path());
+    if (regions.collecting())
+    {
+        start_markers(fifo);
+    }
+    int marker_fd = open_marker_fifo(fifo, region_ring_name(job.job_id, job.step_id));
+    int marker_slot = marker_fd >= 0 ? marker_fd_slot(marker_fd) : -1;
+    if (marker_fd >= 0)
+    {
+        setenv(MARKER_FD_ENV, std::to_string(marker_slot).c_str(), 1);
+        setenv(MARKER_FIFO_ENV, fifo.c_str(), 1);
     }
 
     struct sigaction sa;
@@ -325,6 +673,12 @@ void JobReport::run(const std::string &cmd) {
     child_pid = fork();
     if (child_pid == 0) {
         // Child process
+        // Only the descriptor the workload is told about stays open in it
+        if (marker_slot != marker_fd)
+        {
+            dup2(marker_fd, marker_slot);
+            close(marker_fd);
+        }
         execl("/bin/sh", "sh", "-c", cmd.c_str(), (char *)nullptr);
         // If execl returns, there was an error
         raise_error("execl failed to execute command. Is /bin/sh available?");
@@ -348,8 +702,18 @@ void JobReport::run(const std::string &cmd) {
     sa.sa_handler = SIG_DFL;
     sigaction(SIGCHLD, &sa, nullptr);
 
+    if (marker_fd >= 0)
+    {
+        close(marker_fd);
+    }
+
     // Stop Job Stats
     if (job.node_root) {
+        stop_markers();
+        stop_regions();
+        stop_metrics();
+        stop_control();
+        stop_sampler();
         stop_job_stats();
         write_job_stats();
     }
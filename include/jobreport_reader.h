@@ -0,0 +1,124 @@
+/*
+    C API of libjobreport_reader, to read jobreport reports in-process.
+
+        jobreport_job *job = jobreport_open("jobreport_1234");
+        for (size_t s = 0; s < jobreport_step_count(job); ++s)
+        {
+            jobreport_step *step = jobreport_step_open(job, s);
+            jobreport_summary summary;
+            jobreport_step_summary(step, &summary, sizeof(summary));
+
+            jobreport_column_type type;
+            const double *power = jobreport_step_column(step, "powerUsageAvg", &type);
+            for (size_t i = 0; i < jobreport_step_rows(step); ++i)
+                printf("%s %.1f W\n", jobreport_step_string(step, "host", i), power[i]);
+            jobreport_step_close(step);
+        }
+        jobreport_close(job);
+
+    A step is loaded as `jobreport print` loads it, from its summary cache
+    when it is up to date. Columns are returned without copy and remain
+    valid until the step is closed. Steps are independent of each other
+    and of their job once opened, and may be used from different threads;
+    threads opening the same step concurrently each write the summary
+    cache to a temporary file of their own before renaming it.
+
+    Functions returning a pointer return NULL on error, those returning an
+    int return 0 on success and -1 on error; jobreport_last_error() then
+    describes the error of the calling thread.
+
+    The API is stable: functions and enumerators are only added, and
+    jobreport_summary only grows at its end, which callers opt into with
+    the size they pass to jobreport_step_summary().
+*/
+
+#ifndef JOBREPORT_READER_H
+#define JOBREPORT_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define JOBREPORT_READER_VERSION 1
+
+#if defined(__GNUC__)
+#define JOBREPORT_READER_API __attribute__((visibility("default")))
+#else
+#define JOBREPORT_READER_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct jobreport_job jobreport_job;
+typedef struct jobreport_step jobreport_step;
+
+typedef enum
+{
+    JOBREPORT_COLUMN_UINT32 = 0, /* unsigned int */
+    JOBREPORT_COLUMN_INT32 = 1,  /* int */
+    JOBREPORT_COLUMN_INT64 = 2,  /* long long */
+    JOBREPORT_COLUMN_DOUBLE = 3,
+    JOBREPORT_COLUMN_STRING = 4  /* read with jobreport_step_string() */
+} jobreport_column_type;
+
+/* Step averages, as shown by the summary of `jobreport print` */
+typedef struct
+{
+    uint32_t job_id;
+    uint32_t step_id;
+    uint32_t n_nodes;
+    uint32_t n_gpus;
+    int64_t start_time_us;
+    int64_t end_time_us;
+    double power_total_avg_w;   /* sum over the GPUs */
+    double energy_j;
+    double sm_util_avg_pct;
+    double mem_bw_util_avg_pct;
+    double max_memory_bytes;
+    double load_imbalance;      /* max / mean - 1 of the per-GPU SM utilization */
+    const char *user;           /* valid until the step is closed */
+    const char *account;
+} jobreport_summary;
+
+/* JOBREPORT_READER_VERSION of the library */
+JOBREPORT_READER_API int jobreport_reader_version(void);
+
+/* Error of the last failed call of this thread */
+JOBREPORT_READER_API const char *jobreport_last_error(void);
+
+/* Opens a job directory, or a single step directory */
+JOBREPORT_READER_API jobreport_job *jobreport_open(const char *path);
+JOBREPORT_READER_API void jobreport_close(jobreport_job *job);
+
+JOBREPORT_READER_API size_t jobreport_step_count(const jobreport_job *job);
+/* Directory of a step, valid until the job is closed */
+JOBREPORT_READER_API const char *jobreport_step_path(const jobreport_job *job, size_t index);
+
+/* Loads a step */
+JOBREPORT_READER_API jobreport_step *jobreport_step_open(const jobreport_job *job, size_t index);
+JOBREPORT_READER_API void jobreport_step_close(jobreport_step *step);
+
+/* Number of rows, one per GPU */
+JOBREPORT_READER_API size_t jobreport_step_rows(const jobreport_step *step);
+
+/* Copies the first `size` bytes of the summary, pass sizeof(jobreport_summary) */
+JOBREPORT_READER_API int jobreport_step_summary(const jobreport_step *step, jobreport_summary *summary, size_t size);
+
+/* Names of the columns, for index 0 to jobreport_column_count() - 1 */
+JOBREPORT_READER_API size_t jobreport_column_count(void);
+JOBREPORT_READER_API const char *jobreport_column_name(size_t index);
+
+/* Values of a numeric column, by name (e.g. "powerUsageAvg"), of the type stored in `type`.
+   NULL for a step without rows. */
+JOBREPORT_READER_API const void *jobreport_step_column(const jobreport_step *step, const char *name,
+                                                       jobreport_column_type *type);
+
+/* Value of a string column ("host", "user", "account") in a row */
+JOBREPORT_READER_API const char *jobreport_step_string(const jobreport_step *step, const char *name, size_t row);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JOBREPORT_READER_H */
@@ -0,0 +1,41 @@
+/*
+    Region markers for workloads monitored by jobreport.
+
+    Link with -ljobreport_regions and wrap the phases of the workload:
+
+        jobreport_region_push("solver");
+        ...
+        jobreport_region_pop();
+
+    `jobreport print` then reports the GPU utilization, power and energy
+    of every region. Regions nest, and the same name can be pushed any
+    number of times. Outside of jobreport, or once the shared buffer of
+    the node is full, the calls do nothing and return -1.
+
+    Both calls are lock-free and cost a clock read and a few stores. A
+    region pushed again within 1 ms of its pop, as the body of a loop,
+    goes on as one interval that counts its instances, without using
+    buffer space, so it can wrap inner loops. Other events are buffered,
+    about 400k per second and thread; beyond that they are dropped and
+    reported as such. Names are looked up by address: pass string
+    literals or other strings that outlive the program's use of them.
+*/
+
+#ifndef JOBREPORT_REGIONS_H
+#define JOBREPORT_REGIONS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Enters the region `name`, returns 0 if the event was recorded */
+int jobreport_region_push(const char *name);
+
+/* Leaves the innermost region, returns 0 if the event was recorded */
+int jobreport_region_pop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JOBREPORT_REGIONS_H */
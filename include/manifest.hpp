@@ -0,0 +1,231 @@
+/*
+    Job manifest.
+
+    The root metadata file of a report directory lists the files of the
+    job: every node root appends one fixed-size ManifestRecord once its
+    CSV data is complete, in a single O_APPEND write, so records from
+    concurrent nodes never interleave. In consolidated mode the ranks of
+    a node append their CSV data to one file per node, and the record
+    locates the data of the rank in it. Readers take the steps and files
+    to load from the manifest rather than listing and stat-ing the tree,
+    and compare what they read against the recorded size, row count and
+    checksum to report missing, truncated or corrupted files.
+
+    An empty root metadata file, as written by earlier versions, means
+    that the directory has to be scanned.
+*/
+
+#ifndef JOBREPORT_MANIFEST_HPP
+#define JOBREPORT_MANIFEST_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "macros.hpp"
+#include "utils.hpp"
+
+#define MANIFEST_MAGIC "JRMR"
+#define MANIFEST_VERSION 1
+#define MANIFEST_MAX_GPUS 16
+
+struct ManifestRecord
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t size;         // sizeof(ManifestRecord), to skip records of newer versions
+    uint32_t step;
+    uint32_t proc;
+    uint32_t nExpected;    // records expected for the step, one per writing rank
+    uint32_t rows;         // data rows of the CSV file
+    uint64_t fileSize;     // bytes of the CSV data of the rank
+    uint64_t offset;       // of the CSV data in the file, shared by the ranks of a node when consolidated
+    uint32_t checksum;     // FNV-1a of the CSV data
+    uint16_t nGpus;
+    uint8_t hasTimeseries; // a .ts file sits next to the CSV file
+    uint8_t sorted;        // rows are ordered by GPU id, all on `host`
+    uint16_t gpus[MANIFEST_MAX_GPUS];
+    char host[64];
+    char file[104];        // CSV file, relative to the job directory
+    char reserved[8];
+};
+
+static_assert(sizeof(ManifestRecord) == 256, "Manifest records have a fixed size");
+
+uint32_t manifest_checksum(const char *data, size_t size)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < size; ++i)
+    {
+        h ^= static_cast<unsigned char>(data[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Copies `s` into a fixed-size, zero-terminated field, false if it does not fit
+template <size_t N>
+bool copy_field(char (&field)[N], const std::string &s)
+{
+    std::memset(field, 0, N);
+    if (s.size() >= N)
+        return false;
+    std::memcpy(field, s.data(), s.size());
+    return true;
+}
+
+template <size_t N>
+std::string read_field(const char (&field)[N])
+{
+    return std::string(field, strnlen(field, N));
+}
+
+// Record of the CSV data `csv` of a rank, written at `offset` of its file, with one
+// row per GPU of `gpus`. The caller sets the file, relative to the job directory.
+ManifestRecord make_manifest_record(uint32_t step, uint32_t proc, uint32_t nExpected, const std::string &csv,
+                                    uint64_t offset, const std::vector<unsigned int> &gpus,
+                                    const std::string &host, bool hasTimeseries)
+{
+    ManifestRecord record = {};
+    std::memcpy(record.magic, MANIFEST_MAGIC, 4);
+    record.version = MANIFEST_VERSION;
+    record.size = sizeof(ManifestRecord);
+    record.step = step;
+    record.proc = proc;
+    record.nExpected = nExpected;
+    record.rows = gpus.size();
+    record.fileSize = csv.size();
+    record.offset = offset;
+    record.checksum = manifest_checksum(csv.data(), csv.size());
+    record.nGpus = std::min<size_t>(gpus.size(), MANIFEST_MAX_GPUS);
+    for (size_t i = 0; i < record.nGpus; ++i)
+    {
+        record.gpus[i] = gpus[i];
+    }
+    record.sorted = std::is_sorted(gpus.begin(), gpus.end());
+    record.hasTimeseries = hasTimeseries;
+    copy_field(record.host, host);
+    return record;
+}
+
+// Appends `record` to the manifest of the job directory `root`
+bool append_manifest_record(const std::filesystem::path &root, const ManifestRecord &record)
+{
+    int fd = open((root / ROOT_METADATA_FILE).c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0)
+        return false;
+
+    // A single write of a whole record: O_APPEND makes it atomic with respect to other appenders
+    ssize_t written = write(fd, &record, sizeof(record));
+    close(fd);
+    return written == static_cast<ssize_t>(sizeof(record));
+}
+
+// Appends `data` to `file` in a single O_APPEND write and returns the offset it
+// was written at, so that the ranks of a node can share a file without locking
+bool append_block(const std::filesystem::path &file, const std::string &data, uint64_t &offset)
+{
+    int fd = open(file.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0)
+        return false;
+
+    ssize_t written = write(fd, data.data(), data.size());
+    off_t end = lseek(fd, 0, SEEK_CUR);
+    close(fd);
+    if (written != static_cast<ssize_t>(data.size()) || end < written)
+        return false;
+
+    offset = end - written;
+    return true;
+}
+
+// Orders records and step numbers by step, for the search of the records of a step
+struct ManifestStepOrder
+{
+    bool operator()(const ManifestRecord &record, unsigned int step) const { return record.step < step; }
+    bool operator()(unsigned int step, const ManifestRecord &record) const { return step < record.step; }
+};
+
+class JobManifest
+{
+public:
+    std::filesystem::path root;
+    std::vector<ManifestRecord> records; // last record of each (step, proc), by step then proc
+
+    bool empty() const { return records.empty(); }
+
+    bool read(const std::filesystem::path &dir);
+    std::vector<ManifestRecord> step_records(unsigned int step) const;
+};
+
+bool JobManifest::read(const std::filesystem::path &dir)
+{
+    root = dir;
+    records.clear();
+
+    std::ifstream ifs(dir / ROOT_METADATA_FILE, std::ios::binary);
+    if (!ifs.is_open())
+        return false;
+
+    std::string data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+
+    // A rerun with --force appends new records for the same ranks, the last one wins
+    std::map<std::pair<uint32_t, uint32_t>, ManifestRecord> latest;
+    size_t offset = 0;
+    while (data.size() - offset >= 8)
+    {
+        ManifestRecord record;
+        std::memcpy(&record, data.data() + offset, std::min(sizeof(record), data.size() - offset));
+        if (std::memcmp(record.magic, MANIFEST_MAGIC, 4) != 0 || record.size < 8)
+        {
+            std::cerr << "WARNING: Corrupted job manifest, ignoring it: " << dir / ROOT_METADATA_FILE << std::endl;
+            latest.clear();
+            break;
+        }
+        if (data.size() - offset < record.size)
+            break; // partially written last record
+
+        if (record.version == MANIFEST_VERSION && record.size == sizeof(ManifestRecord))
+        {
+            latest[{record.step, record.proc}] = record;
+        }
+        offset += record.size;
+    }
+
+    for (const auto &entry : latest)
+    {
+        records.push_back(entry.second);
+    }
+    return !records.empty();
+}
+
+std::vector<ManifestRecord> JobManifest::step_records(unsigned int step) const
+{
+    auto range = std::equal_range(records.begin(), records.end(), step, ManifestStepOrder());
+    return std::vector<ManifestRecord>(range.first, range.second);
+}
+
+// Order-independent fingerprint of the files of a step, as recorded in the manifest
+uint64_t manifest_fingerprint(const std::vector<ManifestRecord> &records)
+{
+    uint64_t fingerprint = 0;
+    for (const auto &record : records)
+    {
+        uint64_t h = manifest_checksum(record.file, strnlen(record.file, sizeof(record.file)));
+        h = (h << 32) ^ record.checksum;
+        h ^= record.fileSize * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 31;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        fingerprint += h ^ (h >> 29);
+    }
+    return fingerprint ^ records.size();
+}
+
+#endif // JOBREPORT_MANIFEST_HPP
@@ -0,0 +1,248 @@
+/*
+    Phase markers written to a FIFO, for workloads that cannot link
+    libjobreport_regions (closed-source codes, shell scripts).
+
+    The node root that collects the regions of the node creates the FIFO
+    of the node and is its only reader. Every rank waits for it to be
+    created, up to MARKER_FIFO_WAIT, then opens it and exports it to the workload
+    as JOBREPORT_MARKER_FD, an inherited descriptor, and as
+    JOBREPORT_MARKER_FIFO, its path. The workload writes one marker per
+    line:
+
+        echo "begin io" >&$JOBREPORT_MARKER_FD
+        ...
+        echo "end io" >&$JOBREPORT_MARKER_FD
+
+    The descriptor is non-blocking: once the pipe is full, a write fails
+    instead of stalling the workload, unlike a write through the path.
+    It is one of 3 to 9 when possible, which POSIX shells can redirect. The node root reads the markers as
+    they arrive, timestamps them and records them as begin and end events
+    in a lane of its region segment, whose bounded buffer counts what it
+    cannot hold as dropped, so markers end up in the region report next
+    to the regions of libjobreport_regions. An end closes the last open
+    begin of the same name; other lines are ignored.
+*/
+
+#ifndef JOBREPORT_MARKERS_HPP
+#define JOBREPORT_MARKERS_HPP
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <thread>
+#include <chrono>
+#include <filesystem>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "control_socket.hpp"
+#include "regions.hpp"
+#include "utils.hpp"
+#include "macros.hpp"
+
+#define MARKER_FD_ENV "JOBREPORT_MARKER_FD"
+#define MARKER_FIFO_ENV "JOBREPORT_MARKER_FIFO"
+#define MARKER_FIFO_EXTENSION ".fifo"
+#define MARKER_LINE_MAX 256 // longer lines are ignored
+#define MARKER_FIFO_WAIT 2000 // ms, for the collecting node root to create the FIFO
+
+// FIFO shared by the ranks of a node: in the runtime directory if there is one, in `step_dir` otherwise
+std::filesystem::path marker_fifo_path(const std::string &job, const std::string &step, const std::filesystem::path &step_dir)
+{
+    std::error_code ec;
+    if (std::filesystem::is_directory(control_socket_dir().parent_path(), ec))
+    {
+        std::filesystem::create_directories(control_socket_dir(), ec);
+        if (!ec)
+            return control_socket_dir() / (job + "." + step + MARKER_FIFO_EXTENSION);
+    }
+    return step_dir / ("markers_" + get_hostname() + MARKER_FIFO_EXTENSION);
+}
+
+// Opens the FIFO for the workload once the collector of the segment `ring` created it, -1 if it does not in time.
+// Opened for reading too, so that writes do not fail once the node root closed it.
+int open_marker_fifo(const std::filesystem::path &path, const std::string &ring)
+{
+    for (int waited = 0;; waited += 10)
+    {
+        struct stat st;
+        if (region_ring_owner(ring) != 0 && stat(path.c_str(), &st) == 0 && S_ISFIFO(st.st_mode))
+            return open(path.c_str(), O_RDWR | O_NONBLOCK);
+        if (waited >= MARKER_FIFO_WAIT)
+            return -1;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+// Descriptor number of the FIFO in the workload: the first of 3 to 9 that
+// is free or closed by exec, where the child moves the descriptor to
+int marker_fd_slot(int fd)
+{
+    for (int slot = 3; slot <= 9; ++slot)
+    {
+        int flags = fcntl(slot, F_GETFD);
+        if (flags < 0 || (flags & FD_CLOEXEC))
+            return slot;
+    }
+    return fd;
+}
+
+class MarkerReader
+{
+public:
+    ~MarkerReader() { stop(); }
+
+    // Creates the FIFO, by the collector of the node only
+    bool start(const std::filesystem::path &path, RegionCollector &collector);
+    // Reads the markers left in the FIFO and removes it
+    void stop();
+
+private:
+    std::filesystem::path path;
+    int fd = -1;
+    int wake = -1; // eventfd signalled by stop()
+    RegionCollector *collector = nullptr;
+    RegionLane *lane = nullptr;
+    std::unordered_map<std::string, uint32_t> names;
+    std::string line;
+    bool overlong = false; // the current line is too long and is skipped
+    uint64_t ignored = 0;
+
+    std::thread thread;
+
+    void loop();
+    void read_markers();
+    void marker(std::string_view line);
+};
+
+bool MarkerReader::start(const std::filesystem::path &path, RegionCollector &collector)
+{
+    this->path = path;
+    this->collector = &collector;
+
+    lane = collector.claim_lane();
+    if (lane == nullptr)
+        return false;
+
+    // Left behind by a killed collector
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+    if (mkfifo(path.c_str(), 0600) != 0)
+        return false;
+    // Also open for writing, so that the FIFO never reports end-of-file when the workload closes it
+    fd = open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    wake = eventfd(0, EFD_CLOEXEC);
+    if (fd < 0 || wake < 0)
+    {
+        stop();
+        return false;
+    }
+
+    thread = std::thread(&MarkerReader::loop, this);
+    return true;
+}
+
+void MarkerReader::stop()
+{
+    if (thread.joinable())
+    {
+        uint64_t one = 1;
+        if (write(wake, &one, sizeof(one)) < 0)
+        {
+            LOG("Could not wake the marker reader");
+        }
+        thread.join();
+    }
+
+    if (fd >= 0)
+    {
+        close(fd);
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+    }
+    if (wake >= 0)
+        close(wake);
+    fd = wake = -1;
+
+    if (ignored > 0)
+    {
+        LOG("Ignored " << ignored << " malformed markers");
+    }
+}
+
+void MarkerReader::loop()
+{
+    pollfd fds[2] = {{fd, POLLIN, 0}, {wake, POLLIN, 0}};
+    while (true)
+    {
+        if (poll(fds, 2, -1) < 0 && errno != EINTR)
+            break;
+        // Markers written before the end of the step are read before leaving
+        read_markers();
+        if (fds[1].revents & POLLIN)
+            break;
+    }
+}
+
+void MarkerReader::read_markers()
+{
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+    {
+        for (ssize_t i = 0; i < n; ++i)
+        {
+            if (buffer[i] != '\n')
+            {
+                if (line.size() < MARKER_LINE_MAX)
+                    line += buffer[i];
+                else
+                    overlong = true;
+                continue;
+            }
+            if (!overlong)
+                marker(line);
+            else
+                ignored++;
+            line.clear();
+            overlong = false;
+        }
+    }
+}
+
+void MarkerReader::marker(std::string_view line)
+{
+    auto trim = [](std::string_view s) {
+        size_t begin = s.find_first_not_of(" \t\r");
+        size_t end = s.find_last_not_of(" \t\r");
+        return begin == std::string_view::npos ? std::string_view() : s.substr(begin, end - begin + 1);
+    };
+    line = trim(line);
+
+    RegionEventKind kind;
+    if (line.rfind("begin ", 0) == 0)
+        kind = RegionBegin;
+    else if (line.rfind("end ", 0) == 0)
+        kind = RegionEnd;
+    else
+    {
+        if (!line.empty())
+            ignored++;
+        return;
+    }
+
+    std::string name(trim(line.substr(line.find(' '))));
+    auto it = names.find(name);
+    if (it == names.end())
+        it = names.emplace(name, collector->intern(name.c_str())).first;
+    if (it->second == UINT32_MAX)
+        return; // no name left in the segment
+
+    region_ring_record(*lane, kind, it->second, 0);
+}
+
+#endif // JOBREPORT_MARKERS_HPP
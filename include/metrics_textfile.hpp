@@ -0,0 +1,258 @@
+/*
+    Metrics textfile of the node root.
+
+    While the workload runs, the node root periodically renders the
+    statistics published by the sampler in the Prometheus text format
+    into <dir>/jobreport_<job>_<step>_<proc>.prom, for the textfile
+    collector of node_exporter to scrape. Every metric carries the job,
+    step, user and account labels, and the GPU metrics a gpu label.
+
+    The file is written to a temporary name the collector ignores and
+    renamed over the previous one, so a scrape never sees a partial
+    file, and removed when the step ends so that the metrics of a
+    finished step do not linger. Rendering reuses the same snapshot
+    vector, label string and OutputBuffer for every file, so a refresh
+    does not allocate per GPU or per sample.
+*/
+
+#ifndef JOBREPORT_METRICS_TEXTFILE_HPP
+#define JOBREPORT_METRICS_TEXTFILE_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <filesystem>
+#include <unistd.h>
+
+#include "slurm_job.hpp"
+#include "sampler.hpp"
+#include "table_writer.hpp"
+
+#define METRICS_TEXTFILE_INTERVAL 15 // s, at least the sampling time
+#define METRICS_TEXTFILE_EXTENSION ".prom"
+
+enum class MetricStatistic
+{
+    Latest,
+    Average,
+    Energy
+};
+
+class MetricsTextfile
+{
+public:
+    MetricsTextfile(const std::filesystem::path &dir, const SlurmJob &job, const Sampler &sampler, long long sampling_time);
+    ~MetricsTextfile() { stop(); }
+
+    void start();
+    void stop();
+
+private:
+    std::filesystem::path path;
+    std::filesystem::path tmp;
+    std::string labels; // job, step, user and account, escaped once
+    const Sampler &sampler;
+    std::chrono::microseconds interval;
+
+    std::vector<ChannelStats> stats;
+    std::ofstream file;
+    OutputBuffer out;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool running = false;
+
+    void loop();
+    bool write();
+    void family(const char *name, const char *type, const char *help, size_t field, MetricStatistic statistic, bool gpus);
+    void sample(const char *name, const ChannelStats &s, double value);
+};
+
+// Appends `value` as a label value, escaping backslashes, quotes and newlines
+void append_label_value(std::string &out, std::string_view value)
+{
+    out += '"';
+    for (char c : value)
+    {
+        if (c == '\\' || c == '"')
+        {
+            out += '\\';
+            out += c;
+        }
+        else if (c == '\n')
+        {
+            out += "\\n";
+        }
+        else
+        {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+MetricsTextfile::MetricsTextfile(const std::filesystem::path &dir, const SlurmJob &job, const Sampler &sampler,
+                                 long long sampling_time)
+    : sampler(sampler),
+      interval(std::max<long long>(METRICS_TEXTFILE_INTERVAL * 1000000LL, sampling_time)),
+      out(file)
+{
+    std::string name = "jobreport_" + job.job_id + "_" + job.step_id + "_" + job.proc_id;
+    path = dir / (name + METRICS_TEXTFILE_EXTENSION);
+    // The collector only reads *.prom files
+    tmp = dir / ("." + name + ".tmp." + std::to_string(getpid()));
+
+    labels = "job=";
+    append_label_value(labels, job.job_id);
+    labels += ",step=";
+    append_label_value(labels, job.step_id);
+    labels += ",user=";
+    append_label_value(labels, job.user);
+    labels += ",account=";
+    append_label_value(labels, job.account);
+}
+
+void MetricsTextfile::start()
+{
+    running = true;
+    thread = std::thread(&MetricsTextfile::loop, this);
+}
+
+void MetricsTextfile::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!running)
+            return;
+        running = false;
+    }
+    cv.notify_all();
+    thread.join();
+
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+}
+
+void MetricsTextfile::loop()
+{
+    bool warned = false;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (running)
+    {
+        cv.wait_for(lock, interval);
+        if (!running)
+            break;
+        lock.unlock();
+        if (!write() && !warned)
+        {
+            std::cerr << "WARNING: Could not write the metrics textfile " << path << std::endl;
+            warned = true;
+        }
+        lock.lock();
+    }
+}
+
+bool MetricsTextfile::write()
+{
+    sampler.snapshot(stats);
+
+    file.open(tmp, std::ios::trunc);
+    if (!file.is_open())
+        return false;
+
+    family("jobreport_gpu_power_watts", "gauge", "Latest power usage of the GPU",
+           0, MetricStatistic::Latest, true);
+    family("jobreport_gpu_power_average_watts", "gauge", "Average power usage of the GPU since the step started",
+           0, MetricStatistic::Average, true);
+    family("jobreport_gpu_energy_joules_total", "counter", "Energy consumed by the GPU since the step started",
+           0, MetricStatistic::Energy, true);
+    family("jobreport_gpu_sm_utilization_percent", "gauge", "Latest SM utilization of the GPU",
+           1, MetricStatistic::Latest, true);
+    family("jobreport_gpu_sm_utilization_average_percent", "gauge", "Average SM utilization of the GPU since the step started",
+           1, MetricStatistic::Average, true);
+    family("jobreport_gpu_memory_utilization_percent", "gauge", "Latest memory bandwidth utilization of the GPU",
+           2, MetricStatistic::Latest, true);
+    family("jobreport_gpu_memory_utilization_average_percent", "gauge", "Average memory bandwidth utilization of the GPU since the step started",
+           2, MetricStatistic::Average, true);
+    family("jobreport_node_power_watts", "gauge", "Latest power usage of the node",
+           0, MetricStatistic::Latest, false);
+    out.flush();
+    file.close();
+
+    if (!file)
+    {
+        file.clear();
+        std::error_code ec;
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    if (ec)
+    {
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
+
+// Writes the samples of one metric, of the GPUs or of the node
+void MetricsTextfile::family(const char *name, const char *type, const char *help, size_t field,
+                             MetricStatistic statistic, bool gpus)
+{
+    bool header = false;
+    for (const ChannelStats &s : stats)
+    {
+        if ((s.channel != NODE_CHANNEL) != gpus)
+            continue;
+
+        double value = s.latest[field];
+        if (statistic == MetricStatistic::Average)
+            value = s.mean(field);
+        else if (statistic == MetricStatistic::Energy)
+            value = s.count[field] > 0 ? s.energy : NAN;
+        if (std::isnan(value))
+            continue; // no sample yet
+
+        if (!header)
+        {
+            out.write("# HELP ");
+            out.write(name);
+            out.put(' ');
+            out.write(help);
+            out.write("\n# TYPE ");
+            out.write(name);
+            out.put(' ');
+            out.write(type);
+            out.put('\n');
+            header = true;
+        }
+        sample(name, s, value);
+    }
+}
+
+void MetricsTextfile::sample(const char *name, const ChannelStats &s, double value)
+{
+    out.write(name);
+    out.put('{');
+    out.write(labels);
+    if (s.channel != NODE_CHANNEL)
+    {
+        out.write(",gpu=\"");
+        out.integer(s.channel);
+        out.put('"');
+    }
+    out.write("} ");
+    out.fixed(value, 3);
+    out.put('\n');
+}
+
+#endif // JOBREPORT_METRICS_TEXTFILE_HPP
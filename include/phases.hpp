@@ -0,0 +1,367 @@
+/*
+    Phase detection and idle-period accounting.
+
+    The utilization time series of every GPU is segmented online with a
+    two-sided CUSUM change-point detector on the SM and memory bandwidth
+    utilization: a segment ends as soon as either signal drifts away
+    from the running mean of the segment, and the samples since the
+    CUSUM statistic last left zero are moved to the next segment, which
+    places the cut at the actual change rather than at its detection.
+    Each segment is then classified from its mean utilization and trend:
+
+        idle                SM and memory BW utilization below 5 %
+        ramp-up             SM utilization rising over the segment (least
+                            squares trend) by 20 points or more, and by
+                            at least half of its mean
+        memory-bound        memory BW utilization >= 40 % and >= SM
+        compute-bound       SM utilization >= 40 %
+        communication-like  busy, but neither compute nor memory bound,
+                            as when kernels wait on collectives
+
+    Only the state of the open segment of each GPU is kept, so the
+    analysis is a single linear pass over the streamed samples.
+*/
+
+#ifndef JOBREPORT_PHASES_HPP
+#define JOBREPORT_PHASES_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <algorithm>
+#include <filesystem>
+
+#include "timeseries.hpp"
+
+#define PHASE_IDLE_THRESHOLD 5.0   // %
+#define PHASE_BUSY_THRESHOLD 40.0  // %
+#define PHASE_RAMP_THRESHOLD 20.0  // % points
+#define PHASE_CUSUM_DRIFT 5.0      // % tolerated before accumulating
+#define PHASE_CUSUM_THRESHOLD 50.0 // % x samples
+#define PHASE_LOOKBACK 32          // samples that can be moved to the next segment
+
+enum class Phase
+{
+    Idle = 0,
+    RampUp,
+    MemoryBound,
+    ComputeBound,
+    Communication,
+    Count
+};
+
+const char *phase_name(Phase phase)
+{
+    static const char *names[] = {"Idle", "Ramp-up", "Memory-bound", "Compute-bound", "Communication-like"};
+    return names[static_cast<int>(phase)];
+}
+
+// Two-sided CUSUM on the deviation from the running mean
+struct ChangeDetector
+{
+    double mean = 0;
+    double high = 0;
+    double low = 0;
+    size_t n = 0;
+    size_t high_run = 0; // samples since `high` was last zero
+    size_t low_run = 0;  // samples since `low` was last zero
+
+    // Returns the number of samples since the change, 0 if there is none
+    size_t update(double x)
+    {
+        n++;
+        mean += (x - mean) / n;
+        high = std::max(0.0, high + x - mean - PHASE_CUSUM_DRIFT);
+        low = std::max(0.0, low + mean - x - PHASE_CUSUM_DRIFT);
+        high_run = high > 0 ? high_run + 1 : 0;
+        low_run = low > 0 ? low_run + 1 : 0;
+
+        if (high > PHASE_CUSUM_THRESHOLD)
+            return high_run;
+        if (low > PHASE_CUSUM_THRESHOLD)
+            return low_run;
+        return 0;
+    }
+
+    void reset() { *this = ChangeDetector(); }
+};
+
+struct IdleInterval
+{
+    std::string host;
+    unsigned int gpuId = 0;
+    long long start = 0;    // us, clock of the node
+    long long duration = 0; // us
+};
+
+struct PhaseReport
+{
+    double gpuHours[static_cast<int>(Phase::Count)] = {};
+    std::map<std::string, double> idleHoursPerNode;
+    IdleInterval longestIdle;
+    size_t nSegments = 0;
+
+    bool empty() const { return total_hours() == 0; }
+
+    double total_hours() const
+    {
+        double total = 0;
+        for (double h : gpuHours)
+            total += h;
+        return total;
+    }
+
+    double idle_hours() const { return gpuHours[static_cast<int>(Phase::Idle)]; }
+};
+
+// Online segmentation of the utilization of one GPU
+class PhaseSegmenter
+{
+public:
+    PhaseSegmenter(PhaseReport &report, const std::string &host, unsigned int gpuId)
+        : report(report), host(host), gpuId(gpuId) {}
+
+    // Sample covering [t, t + dt) with the given utilizations
+    void add(long long t, long long dt, double sm, double mem)
+    {
+        accumulate(Sample{t, dt, sm, mem});
+
+        size_t run = std::max(sm_detector.update(sm), mem_detector.update(mem));
+        if (run == 0)
+            return;
+
+        // Move the samples since the change to a new segment
+        run = std::min(run, recent.size());
+        if (run >= count)
+            return;
+        std::vector<Sample> moved(recent.end() - run, recent.end());
+        for (const auto &m : moved)
+        {
+            accumulate(m, -1);
+        }
+
+        close();
+        for (const auto &m : moved)
+        {
+            accumulate(m);
+            sm_detector.update(m.sm);
+            mem_detector.update(m.mem);
+        }
+    }
+
+    // Closes the open segment
+    void close()
+    {
+        if (count > 0 && duration > 0)
+        {
+            Phase phase = classify(sum_sm / duration, sum_mem / duration, rise());
+            account(phase);
+        }
+
+        sm_detector.reset();
+        mem_detector.reset();
+        recent.clear();
+        count = 0;
+        duration = 0;
+        sum_sm = 0;
+        sum_mem = 0;
+        sum_x = 0;
+        sum_xx = 0;
+        sum_xsm = 0;
+    }
+
+    // Ends the last idle run, if any
+    void finish()
+    {
+        close();
+        end_idle_run();
+    }
+
+private:
+    struct Sample
+    {
+        long long t;
+        long long dt;
+        double sm;
+        double mem;
+    };
+
+    PhaseReport &report;
+    std::string host;
+    unsigned int gpuId;
+    std::deque<Sample> recent; // last samples of the open segment
+
+    ChangeDetector sm_detector;
+    ChangeDetector mem_detector;
+    long long start = 0;
+    long long duration = 0;
+    size_t count = 0;
+
+    // Time-weighted sums, x being the time since the start of the segment
+    double sum_sm = 0;
+    double sum_mem = 0;
+    double sum_x = 0;
+    double sum_xx = 0;
+    double sum_xsm = 0;
+
+    // Consecutive idle segments form a single idle interval
+    long long idle_start = -1;
+    long long idle_duration = 0;
+
+    // Adds (sign = 1) or removes (sign = -1) a sample from the open segment
+    void accumulate(const Sample &s, int sign = 1)
+    {
+        if (count == 0)
+        {
+            start = s.t;
+        }
+
+        double w = sign * static_cast<double>(s.dt);
+        double x = (s.t - start + s.dt / 2) / 1e6;
+        sum_sm += w * s.sm;
+        sum_mem += w * s.mem;
+        sum_x += w * x;
+        sum_xx += w * x * x;
+        sum_xsm += w * x * s.sm;
+        duration += sign * s.dt;
+        count += sign;
+
+        if (sign > 0)
+        {
+            recent.push_back(s);
+            if (recent.size() > PHASE_LOOKBACK)
+                recent.pop_front();
+        }
+        else
+        {
+            recent.pop_back();
+        }
+    }
+
+    // Change of SM utilization over the segment according to its least-squares trend
+    double rise() const
+    {
+        double w = static_cast<double>(duration);
+        double denominator = w * sum_xx - sum_x * sum_x;
+        if (denominator <= 0)
+            return 0;
+        double slope = (w * sum_xsm - sum_x * sum_sm) / denominator; // % per s
+        return slope * duration / 1e6;
+    }
+
+    static Phase classify(double sm, double mem, double rise)
+    {
+        if (sm < PHASE_IDLE_THRESHOLD && mem < PHASE_IDLE_THRESHOLD)
+            return Phase::Idle;
+        if (rise >= PHASE_RAMP_THRESHOLD && rise >= 0.5 * sm)
+            return Phase::RampUp;
+        if (mem >= PHASE_BUSY_THRESHOLD && mem >= sm)
+            return Phase::MemoryBound;
+        if (sm >= PHASE_BUSY_THRESHOLD)
+            return Phase::ComputeBound;
+        return Phase::Communication;
+    }
+
+    void account(Phase phase)
+    {
+        double hours = duration / 3600e6;
+        report.gpuHours[static_cast<int>(phase)] += hours;
+        report.nSegments++;
+
+        if (phase == Phase::Idle)
+        {
+            report.idleHoursPerNode[host] += hours;
+            if (idle_start < 0)
+                idle_start = start;
+            idle_duration += duration;
+        }
+        else
+        {
+            end_idle_run();
+        }
+    }
+
+    void end_idle_run()
+    {
+        if (idle_start >= 0 && idle_duration > report.longestIdle.duration)
+        {
+            report.longestIdle = IdleInterval{host, gpuId, idle_start, idle_duration};
+        }
+        idle_start = -1;
+        idle_duration = 0;
+    }
+};
+
+// Resolution is the time resolution to read the samples at, in us
+PhaseReport compute_phases(const std::filesystem::path &dir, long long resolution)
+{
+    PROFILE_SCOPE("compute_phases");
+    PhaseReport report;
+
+    std::vector<TimeSeriesBucket> buckets;
+    for (const auto &file : list_timeseries(dir))
+    {
+        TimeSeriesReader reader;
+        if (!reader.open(file))
+            continue;
+
+        size_t level = reader.select_level(resolution);
+        reader.seek_level(level);
+
+        const TimeSeriesHeader &header = reader.header;
+        size_t nChannels = header.channels.size();
+        long long width = reader.level_width(level);
+
+        std::vector<PhaseSegmenter> segmenters;
+        for (size_t c = 0; c < nChannels; ++c)
+        {
+            segmenters.emplace_back(report, header.host, header.channels[c]);
+        }
+
+        // Utilization samples of a channel arrive one field at a time: the
+        // memory utilization is carried over until its next sample, and each
+        // SM sample is accounted once the next one tells how long it lasted
+        std::vector<double> mem(nChannels, 0.0);
+        std::vector<double> prev_sm(nChannels, 0.0);
+        std::vector<long long> prev_t(nChannels, -1);
+
+        while (reader.next(buckets))
+        {
+            for (const auto &b : buckets)
+            {
+                size_t c = b.channel;
+                if (c >= nChannels || header.channels[c] == NODE_CHANNEL)
+                    continue;
+
+                if (b.field == static_cast<uint16_t>(TimeSeriesField::MemoryUtilization))
+                {
+                    mem[c] = b.mean;
+                }
+                else if (b.field == static_cast<uint16_t>(TimeSeriesField::SmUtilization))
+                {
+                    if (prev_t[c] >= 0 && b.start > prev_t[c])
+                    {
+                        // A gap in the samples is attributed for at most two periods
+                        segmenters[c].add(prev_t[c], std::min(b.start - prev_t[c], 2 * width), prev_sm[c], mem[c]);
+                    }
+                    prev_t[c] = b.start;
+                    prev_sm[c] = b.mean;
+                }
+            }
+        }
+
+        for (size_t c = 0; c < nChannels; ++c)
+        {
+            if (prev_t[c] >= 0)
+            {
+                segmenters[c].add(prev_t[c], width, prev_sm[c], mem[c]);
+            }
+            segmenters[c].finish();
+        }
+    }
+
+    return report;
+}
+
+#endif // JOBREPORT_PHASES_HPP
@@ -0,0 +1,253 @@
+/*
+    Job-wide power timeline.
+
+    The power samples of every GPU (and node, where recorded) are
+    linearly interpolated onto a common time grid and summed into one
+    job-level curve. Files are streamed one chunk at a time and each
+    channel only keeps its previous sample, so memory usage is bounded
+    by the size of the grid regardless of the number of GPUs.
+
+    Nodes do not share a clock: every file is aligned on its own start
+    time, which removes clock offsets between nodes at the cost of the
+    (small) launch skew between them.
+
+    Each file is read from the coarsest aggregated level that still
+    resolves the grid. Bucket means are summed into the power curve,
+    and bucket maxima into an envelope that keeps short spikes visible.
+*/
+
+#ifndef JOBREPORT_POWER_TIMELINE_HPP
+#define JOBREPORT_POWER_TIMELINE_HPP
+
+#include <vector>
+#include <string>
+#include <set>
+#include <algorithm>
+#include <numeric>
+#include <filesystem>
+
+#include "timeseries.hpp"
+#include "dataframe.hpp"
+
+// Number of grid points of a timeline when no resolution is requested
+#define POWER_TIMELINE_POINTS 4096
+// Upper bound on the number of grid points of a timeline
+#define POWER_TIMELINE_MAX_POINTS (1 << 20)
+#define SPARKLINE_WIDTH 60
+
+struct PowerCurve
+{
+    std::vector<double> power;    // summed power at each grid point (W)
+    std::vector<double> envelope; // summed maximum power at each grid point (W)
+    size_t nChannels = 0;
+
+    bool empty() const { return nChannels == 0; }
+    size_t peak_index() const;
+    double percentile(double p) const;
+    double average() const;
+    std::string sparkline(size_t width = SPARKLINE_WIDTH) const;
+};
+
+struct PowerTimeline
+{
+    long long origin = 0; // us, start of the earliest node
+    long long step = 0;   // us between grid points
+    bool aggregated = false; // read from aggregated levels rather than raw samples
+    PowerCurve gpu;
+    PowerCurve node;
+
+    bool empty() const { return gpu.empty() && node.empty(); }
+};
+
+size_t PowerCurve::peak_index() const
+{
+    return std::max_element(power.begin(), power.end()) - power.begin();
+}
+
+double PowerCurve::percentile(double p) const
+{
+    std::vector<double> tmp(power);
+    size_t k = static_cast<size_t>(p / 100. * (tmp.size() - 1) + 0.5);
+    std::nth_element(tmp.begin(), tmp.begin() + k, tmp.end());
+    return tmp[k];
+}
+
+double PowerCurve::average() const
+{
+    return std::accumulate(power.begin(), power.end(), 0.0) / power.size();
+}
+
+std::string PowerCurve::sparkline(size_t width) const
+{
+    static const std::string levels = " .:-=+*#%@";
+
+    double peak = *std::max_element(envelope.begin(), envelope.end());
+    size_t bucket = (envelope.size() + width - 1) / width;
+
+    std::string line;
+    for (size_t i = 0; i < envelope.size(); i += bucket)
+    {
+        // Max of each bucket, so that short spikes remain visible
+        double v = *std::max_element(envelope.begin() + i, envelope.begin() + std::min(i + bucket, envelope.size()));
+        size_t level = peak > 0 ? static_cast<size_t>(v / peak * (levels.size() - 1) + 0.5) : 0;
+        line += levels[level];
+    }
+    return line;
+}
+
+// Adds the linear interpolation between (t0, v0) and (t1, v1) to all grid points in (t0, t1]
+void accumulate_segment(std::vector<double> &curve, long long step,
+                        long long t0, double v0, long long t1, double v1)
+{
+    if (t1 <= t0 || t1 < 0)
+        return;
+
+    long long first = t0 < 0 ? 0 : t0 / step + 1;
+    long long last = std::min<long long>(t1 / step, curve.size() - 1);
+    if (first > last)
+        return;
+
+    // v(g) = a + b * g, written so that the loop vectorizes
+    double slope = (v1 - v0) / (t1 - t0);
+    double a = v0 - slope * t0;
+    double b = slope * step;
+    double *c = curve.data();
+    for (long long g = first; g <= last; ++g)
+    {
+        c[g] += a + b * g;
+    }
+}
+
+// Resolution is the requested time between grid points in us, 0 to pick one automatically
+PowerTimeline compute_power_timeline(const std::filesystem::path &dir, const DataFrame &df, long long resolution = 0)
+{
+    PROFILE_SCOPE("compute_power_timeline");
+    PowerTimeline timeline;
+
+    std::vector<std::filesystem::path> files = list_timeseries(dir);
+    if (files.empty() || df.gpuId.empty())
+    {
+        return timeline;
+    }
+
+    // The grid covers the longest GPU of the step
+    long long duration = 0;
+    for (size_t i = 0; i < df.gpuId.size(); ++i)
+    {
+        duration = std::max(duration, df.endTime[i] - df.startTime[i]);
+    }
+
+    long long sampling = 0;
+    timeline.origin = std::numeric_limits<long long>::max();
+    for (const auto &file : files)
+    {
+        TimeSeriesReader reader;
+        if (reader.open(file))
+        {
+            sampling = sampling == 0 ? reader.header.samplingTime : std::min<long long>(sampling, reader.header.samplingTime);
+            timeline.origin = std::min<long long>(timeline.origin, reader.header.startTime);
+        }
+    }
+
+    if (sampling <= 0 || duration <= 0)
+    {
+        return PowerTimeline();
+    }
+
+    if (resolution <= 0)
+    {
+        resolution = duration / POWER_TIMELINE_POINTS;
+    }
+    timeline.step = std::max({resolution, sampling, duration / POWER_TIMELINE_MAX_POINTS + 1});
+
+    size_t n = duration / timeline.step + 1;
+    for (PowerCurve *curve : {&timeline.gpu, &timeline.node})
+    {
+        curve->power.assign(n, 0.0);
+        curve->envelope.assign(n, 0.0);
+    }
+
+    // Ranks sharing a node all record the same node power
+    std::set<std::string> hosts_with_node_power;
+
+    std::vector<TimeSeriesBucket> buckets;
+    for (const auto &file : files)
+    {
+        TimeSeriesReader reader;
+        if (!reader.open(file))
+        {
+            std::cerr << "WARNING: Could not read time series. Skipping: " << file << std::endl;
+            continue;
+        }
+
+        size_t level = reader.select_level(timeline.step);
+        reader.seek_level(level);
+        timeline.aggregated |= level > 0;
+
+        const TimeSeriesHeader &header = reader.header;
+        size_t nChannels = header.channels.size();
+        long long width = reader.level_width(level);
+        // Raw samples sit at their timestamp, buckets at their center
+        long long center = level > 0 ? width / 2 : 0;
+
+        std::vector<bool> use(nChannels, true);
+        for (size_t c = 0; c < nChannels; ++c)
+        {
+            if (header.channels[c] == NODE_CHANNEL)
+            {
+                use[c] = hosts_with_node_power.insert(header.host).second;
+            }
+        }
+
+        std::vector<long long> prev_t(nChannels, -1);
+        std::vector<double> prev_mean(nChannels, 0.0);
+        std::vector<double> prev_max(nChannels, 0.0);
+
+        auto segment = [&](PowerCurve &curve, long long t0, double mean0, double max0,
+                           long long t1, double mean1, double max1) {
+            accumulate_segment(curve.power, timeline.step, t0, mean0, t1, mean1);
+            accumulate_segment(curve.envelope, timeline.step, t0, max0, t1, max1);
+        };
+
+        while (reader.next(buckets))
+        {
+            for (const auto &b : buckets)
+            {
+                if (b.field != static_cast<uint16_t>(TimeSeriesField::Power) || b.channel >= nChannels || !use[b.channel])
+                    continue;
+
+                PowerCurve &curve = header.channels[b.channel] == NODE_CHANNEL ? timeline.node : timeline.gpu;
+                long long t = b.start + center - header.startTime;
+                size_t c = b.channel;
+
+                if (prev_t[c] < 0)
+                {
+                    // Hold the first sample for one sampling period before it
+                    segment(curve, t - width, b.mean, b.max, t, b.mean, b.max);
+                }
+                else
+                {
+                    segment(curve, prev_t[c], prev_mean[c], prev_max[c], t, b.mean, b.max);
+                }
+                prev_t[c] = t;
+                prev_mean[c] = b.mean;
+                prev_max[c] = b.max;
+            }
+        }
+
+        // Hold the last sample for one sampling period after it
+        for (size_t c = 0; c < nChannels; ++c)
+        {
+            if (prev_t[c] < 0)
+                continue;
+
+            PowerCurve &curve = header.channels[c] == NODE_CHANNEL ? timeline.node : timeline.gpu;
+            segment(curve, prev_t[c], prev_mean[c], prev_max[c], prev_t[c] + width, prev_mean[c], prev_max[c]);
+            curve.nChannels++;
+        }
+    }
+
+    return timeline;
+}
+
+#endif // JOBREPORT_POWER_TIMELINE_HPP
@@ -0,0 +1,315 @@
+/*
+    Self-profiling of the print pipeline (jobreport print --profile).
+
+    The stages of the pipeline open a scope with PROFILE_SCOPE("name"),
+    and count what they read with PROFILE_COUNT(ProfileFiles, 1),
+    PROFILE_COUNT(ProfileBytes, n) or PROFILE_COUNT(ProfileRows, n). A
+    scope records its wall and CPU time, its counters, the allocations
+    made while it was open and the peak RSS of the process when it
+    closed. Scopes nest: what a scope counts is also counted by the
+    scopes enclosing it, so every stage reports inclusive figures.
+
+    Without JOBREPORT_PROFILING the macros expand to nothing, and their
+    arguments are not evaluated. With it, the profiler only records once
+    profile_enable() was called, a scope costing a branch otherwise.
+    Allocations are counted by replacing the global operator new, only
+    in the executable built with JOBREPORT_PROFILING, never in the
+    libraries.
+
+    The events are written as a table of the stages, aggregated by name
+    in the order they first opened, or as Chrome trace events
+    (chrome://tracing, Perfetto) with the counters as arguments.
+*/
+
+#ifndef JOBREPORT_PROFILE_HPP
+#define JOBREPORT_PROFILE_HPP
+
+#ifdef JOBREPORT_PROFILING
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "third_party/tabulate/tabulate.hpp"
+
+enum ProfileCounter
+{
+    ProfileFiles = 0, // files opened
+    ProfileBytes = 1, // bytes read
+    ProfileRows = 2,  // rows parsed
+    N_PROFILE_COUNTERS = 3
+};
+
+struct ProfileEvent
+{
+    const char *name;
+    int depth;
+    int64_t start; // ns, since profile_enable()
+    int64_t wall;  // ns
+    int64_t cpu;   // ns, of the thread
+    uint64_t counters[N_PROFILE_COUNTERS] = {};
+    uint64_t allocations = 0;
+    uint64_t allocatedBytes = 0;
+    uint64_t peakRss = 0; // bytes
+};
+
+// Zero-initialized before any constructor runs, as operator new may be called first
+bool profile_enabled = false;
+std::atomic<uint64_t> profile_allocations{0};
+std::atomic<uint64_t> profile_allocated_bytes{0};
+
+void *operator new(std::size_t size)
+{
+    if (profile_enabled)
+    {
+        profile_allocations.fetch_add(1, std::memory_order_relaxed);
+        profile_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+    void *p = std::malloc(size > 0 ? size : 1);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+class ProfileScope;
+
+struct Profiler
+{
+    std::chrono::steady_clock::time_point origin;
+    std::vector<ProfileEvent> events; // in closing order
+    ProfileScope *current = nullptr;  // innermost open scope; the print pipeline runs on one thread
+    int depth = 0;
+};
+
+Profiler &profiler()
+{
+    static Profiler instance;
+    return instance;
+}
+
+class ProfileScope
+{
+public:
+    explicit ProfileScope(const char *name);
+    ~ProfileScope();
+
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+
+    void count(ProfileCounter counter, uint64_t n) { event.counters[counter] += n; }
+
+private:
+    bool active;
+    ProfileScope *parent = nullptr;
+    ProfileEvent event;
+    std::chrono::steady_clock::time_point start;
+    int64_t cpuStart = 0;
+    uint64_t allocationsStart = 0;
+    uint64_t allocatedBytesStart = 0;
+};
+
+int64_t profile_thread_cpu_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+ProfileScope::ProfileScope(const char *name) : active(profile_enabled)
+{
+    if (!active)
+        return;
+
+    Profiler &p = profiler();
+    parent = p.current;
+    p.current = this;
+    event.name = name;
+    event.depth = p.depth++;
+    allocationsStart = profile_allocations.load(std::memory_order_relaxed);
+    allocatedBytesStart = profile_allocated_bytes.load(std::memory_order_relaxed);
+    cpuStart = profile_thread_cpu_ns();
+    start = std::chrono::steady_clock::now();
+}
+
+ProfileScope::~ProfileScope()
+{
+    if (!active)
+        return;
+
+    auto end = std::chrono::steady_clock::now();
+    Profiler &p = profiler();
+    event.start = std::chrono::duration_cast<std::chrono::nanoseconds>(start - p.origin).count();
+    event.wall = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    event.cpu = profile_thread_cpu_ns() - cpuStart;
+    event.allocations = profile_allocations.load(std::memory_order_relaxed) - allocationsStart;
+    event.allocatedBytes = profile_allocated_bytes.load(std::memory_order_relaxed) - allocatedBytesStart;
+
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    event.peakRss = static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+
+    if (parent != nullptr)
+    {
+        for (int c = 0; c < N_PROFILE_COUNTERS; ++c)
+            parent->count(static_cast<ProfileCounter>(c), event.counters[c]);
+    }
+    p.current = parent;
+    p.depth--;
+    p.events.push_back(event);
+}
+
+void profile_enable()
+{
+    profiler().origin = std::chrono::steady_clock::now();
+    profile_enabled = true;
+}
+
+void profile_count(ProfileCounter counter, uint64_t n)
+{
+    if (profiler().current != nullptr)
+        profiler().current->count(counter, n);
+}
+
+// Stages aggregated by name, in the order they first opened
+void write_profile_table(std::ostream &os)
+{
+    struct Stage
+    {
+        ProfileEvent total;
+        uint64_t calls = 0;
+    };
+
+    std::vector<const ProfileEvent *> order;
+    for (const auto &event : profiler().events)
+        order.push_back(&event);
+    std::stable_sort(order.begin(), order.end(),
+                     [](const ProfileEvent *a, const ProfileEvent *b) { return a->start < b->start; });
+
+    std::vector<Stage> stages;
+    for (const ProfileEvent *event : order)
+    {
+        auto it = std::find_if(stages.begin(), stages.end(),
+                               [&](const Stage &s) { return std::strcmp(s.total.name, event->name) == 0; });
+        if (it == stages.end())
+        {
+            stages.push_back({*event, 1});
+            continue;
+        }
+        // A stage never opens inside itself, so its calls simply add up
+        it->calls++;
+        it->total.wall += event->wall;
+        it->total.cpu += event->cpu;
+        for (int c = 0; c < N_PROFILE_COUNTERS; ++c)
+            it->total.counters[c] += event->counters[c];
+        it->total.allocations += event->allocations;
+        it->total.allocatedBytes += event->allocatedBytes;
+        it->total.peakRss = std::max(it->total.peakRss, event->peakRss);
+    }
+
+    auto seconds = [](int64_t ns) {
+        char formatted[32];
+        snprintf(formatted, sizeof(formatted), "%.3f s", ns / 1e9);
+        return std::string(formatted);
+    };
+    auto count = [](uint64_t n) { return n > 0 ? std::to_string(n) : std::string("-"); };
+    auto mib = [](uint64_t bytes) {
+        char formatted[32];
+        snprintf(formatted, sizeof(formatted), "%.1f MiB", bytes / 1048576.);
+        return std::string(formatted);
+    };
+
+    tabulate::Table table;
+    table.add_row({"Stage", "Calls", "Wall Time", "CPU Time", "Files", "Bytes Read", "Rows", "Allocations", "Peak RSS"});
+    for (const auto &stage : stages)
+    {
+        const ProfileEvent &e = stage.total;
+        table.add_row(tabulate::Table::Row_t{
+            std::string(2 * e.depth, ' ') + e.name,
+            std::to_string(stage.calls),
+            seconds(e.wall),
+            seconds(e.cpu),
+            count(e.counters[ProfileFiles]),
+            e.counters[ProfileBytes] > 0 ? mib(e.counters[ProfileBytes]) : "-",
+            count(e.counters[ProfileRows]),
+            e.allocations > 0 ? std::to_string(e.allocations) + " (" + mib(e.allocatedBytes) + ")" : "-",
+            mib(e.peakRss)});
+    }
+
+    table.format()
+        .border_top("-")
+        .border_bottom("-")
+        .border_left("|")
+        .border_right("|")
+        .corner("+");
+
+    os << "Profile" << std::endl
+       << table << std::endl
+       << "* Figures of a stage include those of the stages nested in it" << std::endl;
+}
+
+// Chrome trace events, as complete ("X") events in microseconds
+void write_profile_trace(std::ostream &os)
+{
+    os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    for (const auto &e : profiler().events)
+    {
+        char buffer[512];
+        snprintf(buffer, sizeof(buffer),
+                 "%s{\"name\":\"%s\",\"cat\":\"print\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,"
+                 "\"args\":{\"cpu_us\":%.3f,\"files\":%llu,\"bytes\":%llu,\"rows\":%llu,"
+                 "\"allocations\":%llu,\"allocated_bytes\":%llu,\"peak_rss_bytes\":%llu}}",
+                 first ? "" : ",\n", e.name, e.start / 1e3, e.wall / 1e3, e.cpu / 1e3,
+                 static_cast<unsigned long long>(e.counters[ProfileFiles]),
+                 static_cast<unsigned long long>(e.counters[ProfileBytes]),
+                 static_cast<unsigned long long>(e.counters[ProfileRows]),
+                 static_cast<unsigned long long>(e.allocations),
+                 static_cast<unsigned long long>(e.allocatedBytes),
+                 static_cast<unsigned long long>(e.peakRss));
+        os << buffer;
+        first = false;
+    }
+    os << "]}" << std::endl;
+}
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define PROFILE_COUNT(counter, n)            \
+    do                                       \
+    {                                        \
+        if (profile_enabled)                 \
+            profile_count(counter, (n));     \
+    } while (0)
+
+#else
+
+#define PROFILE_SCOPE(name)
+#define PROFILE_COUNT(counter, n) \
+    do                            \
+    {                             \
+    } while (0)
+
+#endif // JOBREPORT_PROFILING
+
+#endif // JOBREPORT_PROFILE_HPP
@@ -0,0 +1,163 @@
+/*
+    Shared-memory layout of the region markers.
+
+    One node root creates one segment per job step and node, named from
+    the job and step ids (region_ring_name), and every rank exports the
+    name in REGION_RING_ENV to the workload. When every rank of a node is
+    a node root, the first one to create the segment is the collector of
+    the node and its pid is stored in the header: the others leave the
+    segment alone, and take it over only if that pid is gone. Each thread of the workload
+    that marks a region claims a lane of the segment on first use and is
+    its only writer: an event is stored in the next slot and published
+    by a release store of the head, with no lock and no read-modify-write
+    on the fast path. The collector is the only reader of every lane and
+    releases slots by advancing the tail. A full lane drops the event and
+    counts it rather than waiting for the collector. Lanes are not
+    reused, so at most REGION_RING_LANES threads of a node can mark
+    regions during a step.
+
+    A lane holds REGION_RING_EVENTS events and is drained every 20 ms,
+    about 400k events per second and thread. A region that wraps the
+    body of a loop would exceed that, so the producer holds back each
+    pop in the `held` field of its lane instead of storing it: a push of
+    the same name at the same depth within REGION_HOLD_GAP continues the
+    region and counts one more instance, without an event. Any other
+    call stores the held pop first, and the collector takes a pop held
+    for longer than REGION_HOLD_GAP with a compare-and-swap, so a pop is
+    recorded at most a drain period after REGION_HOLD_GAP. The pop event carries the
+    number of instances it closes.
+
+    Region names are interned once per name and thread into a shared
+    table, and events carry the index of the name.
+
+    Pushes and pops nest per lane. Begins and ends, which the node root
+    records for the markers of markers.hpp, are matched by name instead:
+    an end closes the last open begin of the same name.
+*/
+
+#ifndef JOBREPORT_REGION_RING_HPP
+#define JOBREPORT_REGION_RING_HPP
+
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <time.h>
+
+#define REGION_RING_MAGIC 0x4a524752u // "JRGR"
+#define REGION_RING_VERSION 3
+#define REGION_RING_ENV "JOBREPORT_REGIONS"
+#define REGION_RING_LANES 256 // threads marking regions on a node
+#define REGION_RING_EVENTS 8192 // per lane, a power of two
+#define REGION_MAX_NAMES 1024
+#define REGION_NAME_SIZE 48
+#define REGION_HOLD_GAP 1000000 // ns, a pop followed this soon by a push of the same name is not recorded
+
+enum RegionEventKind : uint16_t
+{
+    RegionPush = 0,
+    RegionPop = 1,
+    RegionBegin = 2,
+    RegionEnd = 3
+};
+
+// The depth lets the collector recover from dropped events: a push is
+// nested at `depth` regions, and a pop leaves `depth` regions open
+struct RegionEvent
+{
+    uint64_t timestamp; // ns, CLOCK_MONOTONIC
+    uint32_t name;      // index in RegionRing::names, instances closed for a pop
+    uint16_t kind;      // RegionEventKind
+    uint16_t depth;     // unused for a begin or an end
+};
+static_assert(sizeof(RegionEvent) == 16, "RegionEvent must be packed to 16 bytes");
+
+struct alignas(64) RegionLane
+{
+    std::atomic<uint64_t> head; // written by the producer
+    std::atomic<uint32_t> pid;  // of the producer, 0 while the lane is free
+    uint32_t reserved;
+    std::atomic<uint64_t> dropped; // events lost to a full lane, written by the producer
+    std::atomic<uint64_t> held;    // timestamp of the pop held back by the producer, 0 if none
+    std::atomic<uint32_t> heldDepth; // of the held pop, set before `held`
+    std::atomic<uint32_t> heldInstances;
+    alignas(64) std::atomic<uint64_t> tail; // written by the collector
+    alignas(64) RegionEvent events[REGION_RING_EVENTS];
+};
+
+struct RegionName
+{
+    std::atomic<uint32_t> ready; // the name is complete
+    char name[REGION_NAME_SIZE];
+};
+
+struct RegionRing
+{
+    std::atomic<uint32_t> magic; // stored last by the collector
+    uint32_t version;
+    std::atomic<uint32_t> owner;  // pid of the collector
+    std::atomic<uint32_t> nLanes; // claimed lanes
+    std::atomic<uint32_t> nNames; // claimed names
+    RegionName names[REGION_MAX_NAMES];
+    RegionLane lanes[REGION_RING_LANES];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Region rings need lock-free 64-bit atomics");
+
+inline uint64_t region_clock()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+// Index of `name` in the shared table, added if missing, UINT32_MAX if the table is full
+inline uint32_t region_ring_intern(RegionRing &ring, const char *name)
+{
+    uint32_t n = std::min<uint32_t>(ring.nNames.load(std::memory_order_acquire), REGION_MAX_NAMES);
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        if (ring.names[i].ready.load(std::memory_order_acquire)
+            && std::strncmp(ring.names[i].name, name, REGION_NAME_SIZE - 1) == 0)
+            return i;
+    }
+
+    // Two threads adding the same name at once both get an entry, which the collector merges
+    uint32_t index = ring.nNames.fetch_add(1, std::memory_order_relaxed);
+    if (index >= REGION_MAX_NAMES)
+        return UINT32_MAX;
+    std::strncpy(ring.names[index].name, name, REGION_NAME_SIZE - 1);
+    ring.names[index].name[REGION_NAME_SIZE - 1] = '\0';
+    ring.names[index].ready.store(1, std::memory_order_release);
+    return index;
+}
+
+// Appends an event to a lane, by its only writer. Returns -1 and counts the event if the lane is full.
+inline int region_ring_record(RegionLane &lane, RegionEventKind kind, uint32_t name, uint32_t depth,
+                              uint64_t timestamp = region_clock())
+{
+    uint64_t head = lane.head.load(std::memory_order_relaxed);
+    if (head - lane.tail.load(std::memory_order_acquire) >= REGION_RING_EVENTS)
+    {
+        // Single writer: no read-modify-write needed
+        lane.dropped.store(lane.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return -1;
+    }
+
+    RegionEvent &event = lane.events[head & (REGION_RING_EVENTS - 1)];
+    event.timestamp = timestamp;
+    event.name = name;
+    event.kind = kind;
+    event.depth = static_cast<uint16_t>(std::min<uint32_t>(depth, UINT16_MAX));
+    lane.head.store(head + 1, std::memory_order_release);
+    return 0;
+}
+
+// Name of the shared memory segment of a job step on this node
+inline std::string region_ring_name(const std::string &job, const std::string &step)
+{
+    return "/jobreport." + job + "." + step;
+}
+
+#endif // JOBREPORT_REGION_RING_HPP
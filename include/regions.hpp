@@ -0,0 +1,542 @@
+/*
+    Region markers: collection by the node root and per-region report.
+
+    The node root creates the shared segment of region_ring.hpp before
+    the workload starts, or leaves it to the one that did when every rank
+    is a node root, and drains it every REGION_DRAIN_PERIOD. Events
+    are replayed on a stack per lane into closed region instances, which
+    are kept per name as a sorted union of wall-clock intervals: repeated
+    instances closer than REGION_MERGE_GAP, as when a region wraps the
+    body of a loop, collapse into one interval, so memory grows with the
+    number of distinct phases rather than the number of calls. Regions
+    still open when the step ends are closed then, and the intervals
+    are written next to the time series file (step_<n>/proc_<id>.regions,
+    or node_<host>.regions with --consolidate):
+
+        jobreport-regions 1
+        dropped <events>
+        region <instances> <name>
+        interval <region index> <begin us> <end us>
+
+    `print` attributes each time series sample of a node to the regions
+    of that node it overlaps, in proportion to the overlap, which gives
+    the utilization, power and energy of every region. Regions are
+    inclusive: the samples of a nested region also count for its parents.
+*/
+
+#ifndef JOBREPORT_REGIONS_HPP
+#define JOBREPORT_REGIONS_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <filesystem>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <cerrno>
+#include <unistd.h>
+
+#include "macros.hpp"
+#include "region_ring.hpp"
+#include "timeseries.hpp"
+
+#define REGION_FILE_EXTENSION ".regions"
+#define REGION_FILE_MAGIC "jobreport-regions 1"
+#define REGION_DRAIN_PERIOD 20000 // us
+#define REGION_MERGE_GAP 1000     // us
+
+// Wall-clock intervals during which a region was open on a node, sorted and disjoint
+struct RegionIntervals
+{
+    uint64_t instances = 0;
+    std::vector<std::pair<int64_t, int64_t>> intervals; // us
+    size_t compacted = 0; // size after the last compaction
+
+    void add(int64_t begin, int64_t end, uint64_t n = 1)
+    {
+        instances += n;
+        if (!intervals.empty() && begin >= intervals.back().first && begin <= intervals.back().second + REGION_MERGE_GAP)
+        {
+            intervals.back().second = std::max(intervals.back().second, end);
+            return;
+        }
+        intervals.emplace_back(begin, end);
+        if (intervals.size() > 2 * compacted + 64)
+            compact();
+    }
+
+    // Sorts and merges the intervals, which arrive out of order from different lanes
+    void compact()
+    {
+        std::sort(intervals.begin(), intervals.end());
+        size_t n = 0;
+        for (size_t i = 0; i < intervals.size(); ++i)
+        {
+            if (n > 0 && intervals[i].first <= intervals[n - 1].second + REGION_MERGE_GAP)
+                intervals[n - 1].second = std::max(intervals[n - 1].second, intervals[i].second);
+            else
+                intervals[n++] = intervals[i];
+        }
+        intervals.resize(n);
+        compacted = n;
+    }
+
+    int64_t duration() const
+    {
+        int64_t total = 0;
+        for (const auto &[begin, end] : intervals)
+            total += end - begin;
+        return total;
+    }
+};
+
+class RegionCollector
+{
+public:
+    ~RegionCollector() { stop(); }
+
+    // True if the node is collected, by this collector or by the one of another node root
+    bool start(const std::string &name);
+    bool collecting() const { return ring != nullptr; }
+    // Drains the last events, writes the regions to `file` and removes the segment, if it collected the node
+    void stop(const std::filesystem::path &file = {});
+
+    // Lane and names for events recorded by the node root itself, nullptr or UINT32_MAX if none is left
+    RegionLane *claim_lane();
+    uint32_t intern(const char *name);
+
+private:
+    std::string name;
+    RegionRing *ring = nullptr;
+    std::vector<std::vector<std::pair<uint32_t, int64_t>>> stacks; // open regions of each lane
+    std::vector<std::map<uint32_t, std::vector<int64_t>>> begins;  // open begins of each lane, per name
+    std::vector<std::string> names;                                // copied from the segment
+    std::map<std::string, RegionIntervals> regions;
+    uint64_t dropped = 0;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool running = false;
+
+    void loop();
+    void drain(bool close = false);
+    const std::string &region_name(uint32_t index);
+};
+
+// Pid of the collector of the segment `name`, 0 if there is none yet
+uint32_t region_ring_owner(const std::string &name)
+{
+    int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0)
+        return 0;
+    struct stat st;
+    uint32_t owner = 0;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(RegionRing))
+    {
+        void *p = mmap(nullptr, sizeof(RegionRing), PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED)
+        {
+            const RegionRing *r = static_cast<const RegionRing *>(p);
+            if (r->magic.load(std::memory_order_acquire) == REGION_RING_MAGIC)
+                owner = r->owner.load(std::memory_order_relaxed);
+            munmap(p, sizeof(RegionRing));
+        }
+    }
+    close(fd);
+    return owner;
+}
+
+bool RegionCollector::start(const std::string &name)
+{
+    this->name = name;
+
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0 && errno == EEXIST)
+    {
+        // Another node root collects the node, unless it was killed without removing the segment
+        uint32_t owner = region_ring_owner(name);
+        if (owner == 0 || kill(static_cast<pid_t>(owner), 0) == 0 || errno != ESRCH)
+            return true;
+
+        // Only one of the node roots that found it stale takes it over
+        int stale = shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0);
+        if (stale < 0)
+            return false;
+        void *p = mmap(nullptr, sizeof(RegionRing), PROT_READ | PROT_WRITE, MAP_SHARED, stale, 0);
+        close(stale);
+        if (p == MAP_FAILED)
+            return false;
+        bool taken = static_cast<RegionRing *>(p)->owner.compare_exchange_strong(owner, getpid());
+        munmap(p, sizeof(RegionRing));
+        if (!taken)
+            return true;
+        shm_unlink(name.c_str());
+        fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    }
+    if (fd < 0)
+        return false;
+    if (ftruncate(fd, sizeof(RegionRing)) != 0)
+    {
+        close(fd);
+        shm_unlink(name.c_str());
+        return false;
+    }
+    void *p = mmap(nullptr, sizeof(RegionRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+    {
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    // The segment is zero-filled: only the header needs to be set, the magic last
+    ring = static_cast<RegionRing *>(p);
+    ring->version = REGION_RING_VERSION;
+    ring->owner.store(getpid(), std::memory_order_relaxed);
+    ring->magic.store(REGION_RING_MAGIC, std::memory_order_release);
+
+    stacks.resize(REGION_RING_LANES);
+    begins.resize(REGION_RING_LANES);
+    running = true;
+    thread = std::thread(&RegionCollector::loop, this);
+    return true;
+}
+
+void RegionCollector::stop(const std::filesystem::path &file)
+{
+    if (ring == nullptr)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    cv.notify_all();
+    thread.join();
+    drain(true);
+
+    munmap(ring, sizeof(RegionRing));
+    shm_unlink(name.c_str());
+    ring = nullptr;
+
+    if (file.empty() || (regions.empty() && dropped == 0))
+        return;
+
+    std::ofstream ofs(file);
+    ofs << REGION_FILE_MAGIC << '\n'
+        << "dropped " << dropped << '\n';
+    size_t index = 0;
+    for (auto &[region, r] : regions)
+    {
+        ofs << "region " << r.instances << ' ' << region << '\n';
+    }
+    for (auto &[region, r] : regions)
+    {
+        r.compact();
+        for (const auto &[begin, end] : r.intervals)
+            ofs << "interval " << index << ' ' << begin << ' ' << end << '\n';
+        index++;
+    }
+    if (!ofs)
+    {
+        std::cerr << "WARNING: Could not write the regions to " << file << std::endl;
+    }
+}
+
+RegionLane *RegionCollector::claim_lane()
+{
+    if (ring == nullptr)
+        return nullptr;
+    uint32_t index = ring->nLanes.fetch_add(1, std::memory_order_relaxed);
+    if (index >= REGION_RING_LANES)
+        return nullptr;
+    ring->lanes[index].pid.store(getpid(), std::memory_order_release);
+    return &ring->lanes[index];
+}
+
+uint32_t RegionCollector::intern(const char *name)
+{
+    return ring == nullptr ? UINT32_MAX : region_ring_intern(*ring, name);
+}
+
+void RegionCollector::loop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (running)
+    {
+        cv.wait_for(lock, std::chrono::microseconds(REGION_DRAIN_PERIOD));
+        if (!running)
+            break;
+        lock.unlock();
+        drain();
+        lock.lock();
+    }
+}
+
+const std::string &RegionCollector::region_name(uint32_t index)
+{
+    static const std::string unknown = "unknown";
+    while (names.size() <= index && names.size() < REGION_MAX_NAMES)
+    {
+        const RegionName &n = ring->names[names.size()];
+        if (!n.ready.load(std::memory_order_acquire))
+            return unknown;
+        std::string s(n.name, strnlen(n.name, REGION_NAME_SIZE));
+        // Names are written on whitespace-separated lines
+        std::replace_if(s.begin(), s.end(), [](char c) { return std::isspace(static_cast<unsigned char>(c)); }, '_');
+        names.push_back(s.empty() ? "_" : s);
+    }
+    return index < names.size() ? names[index] : unknown;
+}
+
+// With `close`, the regions still open at the end of the step are closed now
+void RegionCollector::drain(bool close)
+{
+    // Monotonic timestamps of the events to wall-clock time, as the time series
+    int64_t offset = std::chrono::duration_cast<std::chrono::microseconds>(
+                         std::chrono::system_clock::now().time_since_epoch()).count()
+                   - static_cast<int64_t>(region_clock() / 1000);
+
+    uint32_t nLanes = std::min<uint32_t>(ring->nLanes.load(std::memory_order_acquire), REGION_RING_LANES);
+    uint64_t nDropped = 0;
+    for (uint32_t l = 0; l < nLanes; ++l)
+    {
+        RegionLane &lane = ring->lanes[l];
+        auto &stack = stacks[l];
+
+        // Closes the regions above `depth`, the innermost one of them by a pop of `instances`
+        auto pop = [&](size_t depth, uint64_t instances, int64_t t) {
+            depth = std::min(depth, stack.size());
+            while (stack.size() > depth)
+            {
+                // Deeper ones were left open by dropped pops
+                bool popped = stack.size() == depth + 1;
+                regions[region_name(stack.back().first)].add(stack.back().second, t, popped ? std::max<uint64_t>(instances, 1) : 1);
+                stack.pop_back();
+            }
+        };
+
+        // Loaded before the head: the events preceding a held pop are then all visible
+        uint64_t held = lane.held.load(std::memory_order_acquire);
+        uint64_t tail = lane.tail.load(std::memory_order_relaxed);
+        uint64_t head = lane.head.load(std::memory_order_acquire);
+        for (; tail < head; ++tail)
+        {
+            const RegionEvent &event = lane.events[tail & (REGION_RING_EVENTS - 1)];
+            int64_t t = static_cast<int64_t>(event.timestamp / 1000) + offset;
+
+            if (event.kind == RegionBegin)
+            {
+                begins[l][event.name].push_back(t);
+                continue;
+            }
+            if (event.kind == RegionEnd)
+            {
+                auto it = begins[l].find(event.name);
+                if (it != begins[l].end() && !it->second.empty())
+                {
+                    regions[region_name(event.name)].add(it->second.back(), t);
+                    it->second.pop_back();
+                }
+                continue;
+            }
+
+            if (event.kind == RegionPush)
+            {
+                pop(event.depth, 1, t);
+                stack.emplace_back(event.name, t);
+            }
+            else
+            {
+                pop(event.depth, event.name, t);
+            }
+        }
+        lane.tail.store(tail, std::memory_order_release);
+
+        // A pop held back for long is taken from the producer, unless it resumed the region meanwhile
+        if (held != 0 && (close || region_clock() - held >= REGION_HOLD_GAP))
+        {
+            uint32_t depth = lane.heldDepth.load(std::memory_order_relaxed);
+            uint32_t instances = lane.heldInstances.load(std::memory_order_relaxed);
+            if (lane.held.compare_exchange_strong(held, 0, std::memory_order_acquire))
+                pop(depth, instances, static_cast<int64_t>(held / 1000) + offset);
+        }
+
+        if (close)
+        {
+            int64_t now = static_cast<int64_t>(region_clock() / 1000) + offset;
+            for (; !stack.empty(); stack.pop_back())
+                regions[region_name(stack.back().first)].add(stack.back().second, now);
+            for (const auto &[index, open] : begins[l])
+            {
+                for (int64_t begin : open)
+                    regions[region_name(index)].add(begin, now);
+            }
+            begins[l].clear();
+        }
+        nDropped += lane.dropped.load(std::memory_order_relaxed);
+    }
+    dropped = nDropped;
+}
+
+// Per-region statistics of a step
+struct RegionStats
+{
+    uint64_t instances = 0;
+    double time = 0;        // s, summed over nodes
+    size_t nNodes = 0;
+    double gpuSeconds = 0;  // of power samples within the region
+    double energy = 0;      // J
+    double sm = 0;          // overlap-weighted sums
+    double smWeight = 0;
+    double mem = 0;
+    double memWeight = 0;
+};
+
+struct RegionReport
+{
+    std::map<std::string, RegionStats> regions;
+    uint64_t dropped = 0;
+
+    bool empty() const { return regions.empty(); }
+};
+
+// Regions of one node, as written by the collector
+struct NodeRegions
+{
+    uint64_t dropped = 0;
+    std::vector<std::string> names;
+    std::vector<RegionIntervals> intervals;
+};
+
+bool read_regions(const std::filesystem::path &file, NodeRegions &node)
+{
+    std::ifstream ifs(file);
+    std::string line;
+    if (!std::getline(ifs, line) || line != REGION_FILE_MAGIC)
+        return false;
+
+    while (std::getline(ifs, line))
+    {
+        std::istringstream iss(line);
+        std::string kind;
+        iss >> kind;
+        if (kind == "dropped")
+        {
+            iss >> node.dropped;
+        }
+        else if (kind == "region")
+        {
+            RegionIntervals r;
+            std::string name;
+            iss >> r.instances >> name;
+            node.names.push_back(name);
+            node.intervals.push_back(r);
+        }
+        else if (kind == "interval")
+        {
+            size_t index;
+            int64_t begin, end;
+            if (iss >> index >> begin >> end && index < node.intervals.size() && end >= begin)
+                node.intervals[index].intervals.emplace_back(begin, end);
+        }
+    }
+    for (auto &r : node.intervals)
+        r.compact();
+    return true;
+}
+
+// Attributes the samples of every time series file to the regions recorded next to it
+RegionReport compute_regions(const std::filesystem::path &dir, long long resolution)
+{
+    PROFILE_SCOPE("compute_regions");
+    RegionReport report;
+
+    std::vector<TimeSeriesBucket> buckets;
+    for (const auto &file : list_timeseries(dir))
+    {
+        NodeRegions node;
+        if (!read_regions(std::filesystem::path(file).replace_extension(REGION_FILE_EXTENSION), node))
+            continue;
+        report.dropped += node.dropped;
+
+        TimeSeriesReader reader;
+        if (!reader.open(file))
+            continue;
+        size_t level = reader.select_level(resolution);
+        reader.seek_level(level);
+        long long width = std::max<long long>(reader.level_width(level), 1);
+        size_t nChannels = reader.header.channels.size();
+
+        std::vector<RegionStats *> stats;
+        for (size_t r = 0; r < node.names.size(); ++r)
+        {
+            RegionStats &s = report.regions[node.names[r]];
+            s.instances += node.intervals[r].instances;
+            s.time += node.intervals[r].duration() / 1e6;
+            s.nNodes++;
+            stats.push_back(&s);
+        }
+
+        // Samples of a channel are in time order: one cursor per region, channel and field
+        std::vector<size_t> cursors(node.names.size() * nChannels * TIMESERIES_FIELDS, 0);
+        while (reader.next(buckets))
+        {
+            for (const auto &b : buckets)
+            {
+                if (b.channel >= nChannels || b.field >= TIMESERIES_FIELDS
+                    || reader.header.channels[b.channel] == NODE_CHANNEL)
+                    continue;
+
+                int64_t begin = b.start;
+                int64_t end = b.start + width;
+                for (size_t r = 0; r < node.names.size(); ++r)
+                {
+                    const auto &intervals = node.intervals[r].intervals;
+                    size_t &cursor = cursors[(r * nChannels + b.channel) * TIMESERIES_FIELDS + b.field];
+                    while (cursor < intervals.size() && intervals[cursor].second <= begin)
+                        cursor++;
+
+                    double overlap = 0;
+                    for (size_t i = cursor; i < intervals.size() && intervals[i].first < end; ++i)
+                        overlap += std::min(end, intervals[i].second) - std::max(begin, intervals[i].first);
+                    if (overlap <= 0)
+                        continue;
+                    overlap /= 1e6;
+
+                    RegionStats &s = *stats[r];
+                    switch (static_cast<TimeSeriesField>(b.field))
+                    {
+                    case TimeSeriesField::Power:
+                        s.energy += b.mean * overlap;
+                        s.gpuSeconds += overlap;
+                        break;
+                    case TimeSeriesField::SmUtilization:
+                        s.sm += b.mean * overlap;
+                        s.smWeight += overlap;
+                        break;
+                    case TimeSeriesField::MemoryUtilization:
+                        s.mem += b.mean * overlap;
+                        s.memWeight += overlap;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    return report;
+}
+
+#endif // JOBREPORT_REGIONS_HPP
@@ -0,0 +1,328 @@
+/*
+    Background sampler run by the node root while the workload executes.
+
+    It periodically fetches the power and utilization samples DCGM
+    recorded since the previous tick, reads the node power where the
+    platform exposes it, and appends everything to the step's time
+    series file. Running statistics of every channel are published
+    after each tick, for the control socket to answer status queries
+    without touching DCGM.
+*/
+
+#ifndef JOBREPORT_SAMPLER_HPP
+#define JOBREPORT_SAMPLER_HPP
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cmath>
+
+#include "timeseries.hpp"
+#include "utils.hpp"
+#ifdef JOBREPORT_WITH_DCGM
+#include "dcgm_loader.hpp"
+#endif
+
+// Node power counter of HPE Cray EX blades, "<value> W <timestamp> us"
+#define NODE_POWER_FILE "/sys/cray/pm_counters/power"
+
+// Running statistics of a channel since the start of the step
+struct ChannelStats
+{
+    uint32_t channel = 0; // GPU id, or NODE_CHANNEL
+    float latest[TIMESERIES_FIELDS] = {NAN, NAN, NAN};
+    double sum[TIMESERIES_FIELDS] = {0, 0, 0};
+    uint64_t count[TIMESERIES_FIELDS] = {0, 0, 0};
+    int64_t lastTimestamp = 0; // us
+    double energy = 0;         // J, integrated power
+
+    double mean(size_t field) const { return count[field] > 0 ? sum[field] / count[field] : NAN; }
+};
+
+#ifdef JOBREPORT_WITH_DCGM
+
+class Sampler
+{
+public:
+    Sampler(dcgmHandle_t handle, dcgmGpuGrp_t group, const std::vector<unsigned int> &gpus, long long sampling_time)
+        : handle(handle), group(group), gpus(gpus), sampling_time(sampling_time) {}
+
+    ~Sampler() { stop(); }
+
+    bool start(const std::filesystem::path &path, const std::string &name);
+    void stop();
+
+    // Energy in Joules obtained by integrating the sampled power of each GPU
+    std::map<unsigned int, double> integrated_energy() const;
+
+    // Statistics of every channel as of the last tick, safe to call from any thread
+    std::vector<ChannelStats> snapshot() const;
+    void snapshot(std::vector<ChannelStats> &out) const; // reuses the storage of `out`
+
+    int64_t start_time() const { return header.startTime; }
+
+private:
+    dcgmHandle_t handle;
+    dcgmGpuGrp_t group;
+    dcgmFieldGrp_t field_group = (dcgmFieldGrp_t)NULL;
+    std::vector<unsigned int> gpus;
+    long long sampling_time; // in microseconds
+
+    TimeSeriesHeader header;
+    TimeSeriesWriter writer;
+    std::vector<TimeSeriesSample> buffer;
+    long long since = 0;
+    bool node_power = false;
+
+    // Trapezoidal integration of the power of each channel
+    std::vector<double> energy;
+    std::vector<int64_t> last_time;
+    std::vector<float> last_power;
+
+    // Updated by the sampling thread, copied to `published` after each tick
+    std::vector<ChannelStats> stats;
+    std::vector<ChannelStats> published;
+    mutable std::mutex published_mutex;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool running = false;
+
+    void loop();
+    void tick();
+    void push(uint16_t channel, TimeSeriesField field, int64_t timestamp, double value);
+    static int collect(unsigned int gpuId, dcgmFieldValue_v1 *values, int numValues, void *userData);
+};
+
+bool Sampler::start(const std::filesystem::path &path, const std::string &name)
+{
+    unsigned short fields[] = {
+        DCGM_FI_DEV_POWER_USAGE,
+        DCGM_FI_DEV_GPU_UTIL,
+        DCGM_FI_DEV_MEM_COPY_UTIL};
+
+    if (gpus.empty()
+        || dcgm().FieldGroupCreate(handle, 3, fields, name.c_str(), &field_group) != DCGM_ST_OK)
+    {
+        field_group = (dcgmFieldGrp_t)NULL;
+        return false;
+    }
+
+    // Keep enough history in the host engine to survive a few missed ticks
+    double keep_age = std::max(60.0, 10.0 * sampling_time / 1e6);
+    if (dcgm().WatchFields(handle, group, field_group, sampling_time, keep_age, 0) != DCGM_ST_OK)
+    {
+        return false;
+    }
+
+    header.startTime = std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::system_clock::now().time_since_epoch()).count();
+    header.samplingTime = sampling_time;
+    header.host = get_hostname();
+    header.channels.assign(gpus.begin(), gpus.end());
+
+    node_power = std::ifstream(NODE_POWER_FILE).good();
+    if (node_power)
+    {
+        header.channels.push_back(NODE_CHANNEL);
+    }
+
+    energy.assign(header.channels.size(), 0.0);
+    last_time.assign(header.channels.size(), -1);
+    last_power.assign(header.channels.size(), 0.0f);
+
+    stats.assign(header.channels.size(), ChannelStats());
+    for (size_t c = 0; c < stats.size(); ++c)
+    {
+        stats[c].channel = header.channels[c];
+    }
+    published = stats;
+
+    if (!writer.open(path, header))
+    {
+        return false;
+    }
+
+    since = header.startTime;
+    running = true;
+    thread = std::thread(&Sampler::loop, this);
+    return true;
+}
+
+void Sampler::stop()
+{
+    bool was_running;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        was_running = running;
+        running = false;
+    }
+
+    if (was_running)
+    {
+        cv.notify_all();
+        thread.join();
+
+        // Fetch whatever was recorded since the last tick
+        dcgm().UpdateAllFields(handle, 1);
+        tick();
+        writer.close();
+    }
+
+    if (field_group != (dcgmFieldGrp_t)NULL)
+    {
+        dcgm().UnwatchFields(handle, group, field_group);
+        dcgm().FieldGroupDestroy(handle, field_group);
+        field_group = (dcgmFieldGrp_t)NULL;
+    }
+}
+
+void Sampler::loop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (running)
+    {
+        cv.wait_for(lock, std::chrono::microseconds(sampling_time));
+        if (!running)
+            break;
+        lock.unlock();
+        tick();
+        lock.lock();
+    }
+}
+
+void Sampler::tick()
+{
+    buffer.clear();
+
+    long long next = since;
+    if (dcgm().GetValuesSince(handle, group, field_group, since, &next, &Sampler::collect, this) == DCGM_ST_OK)
+    {
+        since = next;
+    }
+
+    if (node_power)
+    {
+        std::ifstream ifs(NODE_POWER_FILE);
+        double watts;
+        if (ifs >> watts)
+        {
+            int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+                              std::chrono::system_clock::now().time_since_epoch()).count();
+            push(header.channels.size() - 1, TimeSeriesField::Power, now, watts);
+        }
+    }
+
+    if (!buffer.empty())
+    {
+        writer.append(buffer);
+
+        std::lock_guard<std::mutex> lock(published_mutex);
+        published = stats;
+    }
+}
+
+void Sampler::push(uint16_t channel, TimeSeriesField field, int64_t timestamp, double value)
+{
+    buffer.push_back(TimeSeriesSample{timestamp, channel, static_cast<uint16_t>(field), static_cast<float>(value)});
+
+    if (field == TimeSeriesField::Power)
+    {
+        if (last_time[channel] >= 0 && timestamp > last_time[channel])
+        {
+            energy[channel] += 0.5 * (last_power[channel] + value) * (timestamp - last_time[channel]) / 1e6;
+        }
+        last_time[channel] = timestamp;
+        last_power[channel] = value;
+        stats[channel].energy = energy[channel];
+    }
+
+    ChannelStats &s = stats[channel];
+    s.latest[static_cast<size_t>(field)] = value;
+    s.sum[static_cast<size_t>(field)] += value;
+    s.count[static_cast<size_t>(field)]++;
+    s.lastTimestamp = std::max<int64_t>(s.lastTimestamp, timestamp);
+}
+
+int Sampler::collect(unsigned int gpuId, dcgmFieldValue_v1 *values, int numValues, void *userData)
+{
+    Sampler *self = static_cast<Sampler *>(userData);
+
+    auto it = std::find(self->gpus.begin(), self->gpus.end(), gpuId);
+    if (it == self->gpus.end())
+    {
+        return 0;
+    }
+    uint16_t channel = it - self->gpus.begin();
+
+    for (int i = 0; i < numValues; ++i)
+    {
+        const dcgmFieldValue_v1 &v = values[i];
+        if (v.status != DCGM_ST_OK)
+            continue;
+
+        double value;
+        if (v.fieldType == DCGM_FT_DOUBLE)
+        {
+            if (DCGM_FP64_IS_BLANK(v.value.dbl))
+                continue;
+            value = v.value.dbl;
+        }
+        else
+        {
+            if (DCGM_INT64_IS_BLANK(v.value.i64))
+                continue;
+            value = static_cast<double>(v.value.i64);
+        }
+
+        switch (v.fieldId)
+        {
+        case DCGM_FI_DEV_POWER_USAGE:
+            self->push(channel, TimeSeriesField::Power, v.ts, value);
+            break;
+        case DCGM_FI_DEV_GPU_UTIL:
+            self->push(channel, TimeSeriesField::SmUtilization, v.ts, value);
+            break;
+        case DCGM_FI_DEV_MEM_COPY_UTIL:
+            self->push(channel, TimeSeriesField::MemoryUtilization, v.ts, value);
+            break;
+        }
+    }
+    return 0;
+}
+
+std::map<unsigned int, double> Sampler::integrated_energy() const
+{
+    std::map<unsigned int, double> result;
+    for (size_t c = 0; c < gpus.size() && c < last_time.size(); ++c)
+    {
+        if (last_time[c] >= 0)
+        {
+            result[gpus[c]] = energy[c];
+        }
+    }
+    return result;
+}
+
+std::vector<ChannelStats> Sampler::snapshot() const
+{
+    std::vector<ChannelStats> out;
+    snapshot(out);
+    return out;
+}
+
+void Sampler::snapshot(std::vector<ChannelStats> &out) const
+{
+    std::lock_guard<std::mutex> lock(published_mutex);
+    out.assign(published.begin(), published.end());
+}
+
+#endif // JOBREPORT_WITH_DCGM
+
+#endif // JOBREPORT_SAMPLER_HPP
@@ -0,0 +1,233 @@
+/*
+    Row selection for the per-GPU table: filters, ordering and top-N.
+
+    Each filter is evaluated over a whole column at once into a byte
+    mask, with one tight loop per comparison operator, and the surviving
+    rows are compacted into a selection vector of row indices. Ordering
+    only moves these indices: with a top-N, std::partial_sort places the
+    first N rows without sorting the rest.
+*/
+
+#ifndef JOBREPORT_SELECTION_HPP
+#define JOBREPORT_SELECTION_HPP
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <numeric>
+
+#include "dataframe.hpp"
+
+enum class CompareOp
+{
+    Less,
+    LessEqual,
+    Greater,
+    GreaterEqual,
+    Equal,
+    NotEqual
+};
+
+struct RowFilter
+{
+    std::string column;
+    CompareOp op = CompareOp::Equal;
+    std::string text; // value as given
+    double value = 0; // value of numeric columns
+};
+
+struct RowSelection
+{
+    std::vector<RowFilter> where;
+    std::string sortBy; // empty to keep the order of the DataFrame
+    bool descending = false;
+    size_t top = 0; // 0 for all rows
+
+    bool empty() const { return where.empty() && sortBy.empty() && top == 0; }
+};
+
+// Calls f with the column named `name`, returns false if there is no such column.
+// Short names are accepted for the most used columns.
+template <typename F>
+bool visit_column(const DataFrame &df, const std::string &name, F &&f)
+{
+    if (name == "host") f(df.host);
+    else if (name == "user") f(df.user);
+    else if (name == "account") f(df.account);
+    else if (name == "gpu" || name == "gpuId") f(df.gpuId);
+    else if (name == "sm" || name == "smUtilizationAvg") f(df.smUtilizationAvg);
+    else if (name == "smUtilizationMin") f(df.smUtilizationMin);
+    else if (name == "smUtilizationMax") f(df.smUtilizationMax);
+    else if (name == "membw" || name == "memoryUtilizationAvg") f(df.memoryUtilizationAvg);
+    else if (name == "memoryUtilizationMin") f(df.memoryUtilizationMin);
+    else if (name == "memoryUtilizationMax") f(df.memoryUtilizationMax);
+    else if (name == "power" || name == "powerUsageAvg") f(df.powerUsageAvg);
+    else if (name == "powerUsageMin") f(df.powerUsageMin);
+    else if (name == "powerUsageMax") f(df.powerUsageMax);
+    else if (name == "memory" || name == "maxAllocatedMemory") f(df.maxAllocatedMemory);
+    else if (name == "energy" || name == "energyConsumed") f(df.energyConsumed);
+    else if (name == "startTime") f(df.startTime);
+    else if (name == "endTime") f(df.endTime);
+    else if (name == "elapsed")
+    {
+        // In seconds, as shown in the table
+        DFColumn<double> elapsed(df.gpuId.size());
+        for (size_t i = 0; i < elapsed.size(); ++i)
+            elapsed[i] = (df.endTime[i] - df.startTime[i]) / 1e6;
+        f(elapsed);
+    }
+    else return false;
+    return true;
+}
+
+bool is_string_column(const std::string &name)
+{
+    return name == "host" || name == "user" || name == "account";
+}
+
+// Parses a number with an optional binary suffix (K, M, G, T), as in memory>40G
+bool parse_value(const std::string &text, double &value)
+{
+    char *end = nullptr;
+    value = std::strtod(text.c_str(), &end);
+    if (end == text.c_str())
+        return false;
+
+    std::string suffix(end);
+    if (suffix == "K" || suffix == "KiB") value *= 1024.;
+    else if (suffix == "M" || suffix == "MiB") value *= 1024. * 1024.;
+    else if (suffix == "G" || suffix == "GiB") value *= 1024. * 1024. * 1024.;
+    else if (suffix == "T" || suffix == "TiB") value *= 1024. * 1024. * 1024. * 1024.;
+    else if (!suffix.empty()) return false;
+    return true;
+}
+
+// Splits <column><op><value>, op being one of < <= > >= == = !=
+bool parse_comparison(const std::string &expr, RowFilter &filter)
+{
+    size_t pos = expr.find_first_of("<>=!");
+    if (pos == std::string::npos || pos == 0)
+        return false;
+
+    static const std::pair<const char *, CompareOp> ops[] = {
+        {"<=", CompareOp::LessEqual}, {">=", CompareOp::GreaterEqual},
+        {"==", CompareOp::Equal},     {"!=", CompareOp::NotEqual},
+        {"<", CompareOp::Less},       {">", CompareOp::Greater},
+        {"=", CompareOp::Equal}};
+
+    size_t len = 0;
+    for (const auto &op : ops)
+    {
+        if (expr.compare(pos, std::char_traits<char>::length(op.first), op.first) == 0)
+        {
+            filter.op = op.second;
+            len = std::char_traits<char>::length(op.first);
+            break;
+        }
+    }
+    if (len == 0)
+        return false;
+
+    filter.column = expr.substr(0, pos);
+    filter.text = expr.substr(pos + len);
+    return !filter.text.empty();
+}
+
+// Parses a filter on a column of the DataFrame
+bool parse_filter(const std::string &expr, RowFilter &filter)
+{
+    if (!parse_comparison(expr, filter) || !visit_column(DataFrame(), filter.column, [](const auto &) {}))
+        return false;
+
+    if (is_string_column(filter.column))
+        return filter.op == CompareOp::Equal || filter.op == CompareOp::NotEqual;
+    return parse_value(filter.text, filter.value);
+}
+
+// Clears the mask of the n rows of `c` that do not satisfy `op value`
+template <typename T, typename V>
+void apply_filter(const T *c, size_t n, CompareOp op, const V &value, uint8_t *m)
+{
+    switch (op)
+    {
+    case CompareOp::Less:
+        for (size_t i = 0; i < n; ++i) m[i] &= c[i] < value;
+        break;
+    case CompareOp::LessEqual:
+        for (size_t i = 0; i < n; ++i) m[i] &= c[i] <= value;
+        break;
+    case CompareOp::Greater:
+        for (size_t i = 0; i < n; ++i) m[i] &= c[i] > value;
+        break;
+    case CompareOp::GreaterEqual:
+        for (size_t i = 0; i < n; ++i) m[i] &= c[i] >= value;
+        break;
+    case CompareOp::Equal:
+        for (size_t i = 0; i < n; ++i) m[i] &= c[i] == value;
+        break;
+    case CompareOp::NotEqual:
+        for (size_t i = 0; i < n; ++i) m[i] &= c[i] != value;
+        break;
+    }
+}
+
+template <typename T, typename V>
+void apply_filter(const std::vector<T> &column, CompareOp op, const V &value, std::vector<uint8_t> &mask)
+{
+    apply_filter(column.data(), column.size(), op, value, mask.data());
+}
+
+// Indices of the selected rows, in display order
+std::vector<size_t> select_rows(const DataFrame &df, const RowSelection &selection)
+{
+    size_t n = df.gpuId.size();
+
+    std::vector<uint8_t> mask(n, 1);
+    for (const auto &filter : selection.where)
+    {
+        visit_column(df, filter.column, [&](const auto &column) {
+            using T = typename std::decay_t<decltype(column)>::value_type;
+            if constexpr (std::is_same_v<T, std::string>)
+                apply_filter(column, filter.op, filter.text, mask);
+            else
+                apply_filter(column, filter.op, filter.value, mask);
+        });
+    }
+
+    std::vector<size_t> rows;
+    rows.reserve(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (mask[i])
+            rows.push_back(i);
+    }
+
+    size_t top = selection.top > 0 ? std::min(selection.top, rows.size()) : rows.size();
+    if (!selection.sortBy.empty())
+    {
+        visit_column(df, selection.sortBy, [&](const auto &column) {
+            // NaN values go last in both directions, ties keep the order of the DataFrame
+            auto less = [&column, desc = selection.descending](size_t a, size_t b) {
+                const auto &x = column[a];
+                const auto &y = column[b];
+                if constexpr (std::is_floating_point_v<std::decay_t<decltype(x)>>)
+                {
+                    bool nan_x = std::isnan(x), nan_y = std::isnan(y);
+                    if (nan_x || nan_y)
+                        return nan_x == nan_y ? a < b : nan_y;
+                }
+                if (x == y)
+                    return a < b;
+                return desc ? y < x : x < y;
+            };
+            std::partial_sort(rows.begin(), rows.begin() + top, rows.end(), less);
+        });
+    }
+    rows.resize(top);
+    return rows;
+}
+
+#endif // JOBREPORT_SELECTION_HPP
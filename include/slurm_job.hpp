@@ -11,6 +11,7 @@
 #include <iostream>
 #include <unordered_map>
 
+#include "status.hpp"
 #include "utils.hpp"
 
 class SlurmJob
@@ -34,6 +35,7 @@ public:
     unsigned int time_limit = 0;
     bool root = false;
     bool node_root = false;
+    bool node_leader = false; // first rank of its node, the only one writing the node files when consolidated
 
     // Debugging
     void print_vars();
@@ -135,6 +137,13 @@ Status SlurmJob::read_slurm_env(bool ignore_gpu_binding, bool verbose)
     // A process is considered the root process of a node if
     node_root = !step_gpus.empty() || (std::stoul(proc_id) % n_tasks_per_node == 0);
 
+    // Every rank is a node root when the step GPUs are known, the first one of the node leads it
+    unsigned int local_id = 0;
+    if(read_env_var(local_id, "SLURM_LOCALID") == Status::Success)
+        node_leader = node_root && local_id == 0;
+    else
+        node_leader = n_tasks_per_node > 0 ? std::stoul(proc_id) % n_tasks_per_node == 0 : node_root;
+
     return Status::Success;
 }
 
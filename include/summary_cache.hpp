@@ -0,0 +1,304 @@
+/*
+    Per-step summary cache.
+
+    The DataFrame of a step and its averages are stored in a binary
+    sidecar file in the step directory, together with a fingerprint of
+    the CSV files they were computed from: their names, sizes and
+    checksums as listed in the job manifest, or their names, sizes and
+    modification times in a directory without one. A later print only
+    compares the fingerprint instead of parsing every CSV file again;
+    any change to the sources, or an unreadable cache, makes it fall
+    back to the CSV files and rewrite the cache.
+
+    The cache is written to a temporary file of its own, created with
+    mkstemp, and renamed over the previous one, so concurrent writers,
+    processes or threads, never write to the same file, and readers see
+    either the old or the new cache, never a partial one. Failing to write it, e.g. in a read-only report
+    directory, is not an error.
+
+    Layout, native endianness:
+        header          SummaryCacheHeader
+        averages        strings as u32 length + bytes, then the numbers
+        columns         strings as above, numbers as packed arrays
+*/
+
+#ifndef JOBREPORT_SUMMARY_CACHE_HPP
+#define JOBREPORT_SUMMARY_CACHE_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "dataframe.hpp"
+#include "profile.hpp"
+#include "utils.hpp"
+
+#define SUMMARY_CACHE_FILE ".jobreport_summary"
+#define SUMMARY_CACHE_MAGIC "JRSC"
+#define SUMMARY_CACHE_VERSION 2 // 2: load imbalance from the exact mean SM utilization
+
+struct SummaryCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t fingerprint;
+    uint64_t nFiles;
+    uint64_t nRows;
+};
+
+// Order-independent hash of the names, sizes and modification times of the
+// CSV files of `dir`, so that the listing does not need to be sorted
+uint64_t source_fingerprint(const std::filesystem::path &dir, uint64_t &nFiles)
+{
+    auto mix = [](uint64_t h) {
+        // splitmix64 finalizer
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebULL;
+        h ^= h >> 31;
+        return h;
+    };
+
+    uint64_t fingerprint = 0;
+    nFiles = 0;
+
+    // One fstatat per file rather than the several stat calls of std::filesystem
+    DIR *d = opendir(dir.c_str());
+    if (d == nullptr)
+        return 0;
+
+    while (struct dirent *entry = readdir(d))
+    {
+        size_t len = std::strlen(entry->d_name);
+        if (len < 4 || std::strcmp(entry->d_name + len - 4, ".csv") != 0)
+            continue;
+
+        struct stat st;
+        if (fstatat(dirfd(d), entry->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode))
+            continue;
+
+        // FNV-1a of the name
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (size_t i = 0; i < len; ++i)
+        {
+            h ^= static_cast<unsigned char>(entry->d_name[i]);
+            h *= 0x100000001b3ULL;
+        }
+        h = mix(h ^ mix(static_cast<uint64_t>(st.st_size)));
+        h = mix(h ^ static_cast<uint64_t>(st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec));
+
+        fingerprint += h;
+        nFiles++;
+    }
+    closedir(d);
+
+    return mix(fingerprint ^ nFiles);
+}
+
+class SummaryCacheWriter
+{
+public:
+    std::string data;
+
+    template <typename T>
+    void pod(const T &v) { data.append(reinterpret_cast<const char *>(&v), sizeof(T)); }
+
+    void string(const std::string &s)
+    {
+        pod(static_cast<uint32_t>(s.size()));
+        data.append(s);
+    }
+
+    template <typename T>
+    void column(const DFColumn<T> &c)
+    {
+        if constexpr (std::is_same_v<T, std::string>)
+        {
+            for (const auto &s : c)
+                string(s);
+        }
+        else
+        {
+            data.append(reinterpret_cast<const char *>(c.data()), c.size() * sizeof(T));
+        }
+    }
+};
+
+class SummaryCacheReader
+{
+public:
+    const char *p;
+    const char *end;
+
+    template <typename T>
+    bool pod(T &v)
+    {
+        if (static_cast<size_t>(end - p) < sizeof(T))
+            return false;
+        std::memcpy(&v, p, sizeof(T));
+        p += sizeof(T);
+        return true;
+    }
+
+    bool string(std::string &s)
+    {
+        uint32_t size;
+        if (!pod(size) || static_cast<size_t>(end - p) < size)
+            return false;
+        s.assign(p, size);
+        p += size;
+        return true;
+    }
+
+    template <typename T>
+    bool column(DFColumn<T> &c, size_t n)
+    {
+        c.resize(n);
+        if constexpr (std::is_same_v<T, std::string>)
+        {
+            for (auto &s : c)
+            {
+                if (!string(s))
+                    return false;
+            }
+            return true;
+        }
+        else
+        {
+            if (static_cast<size_t>(end - p) / sizeof(T) < n)
+                return false;
+            std::memcpy(c.data(), p, n * sizeof(T));
+            p += n * sizeof(T);
+            return true;
+        }
+    }
+};
+
+// Applies `f` to every column of `df`, in the order of the cache
+template <typename DF, typename F>
+bool for_each_column(DF &df, F &&f)
+{
+    return f(df.user) && f(df.account) && f(df.jobId) && f(df.stepId) && f(df.nNodes)
+        && f(df.host) && f(df.gpuId)
+        && f(df.powerUsageMin) && f(df.powerUsageMax) && f(df.powerUsageAvg)
+        && f(df.startTime) && f(df.endTime)
+        && f(df.smUtilizationMin) && f(df.smUtilizationMax) && f(df.smUtilizationAvg)
+        && f(df.memoryUtilizationMin) && f(df.memoryUtilizationMax) && f(df.memoryUtilizationAvg)
+        && f(df.maxAllocatedMemory) && f(df.energyConsumed);
+}
+
+template <typename A, typename F>
+bool for_each_average(A &avg, F &&f)
+{
+    return f(avg.jobId) && f(avg.stepId) && f(avg.nNodes) && f(avg.nGpus)
+        && f(avg.powerUsageAvg) && f(avg.energyConsumed)
+        && f(avg.startTime) && f(avg.endTime)
+        && f(avg.smUtilizationAvg) && f(avg.memoryUtilizationAvg)
+        && f(avg.maxAllocatedMemory) && f(avg.loadImbalance);
+}
+
+// Loads the cache of `dir` if it was written for the sources of `fingerprint`
+bool read_summary_cache(const std::filesystem::path &dir, uint64_t fingerprint, uint64_t nFiles,
+                        DataFrame &df, DataFrameAvg &avg)
+{
+    std::ifstream ifs(dir / SUMMARY_CACHE_FILE, std::ios::binary);
+    if (!ifs.is_open())
+        return false;
+
+    PROFILE_SCOPE("read_summary_cache");
+    std::string data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    PROFILE_COUNT(ProfileFiles, 1);
+    PROFILE_COUNT(ProfileBytes, data.size());
+    SummaryCacheReader reader{data.data(), data.data() + data.size()};
+
+    SummaryCacheHeader header;
+    if (!reader.pod(header)
+        || std::memcmp(header.magic, SUMMARY_CACHE_MAGIC, 4) != 0
+        || header.version != SUMMARY_CACHE_VERSION)
+        return false;
+
+    if (fingerprint != header.fingerprint || nFiles != header.nFiles || nFiles == 0)
+    {
+        LOG("Summary cache of " << dir << " is out of date");
+        return false;
+    }
+
+    DataFrame cached;
+    DataFrameAvg cached_avg;
+    size_t n = header.nRows;
+    if (n > data.size()) // corrupted
+        return false;
+    if (!reader.string(cached_avg.user) || !reader.string(cached_avg.account)
+        || !for_each_average(cached_avg, [&](auto &v) { return reader.pod(v); })
+        || !for_each_column(cached, [&](auto &c) { return reader.column(c, n); }))
+        return false;
+
+    df = std::move(cached);
+    avg = std::move(cached_avg);
+    return true;
+}
+
+// Writes the cache of `dir`, atomically replacing the previous one
+void write_summary_cache(const std::filesystem::path &dir, uint64_t fingerprint, uint64_t nFiles,
+                         const DataFrame &df, const DataFrameAvg &avg)
+{
+    PROFILE_SCOPE("write_summary_cache");
+    SummaryCacheWriter writer;
+
+    SummaryCacheHeader header;
+    std::memcpy(header.magic, SUMMARY_CACHE_MAGIC, 4);
+    header.version = SUMMARY_CACHE_VERSION;
+    header.fingerprint = fingerprint;
+    header.nFiles = nFiles;
+    header.nRows = df.gpuId.size();
+    writer.pod(header);
+
+    writer.string(avg.user);
+    writer.string(avg.account);
+    for_each_average(avg, [&](const auto &v) { writer.pod(v); return true; });
+    for_each_column(df, [&](const auto &c) { writer.column(c); return true; });
+
+    // A file of its own for every writer, threads of one process included, named by mkstemp
+    std::string name = (dir / (std::string(SUMMARY_CACHE_FILE) + ".tmp.XXXXXX")).string();
+    int fd = mkstemp(name.data());
+    if (fd < 0)
+    {
+        LOG("Could not write summary cache " << name);
+        return;
+    }
+    std::filesystem::path tmp = name;
+    bool written = fchmod(fd, 0644) == 0;
+    for (size_t offset = 0; written && offset < writer.data.size();)
+    {
+        ssize_t n = write(fd, writer.data.data() + offset, writer.data.size() - offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        written = n > 0;
+        offset += written ? n : 0;
+    }
+    if (close(fd) != 0 || !written)
+    {
+        std::error_code ec;
+        std::filesystem::remove(tmp, ec);
+        return;
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmp, dir / SUMMARY_CACHE_FILE, ec);
+    if (ec)
+    {
+        std::filesystem::remove(tmp, ec);
+    }
+}
+
+#endif // JOBREPORT_SUMMARY_CACHE_HPP
@@ -0,0 +1,408 @@
+/*
+    Synthetic job reports.
+
+    Writes the directory tree the monitor writes for a job, without GPUs:
+    the root metadata file, one step_<N> directory per step and in it one
+    proc_<rank>.csv file per rank, or one node_<host>.csv file per node
+    when consolidated, with optionally the time series of each rank in
+    proc_<rank>.ts, or of each node in node_<host>.ts when consolidated,
+    registered in the job manifest. The GPUs of a node
+    are split evenly between its ranks, as with per-rank GPU binding.
+
+    Every GPU is drawn as regular, idle, straggler or throttled, and may
+    have failed to read its power, in the proportions of the options. The
+    values of a node in a step are drawn from a generator seeded by the
+    seed, the step and the node, so a tree is generated identically
+    whatever the number of threads that write it.
+
+    Nodes are generated in parallel, and every CSV file is written in a
+    single write; the manifest records are collected and written at the
+    end, in step and rank order.
+*/
+
+#ifndef JOBREPORT_SYNTH_HPP
+#define JOBREPORT_SYNTH_HPP
+
+#include <string>
+#include <vector>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <sstream>
+#include <filesystem>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "dataframe.hpp"
+#include "manifest.hpp"
+#include "timeseries.hpp"
+#include "macros.hpp"
+#include "utils.hpp"
+
+#define SYNTH_START_TIME 1700000000000000LL // us, start of the first step
+
+// Proportions of the GPUs that do not behave regularly, each from 0 to 1
+struct SynthDistribution
+{
+    double idle = 0;       // no load, at idle power
+    double stragglers = 0; // fully busy and finishing late, while the others wait
+    double throttled = 0;  // capped in power, at a lower utilization
+    double nanPower = 0;   // power not read, as DCGM reports it when it fails
+};
+
+struct SynthOptions
+{
+    unsigned int nodes = 1;
+    unsigned int gpusPerNode = 4;
+    unsigned int ranksPerNode = 4; // each with gpusPerNode / ranksPerNode GPUs
+    unsigned int steps = 1;
+    bool consolidate = false;      // one CSV file per node and step
+    bool manifest = true;          // an empty root metadata file otherwise, as written by earlier versions
+    bool timeseries = false;       // a .ts file per rank
+    long long duration = 3600;     // s, of each step
+    long long samplingTime = 1;    // s, between time series samples
+    uint64_t seed = 1;
+    unsigned int jobId = 1000000;
+    unsigned int threads = 0;      // 0 for one per core
+    SynthDistribution distribution;
+};
+
+enum class SynthBehavior
+{
+    Regular,
+    Idle,
+    Straggler,
+    Throttled
+};
+
+// Load of a GPU over a step
+struct SynthGpu
+{
+    SynthBehavior behavior = SynthBehavior::Regular;
+    double power = 0;       // W, average
+    double powerSpread = 0; // W, of the samples around the average
+    double powerCap = 0;    // W, for throttled GPUs
+    int sm = 0;             // %, average
+    int mem = 0;            // %, average
+    long long memory = 0;   // bytes, maximum allocated
+    long long delay = 0;    // us the GPU finishes after the end of the step
+    bool nanPower = false;
+};
+
+// Host name of a node, in the natural order of the node index
+std::string synth_host(unsigned int node)
+{
+    char name[16];
+    std::snprintf(name, sizeof(name), "nid%06u", node);
+    return name;
+}
+
+SynthGpu synth_gpu(const SynthOptions &options, std::mt19937_64 &rng)
+{
+    const SynthDistribution &d = options.distribution;
+    std::uniform_real_distribution<double> uniform(0., 1.);
+    std::normal_distribution<double> noise(0., 1.);
+    auto percent = [](double x) { return static_cast<int>(std::clamp(x, 0., 100.) + 0.5); };
+
+    SynthGpu gpu;
+    double u = uniform(rng);
+    if (u < d.idle)
+        gpu.behavior = SynthBehavior::Idle;
+    else if (u < d.idle + d.stragglers)
+        gpu.behavior = SynthBehavior::Straggler;
+    else if (u < d.idle + d.stragglers + d.throttled)
+        gpu.behavior = SynthBehavior::Throttled;
+    gpu.nanPower = uniform(rng) < d.nanPower;
+
+    switch (gpu.behavior)
+    {
+    case SynthBehavior::Idle:
+        gpu.power = 60. + 30. * uniform(rng);
+        gpu.powerSpread = 5.;
+        gpu.memory = static_cast<long long>(uniform(rng) * (1LL << 30));
+        break;
+    case SynthBehavior::Straggler:
+        gpu.sm = percent(97. + 3. * uniform(rng));
+        gpu.mem = percent(60. + 5. * noise(rng));
+        gpu.power = 520. + 40. * uniform(rng);
+        gpu.powerSpread = 20.;
+        gpu.memory = static_cast<long long>((60. + 30. * uniform(rng)) * (1LL << 30));
+        gpu.delay = static_cast<long long>((0.05 + 0.15 * uniform(rng)) * options.duration * 1e6);
+        break;
+    case SynthBehavior::Throttled:
+        gpu.sm = percent(55. + 8. * noise(rng));
+        gpu.mem = percent(35. + 8. * noise(rng));
+        gpu.powerCap = 250. + 70. * uniform(rng);
+        gpu.power = gpu.powerCap - 20. * uniform(rng);
+        gpu.powerSpread = 60.;
+        gpu.memory = static_cast<long long>((30. + 50. * uniform(rng)) * (1LL << 30));
+        break;
+    case SynthBehavior::Regular:
+        gpu.sm = percent(70. + 8. * noise(rng));
+        gpu.mem = percent(45. + 8. * noise(rng));
+        gpu.power = std::max(90., 100. + 4.2 * gpu.sm + 15. * noise(rng));
+        gpu.powerSpread = 0.25 * gpu.power;
+        gpu.memory = static_cast<long long>((30. + 50. * uniform(rng)) * (1LL << 30));
+        break;
+    }
+    return gpu;
+}
+
+// Summary rows of the GPUs `first` to `first + gpus.size() - 1` of a node
+DataFrame synth_dataframe(const SynthOptions &options, unsigned int step, const std::string &host,
+                          unsigned int first, const std::vector<SynthGpu> &gpus)
+{
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    const long long start = SYNTH_START_TIME + step * options.duration * 1000000LL;
+    const long long end = start + options.duration * 1000000LL;
+
+    DataFrame df;
+    for (size_t i = 0; i < gpus.size(); ++i)
+    {
+        const SynthGpu &gpu = gpus[i];
+        const double maxPower = gpu.behavior == SynthBehavior::Throttled ? gpu.powerCap : gpu.power + gpu.powerSpread;
+
+        df.user.push_back("synth");
+        df.account.push_back("synth");
+        df.jobId.push_back(options.jobId);
+        df.stepId.push_back(step);
+        df.nNodes.push_back(options.nodes);
+        df.host.push_back(host);
+        df.gpuId.push_back(first + i);
+        df.powerUsageMin.push_back(gpu.nanPower ? nan : std::max(0., gpu.power - gpu.powerSpread));
+        df.powerUsageMax.push_back(gpu.nanPower ? nan : maxPower);
+        df.powerUsageAvg.push_back(gpu.nanPower ? nan : gpu.power);
+        df.startTime.push_back(start);
+        df.endTime.push_back(end + gpu.delay);
+        df.smUtilizationMin.push_back(std::max(0, gpu.sm - 20));
+        df.smUtilizationMax.push_back(std::min(100, gpu.sm + 10));
+        df.smUtilizationAvg.push_back(gpu.sm);
+        df.memoryUtilizationMin.push_back(std::max(0, gpu.mem - 20));
+        df.memoryUtilizationMax.push_back(std::min(100, gpu.mem + 10));
+        df.memoryUtilizationAvg.push_back(gpu.mem);
+        df.maxAllocatedMemory.push_back(gpu.memory);
+        // As the monitor does without energy counter: the average power over the elapsed time
+        df.energyConsumed.push_back(gpu.nanPower ? nan : gpu.power * (end + gpu.delay - start) / 1e6);
+    }
+    return df;
+}
+
+// Time series of the GPUs of a rank, sampled as the collector samples them
+std::vector<TimeSeriesSample> synth_samples(const SynthOptions &options, long long start,
+                                            const std::vector<SynthGpu> &gpus, std::mt19937_64 &rng)
+{
+    std::uniform_real_distribution<double> uniform(-1., 1.);
+    const long long step = options.samplingTime * 1000000LL;
+    long long end = start + options.duration * 1000000LL;
+    for (const auto &gpu : gpus)
+        end = std::max(end, start + options.duration * 1000000LL + gpu.delay);
+
+    std::vector<TimeSeriesSample> samples;
+    samples.reserve((end - start) / step * gpus.size() * TIMESERIES_FIELDS);
+    for (long long t = start; t < end; t += step)
+    {
+        for (size_t c = 0; c < gpus.size(); ++c)
+        {
+            const SynthGpu &gpu = gpus[c];
+            if (t >= start + options.duration * 1000000LL + gpu.delay)
+                continue;
+
+            double power = gpu.power + gpu.powerSpread * uniform(rng);
+            double sm = gpu.sm + (gpu.sm > 0 ? 10. * uniform(rng) : 0.);
+            double mem = gpu.mem + (gpu.mem > 0 ? 10. * uniform(rng) : 0.);
+            // Throttled GPUs hold their cap and slow down while they are at it
+            if (gpu.behavior == SynthBehavior::Throttled && power > gpu.powerCap)
+            {
+                power = gpu.powerCap;
+                sm *= 0.8;
+            }
+
+            uint16_t channel = static_cast<uint16_t>(c);
+            if (!gpu.nanPower)
+                samples.push_back({t, channel, static_cast<uint16_t>(TimeSeriesField::Power), static_cast<float>(power)});
+            samples.push_back({t, channel, static_cast<uint16_t>(TimeSeriesField::SmUtilization),
+                               static_cast<float>(std::clamp(sm, 0., 100.))});
+            samples.push_back({t, channel, static_cast<uint16_t>(TimeSeriesField::MemoryUtilization),
+                               static_cast<float>(std::clamp(mem, 0., 100.))});
+        }
+    }
+    return samples;
+}
+
+// Writes `data` to a new file in a single write
+bool write_synth_file(const std::filesystem::path &path, const std::string &data)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+
+    ssize_t written = write(fd, data.data(), data.size());
+    return close(fd) == 0 && written == static_cast<ssize_t>(data.size());
+}
+
+// Writes the files of a node in a step, and the manifest records of its ranks
+// into `records`. Returns the path that could not be written, empty on success.
+std::string write_synth_node(const std::filesystem::path &root, const SynthOptions &options, unsigned int step,
+                             unsigned int node, ManifestRecord *records)
+{
+    std::seed_seq seed{static_cast<uint32_t>(options.seed), static_cast<uint32_t>(options.seed >> 32), step, node};
+    std::mt19937_64 rng(seed);
+
+    const unsigned int gpusPerRank = options.gpusPerNode / options.ranksPerNode;
+    const unsigned int nRanks = options.nodes * options.ranksPerNode;
+    const std::string host = synth_host(node);
+    const std::string stepName = "step_" + std::to_string(step);
+    const std::string nodeFile = stepName + "/node_" + host + ".csv";
+
+    std::string nodeData;
+    TimeSeriesHeader nodeHeader;
+    std::vector<TimeSeriesSample> nodeSamples;
+    for (unsigned int local = 0; local < options.ranksPerNode; ++local)
+    {
+        const unsigned int rank = node * options.ranksPerNode + local;
+        const std::string procName = stepName + "/proc_" + std::to_string(rank);
+
+        std::vector<SynthGpu> gpus;
+        for (unsigned int g = 0; g < gpusPerRank; ++g)
+            gpus.push_back(synth_gpu(options, rng));
+
+        DataFrame df = synth_dataframe(options, step, host, local * gpusPerRank, gpus);
+        std::ostringstream oss;
+        df.dump(oss);
+        const std::string csv = oss.str();
+
+        uint64_t offset = 0;
+        std::string file = procName + ".csv";
+        if (options.consolidate)
+        {
+            offset = nodeData.size();
+            file = nodeFile;
+            nodeData += csv;
+        }
+        else if (!write_synth_file(root / file, csv))
+        {
+            return (root / file).string();
+        }
+
+        if (options.timeseries)
+        {
+            TimeSeriesHeader header;
+            header.startTime = df.startTime[0];
+            header.samplingTime = options.samplingTime * 1000000LL;
+            header.host = host;
+            header.channels.assign(df.gpuId.begin(), df.gpuId.end());
+
+            std::vector<TimeSeriesSample> samples = synth_samples(options, header.startTime, gpus, rng);
+            if (options.consolidate)
+            {
+                // The channels of the ranks follow each other in the file of the node
+                if (local == 0)
+                    nodeHeader = header;
+                else
+                    nodeHeader.channels.insert(nodeHeader.channels.end(), header.channels.begin(), header.channels.end());
+                for (auto &sample : samples)
+                    sample.channel += local * gpusPerRank;
+                nodeSamples.insert(nodeSamples.end(), samples.begin(), samples.end());
+            }
+            else
+            {
+                TimeSeriesWriter writer;
+                if (!writer.open(root / (procName + TIMESERIES_EXTENSION), header))
+                    return (root / (procName + TIMESERIES_EXTENSION)).string();
+                writer.append(samples);
+                writer.close();
+            }
+        }
+
+        records[local] = make_manifest_record(step, rank, nRanks, csv, offset, df.gpuId, host, options.timeseries);
+        copy_field(records[local].file, file);
+    }
+
+    if (options.consolidate && !write_synth_file(root / nodeFile, nodeData))
+    {
+        return (root / nodeFile).string();
+    }
+    if (options.consolidate && options.timeseries)
+    {
+        std::filesystem::path tsFile = root / (stepName + "/node_" + host + TIMESERIES_EXTENSION);
+        TimeSeriesWriter writer;
+        if (!writer.open(tsFile, nodeHeader))
+            return tsFile.string();
+        writer.append(nodeSamples);
+        writer.close();
+    }
+    return "";
+}
+
+// Writes a synthetic job into `root`, which must not hold a job yet
+void write_synthetic_job(const std::filesystem::path &root, const SynthOptions &options)
+{
+    if (options.nodes == 0 || options.ranksPerNode == 0 || options.steps == 0
+        || options.gpusPerNode % options.ranksPerNode != 0 || options.duration <= 0 || options.samplingTime <= 0)
+    {
+        raise_error("Error: Invalid synthetic job layout");
+    }
+    if (std::filesystem::exists(root / ROOT_METADATA_FILE))
+    {
+        raise_error("Error: Output directory already holds a job: \"" + root.string() + "\"");
+    }
+
+    for (unsigned int step = 0; step < options.steps; ++step)
+    {
+        std::filesystem::create_directories(root / ("step_" + std::to_string(step)));
+    }
+
+    // Nodes of all steps are handed out to the threads one at a time
+    const size_t nNodes = static_cast<size_t>(options.steps) * options.nodes;
+    std::vector<ManifestRecord> records(nNodes * options.ranksPerNode);
+    std::atomic<size_t> next(0);
+    std::mutex mutex;
+    std::string failed;
+
+    auto worker = [&]() {
+        for (size_t i = next++; i < nNodes; i = next++)
+        {
+            std::string path = write_synth_node(root, options, i / options.nodes, i % options.nodes,
+                                                &records[i * options.ranksPerNode]);
+            if (!path.empty())
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                failed = path;
+                next = nNodes;
+            }
+        }
+    };
+
+    unsigned int nThreads = options.threads > 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> threads;
+    for (unsigned int t = 1; t < std::min<size_t>(nThreads, nNodes); ++t)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    if (!failed.empty())
+    {
+        raise_error("Error: Could not write " + failed);
+    }
+
+    // Written last, as the monitor completes the manifest once the data is on disk
+    std::string metadata;
+    if (options.manifest)
+    {
+        metadata.assign(reinterpret_cast<const char *>(records.data()), records.size() * sizeof(ManifestRecord));
+    }
+    if (!write_synth_file(root / ROOT_METADATA_FILE, metadata))
+    {
+        raise_error("Error: Could not write the job manifest of " + root.string());
+    }
+}
+
+#endif // JOBREPORT_SYNTH_HPP
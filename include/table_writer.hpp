@@ -0,0 +1,282 @@
+/*
+    Streaming output for large reports.
+
+    OutputBuffer collects text in a fixed-size buffer that is handed to
+    the underlying stream in large blocks, and formats numbers with
+    std::to_chars instead of going through the locale-aware stream
+    machinery. FixedWidthTable draws tables with the same borders and
+    padding as the tabulate tables of the report, but from precomputed
+    column widths, so rows are written out as they are produced and no
+    per-cell state is kept.
+*/
+
+#ifndef JOBREPORT_TABLE_WRITER_HPP
+#define JOBREPORT_TABLE_WRITER_HPP
+
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+#define OUTPUT_BUFFER_SIZE (1 << 16)
+#define TABLE_CELL_CAPACITY 64
+// Number of rows above which tables are streamed rather than built with tabulate
+#define TABLE_STREAMING_THRESHOLD 256
+
+class OutputBuffer
+{
+public:
+    explicit OutputBuffer(std::ostream &os, size_t capacity = OUTPUT_BUFFER_SIZE)
+        : os(os), data(capacity) {}
+
+    ~OutputBuffer() { flush(); }
+
+    OutputBuffer(const OutputBuffer &) = delete;
+    OutputBuffer &operator=(const OutputBuffer &) = delete;
+
+    void put(char c)
+    {
+        if (size == data.size())
+            flush();
+        data[size++] = c;
+    }
+
+    void write(std::string_view s)
+    {
+        if (s.size() > data.size() - size)
+        {
+            flush();
+            if (s.size() > data.size())
+            {
+                os.write(s.data(), s.size());
+                return;
+            }
+        }
+        std::memcpy(data.data() + size, s.data(), s.size());
+        size += s.size();
+    }
+
+    void fill(char c, size_t n)
+    {
+        while (n > 0)
+        {
+            if (size == data.size())
+                flush();
+            size_t k = std::min(n, data.size() - size);
+            std::memset(data.data() + size, c, k);
+            size += k;
+            n -= k;
+        }
+    }
+
+    template <typename T>
+    void integer(T value)
+    {
+        char tmp[24];
+        auto res = std::to_chars(tmp, tmp + sizeof(tmp), value);
+        write(std::string_view(tmp, res.ptr - tmp));
+    }
+
+    // Fixed-point notation, NaN written as `nan`
+    void fixed(double value, int precision);
+
+    void flush()
+    {
+        if (size > 0)
+        {
+            os.write(data.data(), size);
+            size = 0;
+        }
+    }
+
+private:
+    std::ostream &os;
+    std::vector<char> data;
+    size_t size = 0;
+};
+
+// Writes `value` with `precision` decimals to [first, last), returns the end of
+// the output. Goes through integers, as floating-point to_chars needs GCC 11.
+char *format_fixed(char *first, char *last, double value, int precision)
+{
+    if (std::isnan(value))
+    {
+        size_t n = std::min<size_t>(3, last - first);
+        std::memcpy(first, "nan", n);
+        return first + n;
+    }
+
+    static const double scales[] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+    precision = std::clamp(precision, 0, 6);
+    double scaled = std::round(std::abs(value) * scales[precision]);
+    if (scaled >= 9e18)
+    {
+        // Out of range of the integer path, fall back to printf
+        int n = snprintf(first, last - first, "%.*f", precision, value);
+        return first + std::min<long>(std::max(n, 0), last - first - 1);
+    }
+
+    unsigned long long digits = static_cast<unsigned long long>(scaled);
+    unsigned long long div = static_cast<unsigned long long>(scales[precision]);
+
+    char *p = first;
+    if (value < 0 && digits > 0 && p < last)
+        *p++ = '-';
+    p = std::to_chars(p, last, digits / div).ptr;
+    if (precision > 0 && p < last)
+    {
+        *p++ = '.';
+        char frac[8];
+        auto res = std::to_chars(frac, frac + sizeof(frac), digits % div);
+        size_t len = res.ptr - frac;
+        for (size_t i = len; i < static_cast<size_t>(precision) && p < last; ++i)
+            *p++ = '0';
+        size_t n = std::min<size_t>(len, last - p);
+        std::memcpy(p, frac, n);
+        p += n;
+    }
+    return p;
+}
+
+void OutputBuffer::fixed(double value, int precision)
+{
+    char tmp[32];
+    char *end = format_fixed(tmp, tmp + sizeof(tmp), value, precision);
+    write(std::string_view(tmp, end - tmp));
+}
+
+// Text of one table cell, formatted in place without allocating
+struct Cell
+{
+    char data[TABLE_CELL_CAPACITY];
+    size_t size = 0;
+
+    void clear() { size = 0; }
+
+    Cell &append(std::string_view s)
+    {
+        size_t n = std::min(s.size(), sizeof(data) - size);
+        std::memcpy(data + size, s.data(), n);
+        size += n;
+        return *this;
+    }
+
+    template <typename T>
+    Cell &integer(T value)
+    {
+        size = std::to_chars(data + size, data + sizeof(data), value).ptr - data;
+        return *this;
+    }
+
+    // Integer right-aligned on `width` characters
+    template <typename T>
+    Cell &integer(T value, size_t width)
+    {
+        char tmp[24];
+        size_t len = std::to_chars(tmp, tmp + sizeof(tmp), value).ptr - tmp;
+        for (size_t i = len; i < width && size < sizeof(data); ++i)
+            data[size++] = ' ';
+        return append(std::string_view(tmp, len));
+    }
+
+    Cell &fixed(double value, int precision)
+    {
+        size = format_fixed(data + size, data + sizeof(data), value, precision) - data;
+        return *this;
+    }
+
+    std::string_view view() const { return std::string_view(data, size); }
+};
+
+// Table with the borders of the report tables:
+//
+//     +------+------+
+//     | Head | Head |
+//     +------+------+
+//     | cell | cell |
+//     +------+------+
+//
+// Widths include the single space of padding on each side, as in tabulate.
+// Cells wider than their column wrap on the following lines.
+class FixedWidthTable
+{
+public:
+    FixedWidthTable(OutputBuffer &out, std::vector<size_t> widths)
+        : out(out), widths(std::move(widths)), pending(this->widths.size()) {}
+
+    void rule()
+    {
+        out.put('+');
+        for (size_t w : widths)
+        {
+            out.fill('-', w);
+            out.put('+');
+        }
+        out.put('\n');
+    }
+
+    // Header cells may span several lines, separated by '\n'
+    void header(const std::vector<std::string> &cells)
+    {
+        for (size_t c = 0; c < widths.size(); ++c)
+            pending[c] = c < cells.size() ? std::string_view(cells[c]) : std::string_view();
+        lines(true);
+    }
+
+    void row(const std::string_view *cells)
+    {
+        for (size_t c = 0; c < widths.size(); ++c)
+            pending[c] = cells[c];
+        lines(false);
+    }
+
+private:
+    OutputBuffer &out;
+    std::vector<size_t> widths;
+    std::vector<std::string_view> pending; // text of each cell left to write
+
+    void lines(bool split_newlines)
+    {
+        bool more = true;
+        while (more)
+        {
+            more = false;
+            out.put('|');
+            for (size_t c = 0; c < widths.size(); ++c)
+            {
+                std::string_view piece = next_piece(pending[c], widths[c] > 2 ? widths[c] - 2 : 1, split_newlines);
+                out.put(' ');
+                out.write(piece);
+                out.fill(' ', widths[c] > piece.size() + 1 ? widths[c] - piece.size() - 1 : 0);
+                out.put('|');
+                more |= !pending[c].empty();
+            }
+            out.put('\n');
+        }
+    }
+
+    // Takes the next line of at most `width` characters, preferably at a space
+    static std::string_view next_piece(std::string_view &text, size_t width, bool split_newlines)
+    {
+        size_t end = split_newlines ? std::min(text.find('\n'), text.size()) : text.size();
+        size_t skip = end < text.size() ? 1 : 0;
+
+        if (end > width)
+        {
+            size_t space = text.rfind(' ', width);
+            end = space != std::string_view::npos && space > 0 ? space : width;
+            skip = space != std::string_view::npos && space > 0 ? 1 : 0;
+        }
+
+        std::string_view piece = text.substr(0, end);
+        text.remove_prefix(std::min(text.size(), end + skip));
+        return piece;
+    }
+};
+
+#endif // JOBREPORT_TABLE_WRITER_HPP
@@ -0,0 +1,428 @@
+/*
+    On-disk format of the time series recorded by the collector.
+
+    Every collecting process writes one binary file next to its CSV
+    (step_<n>/proc_<id>.ts, or step_<n>/node_<host>.ts from the leader
+    of each node with --consolidate) made of a header followed by a stream of
+    fixed-size samples appended in the order they were fetched.
+    Samples of different channels are interleaved, but the samples of
+    a single channel are always in increasing time order.
+
+    While sampling, the writer also aggregates the samples into coarser
+    levels (1 s, 10 s and 60 s buckets with min, max, mean and count).
+    They are appended after the raw samples when the file is closed,
+    followed by a fixed-size footer indexing them, so a reader can get
+    an overview of the whole step by reading a few kilobytes.
+
+        | header | raw samples ... | level 1 | level 2 | level 3 | footer |
+
+    Files without a footer (step still running, or collector killed)
+    only provide the raw level.
+*/
+
+#ifndef JOBREPORT_TIMESERIES_HPP
+#define JOBREPORT_TIMESERIES_HPP
+
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <limits>
+#include <filesystem>
+
+#include "profile.hpp"
+#include "utils.hpp"
+
+#define TIMESERIES_EXTENSION ".ts"
+#define TIMESERIES_MAGIC "JRTS"
+#define TIMESERIES_FOOTER_MAGIC "JRTF"
+#define TIMESERIES_VERSION 2
+#define TIMESERIES_FIELDS 3
+#define TIMESERIES_LEVELS 3
+#define TIMESERIES_TMP_EXTENSION ".tmp"
+
+// Width of the buckets of each aggregated level, in us
+constexpr int64_t TIMESERIES_LEVEL_WIDTH[TIMESERIES_LEVELS] = {1000000, 10000000, 60000000};
+
+// Channel id used for node-level measurements (as opposed to a GPU id)
+constexpr uint32_t NODE_CHANNEL = std::numeric_limits<uint32_t>::max();
+
+enum class TimeSeriesField : uint16_t
+{
+    Power = 0,             // W
+    SmUtilization = 1,     // %
+    MemoryUtilization = 2, // %
+};
+
+struct TimeSeriesSample
+{
+    int64_t timestamp; // us, clock of the node that recorded the sample
+    uint16_t channel;  // index into TimeSeriesHeader::channels
+    uint16_t field;    // TimeSeriesField
+    float value;
+};
+static_assert(sizeof(TimeSeriesSample) == 16, "TimeSeriesSample must be packed to 16 bytes");
+
+// Aggregate of the samples of one channel and field within [start, start + width)
+struct TimeSeriesBucket
+{
+    int64_t start; // us, clock of the node that recorded the samples
+    uint16_t channel;
+    uint16_t field;
+    uint32_t count;
+    float min;
+    float max;
+    double mean;
+
+    void add(float value)
+    {
+        min = count == 0 ? value : std::min(min, value);
+        max = count == 0 ? value : std::max(max, value);
+        mean += (value - mean) / ++count;
+    }
+};
+static_assert(sizeof(TimeSeriesBucket) == 32, "TimeSeriesBucket must be packed to 32 bytes");
+
+struct TimeSeriesLevel
+{
+    int64_t width = 0;   // us
+    uint64_t offset = 0; // bytes from the start of the file
+    uint64_t count = 0;  // buckets
+};
+
+struct TimeSeriesFooter
+{
+    uint64_t rawEnd = 0; // bytes from the start of the file
+    TimeSeriesLevel levels[TIMESERIES_LEVELS];
+    uint32_t nLevels = 0;
+    char magic[4] = {'J', 'R', 'T', 'F'};
+};
+
+struct TimeSeriesHeader
+{
+    uint32_t version = TIMESERIES_VERSION;
+    int64_t startTime = 0;    // us, clock of the node that recorded the samples
+    int64_t samplingTime = 0; // us
+    std::string host;
+    std::vector<uint32_t> channels; // GPU id, or NODE_CHANNEL
+
+    void write(std::ofstream &os) const;
+    bool read(std::ifstream &is);
+};
+
+void TimeSeriesHeader::write(std::ofstream &os) const
+{
+    uint32_t hostLength = host.size();
+    uint32_t nChannels = channels.size();
+
+    os.write(TIMESERIES_MAGIC, 4);
+    os.write(reinterpret_cast<const char *>(&version), sizeof(version));
+    os.write(reinterpret_cast<const char *>(&startTime), sizeof(startTime));
+    os.write(reinterpret_cast<const char *>(&samplingTime), sizeof(samplingTime));
+    os.write(reinterpret_cast<const char *>(&hostLength), sizeof(hostLength));
+    os.write(host.data(), hostLength);
+    os.write(reinterpret_cast<const char *>(&nChannels), sizeof(nChannels));
+    os.write(reinterpret_cast<const char *>(channels.data()), nChannels * sizeof(uint32_t));
+}
+
+bool TimeSeriesHeader::read(std::ifstream &is)
+{
+    char magic[4];
+    uint32_t hostLength = 0;
+    uint32_t nChannels = 0;
+
+    if (!is.read(magic, 4) || std::memcmp(magic, TIMESERIES_MAGIC, 4) != 0)
+        return false;
+
+    is.read(reinterpret_cast<char *>(&version), sizeof(version));
+    is.read(reinterpret_cast<char *>(&startTime), sizeof(startTime));
+    is.read(reinterpret_cast<char *>(&samplingTime), sizeof(samplingTime));
+    is.read(reinterpret_cast<char *>(&hostLength), sizeof(hostLength));
+    // Version 1 files are identical to version 2 files without levels
+    if (!is || version < 1 || version > TIMESERIES_VERSION || hostLength > HOST_NAME_MAX)
+        return false;
+
+    host.resize(hostLength);
+    is.read(host.data(), hostLength);
+    is.read(reinterpret_cast<char *>(&nChannels), sizeof(nChannels));
+    if (!is || nChannels > std::numeric_limits<uint16_t>::max())
+        return false;
+
+    channels.resize(nChannels);
+    is.read(reinterpret_cast<char *>(channels.data()), nChannels * sizeof(uint32_t));
+    return static_cast<bool>(is);
+}
+
+// Appends samples to a time series file and maintains its aggregated levels
+class TimeSeriesWriter
+{
+public:
+    TimeSeriesWriter() = default;
+
+    bool open(const std::filesystem::path &path, const TimeSeriesHeader &header)
+    {
+        this->path = path;
+        this->header = header;
+
+        os.open(path, std::ios::binary | std::ios::trunc);
+        if (!os.is_open())
+            return false;
+        header.write(os);
+        os.flush();
+
+        // Completed buckets are staged in temporary files, so that memory
+        // usage does not grow with the duration of the step. They are
+        // unlinked once open: the step directory only holds the .ts file,
+        // and a killed monitor leaves no temporary files behind.
+        for (size_t l = 0; l < TIMESERIES_LEVELS; ++l)
+        {
+            levels[l].open(level_path(l), std::ios::binary | std::ios::trunc | std::ios::in | std::ios::out);
+            if (!levels[l].is_open())
+                return false;
+            std::filesystem::remove(level_path(l));
+        }
+
+        current.assign(header.channels.size() * TIMESERIES_FIELDS * TIMESERIES_LEVELS, TimeSeriesBucket{});
+        return static_cast<bool>(os);
+    }
+
+    void append(const std::vector<TimeSeriesSample> &samples)
+    {
+        os.write(reinterpret_cast<const char *>(samples.data()), samples.size() * sizeof(TimeSeriesSample));
+        // Flush so that a crashed or killed workload still leaves the data on disk
+        os.flush();
+
+        for (const auto &s : samples)
+        {
+            aggregate(s);
+        }
+        for (auto &level : levels)
+        {
+            level.flush();
+        }
+    }
+
+    // Completes the open buckets and appends the levels and the footer
+    void close()
+    {
+        if (!os.is_open())
+            return;
+
+        for (size_t i = 0; i < current.size(); ++i)
+        {
+            if (current[i].count > 0)
+            {
+                write_bucket(i % TIMESERIES_LEVELS, current[i]);
+            }
+        }
+
+        TimeSeriesFooter footer;
+        footer.rawEnd = os.tellp();
+        footer.nLevels = TIMESERIES_LEVELS;
+        for (size_t l = 0; l < TIMESERIES_LEVELS; ++l)
+        {
+            footer.levels[l].width = TIMESERIES_LEVEL_WIDTH[l];
+            footer.levels[l].offset = os.tellp();
+            footer.levels[l].count = levels[l].tellp() / sizeof(TimeSeriesBucket);
+
+            levels[l].seekg(0);
+            os << levels[l].rdbuf();
+            levels[l].close();
+        }
+
+        os.write(reinterpret_cast<const char *>(&footer), sizeof(footer));
+        os.close();
+    }
+
+private:
+    std::filesystem::path path;
+    TimeSeriesHeader header;
+    std::ofstream os;
+    std::fstream levels[TIMESERIES_LEVELS];
+    std::vector<TimeSeriesBucket> current; // open bucket of each channel, field and level
+
+    std::filesystem::path level_path(size_t level) const
+    {
+        std::filesystem::path p = path;
+        p += ".level" + std::to_string(level + 1) + TIMESERIES_TMP_EXTENSION;
+        return p;
+    }
+
+    void aggregate(const TimeSeriesSample &s)
+    {
+        if (s.channel >= header.channels.size() || s.field >= TIMESERIES_FIELDS)
+            return;
+
+        for (size_t l = 0; l < TIMESERIES_LEVELS; ++l)
+        {
+            // Buckets are aligned on the start of the file
+            int64_t width = TIMESERIES_LEVEL_WIDTH[l];
+            int64_t offset = s.timestamp - header.startTime;
+            int64_t start = header.startTime + (offset >= 0 ? offset / width : (offset - width + 1) / width) * width;
+
+            TimeSeriesBucket &bucket = current[(s.channel * TIMESERIES_FIELDS + s.field) * TIMESERIES_LEVELS + l];
+            if (bucket.count > 0 && bucket.start != start)
+            {
+                write_bucket(l, bucket);
+                bucket.count = 0;
+            }
+            if (bucket.count == 0)
+            {
+                bucket = TimeSeriesBucket{start, s.channel, s.field, 0, 0.0f, 0.0f, 0.0};
+            }
+            bucket.add(s.value);
+        }
+    }
+
+    void write_bucket(size_t level, const TimeSeriesBucket &bucket)
+    {
+        levels[level].write(reinterpret_cast<const char *>(&bucket), sizeof(bucket));
+    }
+};
+
+// Streams a time series file in fixed-size chunks, from the raw level or
+// from one of the aggregated levels
+class TimeSeriesReader
+{
+public:
+    static constexpr size_t CHUNK = 1 << 16; // samples or buckets
+
+    bool open(const std::filesystem::path &path)
+    {
+        is.open(path, std::ios::binary);
+        if (!is.is_open() || !header.read(is))
+            return false;
+        PROFILE_COUNT(ProfileFiles, 1);
+
+        rawBegin = is.tellg();
+        is.seekg(0, std::ios::end);
+        end = is.tellg();
+
+        // The footer is only present once the collector closed the file
+        if (end - rawBegin >= static_cast<std::streamoff>(sizeof(TimeSeriesFooter)))
+        {
+            TimeSeriesFooter tmp;
+            is.seekg(end - static_cast<std::streamoff>(sizeof(tmp)));
+            if (is.read(reinterpret_cast<char *>(&tmp), sizeof(tmp))
+                && std::memcmp(tmp.magic, TIMESERIES_FOOTER_MAGIC, 4) == 0
+                && tmp.nLevels <= TIMESERIES_LEVELS)
+            {
+                footer = tmp;
+            }
+        }
+
+        return seek_level(0);
+    }
+
+    // Number of levels, the raw samples being level 0
+    size_t levels() const { return footer.nLevels + 1; }
+
+    // Time covered by one sample or bucket of the level, in us
+    long long level_width(size_t level) const
+    {
+        return level == 0 ? header.samplingTime : footer.levels[level - 1].width;
+    }
+
+    // Coarsest level that still resolves `resolution` (us)
+    size_t select_level(long long resolution) const
+    {
+        size_t level = 0;
+        for (size_t l = 1; l < levels(); ++l)
+        {
+            if (level_width(l) <= resolution)
+                level = l;
+        }
+        return level;
+    }
+
+    bool seek_level(size_t level)
+    {
+        if (level >= levels())
+            return false;
+
+        this->level = level;
+        is.clear();
+        if (level == 0)
+        {
+            position = rawBegin;
+            limit = footer.nLevels > 0 ? static_cast<std::streamoff>(footer.rawEnd) : end;
+        }
+        else
+        {
+            position = footer.levels[level - 1].offset;
+            limit = position + footer.levels[level - 1].count * sizeof(TimeSeriesBucket);
+        }
+        is.seekg(position);
+        return static_cast<bool>(is);
+    }
+
+    // Reads the next chunk of raw samples, returns false once the level is exhausted.
+    // A truncated trailing sample (e.g. the collector was killed mid-write) is ignored.
+    bool next(std::vector<TimeSeriesSample> &samples)
+    {
+        read_chunk(samples);
+        return !samples.empty();
+    }
+
+    // Reads the next chunk of buckets of the current level. Raw samples are
+    // returned as single-sample buckets, so that all levels can be consumed alike.
+    bool next(std::vector<TimeSeriesBucket> &buckets)
+    {
+        if (level > 0)
+        {
+            read_chunk(buckets);
+            return !buckets.empty();
+        }
+
+        read_chunk(raw);
+        buckets.resize(raw.size());
+        for (size_t i = 0; i < raw.size(); ++i)
+        {
+            const TimeSeriesSample &s = raw[i];
+            buckets[i] = TimeSeriesBucket{s.timestamp, s.channel, s.field, 1, s.value, s.value, s.value};
+        }
+        return !buckets.empty();
+    }
+
+    TimeSeriesHeader header;
+
+private:
+    std::ifstream is;
+    TimeSeriesFooter footer;
+    std::streamoff rawBegin = 0;
+    std::streamoff end = 0;
+    std::streamoff position = 0;
+    std::streamoff limit = 0;
+    size_t level = 0;
+    std::vector<TimeSeriesSample> raw;
+
+    template <typename T>
+    void read_chunk(std::vector<T> &out)
+    {
+        size_t n = std::min<std::streamoff>(CHUNK, (limit - position) / static_cast<std::streamoff>(sizeof(T)));
+        out.resize(n);
+        is.read(reinterpret_cast<char *>(out.data()), n * sizeof(T));
+        out.resize(is.gcount() / sizeof(T));
+        PROFILE_COUNT(ProfileBytes, is.gcount());
+        position += out.size() * sizeof(T);
+    }
+};
+
+// Lists the time series files of a step directory
+std::vector<std::filesystem::path> list_timeseries(const std::filesystem::path &dir)
+{
+    std::vector<std::filesystem::path> files;
+    for (const auto &entry : std::filesystem::directory_iterator(dir))
+    {
+        if (entry.is_regular_file() && entry.path().extension() == TIMESERIES_EXTENSION)
+        {
+            files.push_back(entry.path());
+        }
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+#endif // JOBREPORT_TIMESERIES_HPP
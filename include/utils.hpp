@@ -4,9 +4,11 @@
 #include <string>
 #include <iostream>
 #include <cstdlib>
+#include <stdexcept>
 #include <vector>
 #include <sstream>
 #include <unistd.h>
+#include <sys/ioctl.h>
 #include <limits.h>
 #include <filesystem>
 
@@ -39,10 +41,24 @@ std::filesystem::path get_home_directory() {
     }
 }
 
+// Number of lines of the terminal on stdout, 0 if stdout is not a terminal
+size_t get_terminal_height() {
+    struct winsize ws;
+    if (isatty(STDOUT_FILENO) && ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0) {
+        return ws.ws_row;
+    }
+    return 0;
+}
+
 void raise_error(const std::string &msg)
 {
+#ifdef JOBREPORT_LIBRARY
+    // The library reports errors to its caller instead of exiting its process
+    throw std::runtime_error(msg);
+#else
     std::cerr << msg << std::endl;
     std::exit(EXIT_FAILURE);
+#endif
 }
 
 // Function used to parse the time string format DD-HH:MM:SS to seconds
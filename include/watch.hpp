@@ -0,0 +1,623 @@
+/*
+    Live view of a running job.
+
+    The report directory is followed with inotify: new step directories
+    are watched as they appear, and every modification of a time series
+    file marks it dirty. At each refresh only the samples appended to the
+    dirty files since the previous refresh are read, from the offset
+    where the previous read stopped, and folded into the latest value and
+    a moving average of every GPU, so the cost of a refresh does not grow
+    with the duration of the job. Files that already hold hours of
+    samples when the view starts are only read from their last minutes.
+
+    A GPU is flagged idle when its moving average of SM utilization is
+    below WATCH_IDLE_THRESHOLD, and stalled when its collector has not
+    appended a sample for WATCH_STALL_SAMPLES sampling periods, which
+    points at a hung node or a killed collector.
+*/
+
+#ifndef JOBREPORT_WATCH_HPP
+#define JOBREPORT_WATCH_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+#include <iostream>
+#include <filesystem>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include "macros.hpp"
+#include "timeseries.hpp"
+#include "table_writer.hpp"
+
+#define WATCH_AVERAGE_WINDOW 60.0   // s, time constant of the moving averages
+#define WATCH_IDLE_THRESHOLD 5.0    // %, SM utilization below which a GPU is idle
+#define WATCH_STALL_SAMPLES 10      // sampling periods without samples before a GPU is stalled
+#define WATCH_STALL_MIN 30.0        // s, lower bound of the stall timeout
+#define WATCH_DEFAULT_ROWS 50       // terminal height when it cannot be queried
+
+using WatchClock = std::chrono::steady_clock;
+
+struct WatchedGpu
+{
+    std::string host;
+    uint32_t gpuId = 0;
+    float latest[TIMESERIES_FIELDS] = {NAN, NAN, NAN};
+    double average[TIMESERIES_FIELDS] = {NAN, NAN, NAN}; // exponential moving average
+    int64_t lastTimestamp[TIMESERIES_FIELDS] = {0, 0, 0};
+    WatchClock::time_point lastUpdate;
+    double stallTimeout = WATCH_STALL_MIN; // s
+    bool finished = false;
+
+    bool idle() const { return !finished && average[1] < WATCH_IDLE_THRESHOLD; }
+
+    bool stalled(WatchClock::time_point now) const
+    {
+        return !finished && std::chrono::duration<double>(now - lastUpdate).count() > stallTimeout;
+    }
+
+    void add(uint16_t field, int64_t timestamp, float value)
+    {
+        if (std::isnan(average[field]))
+        {
+            average[field] = value;
+        }
+        else
+        {
+            double dt = std::max<int64_t>(timestamp - lastTimestamp[field], 0) / 1e6;
+            average[field] += (1 - std::exp(-dt / WATCH_AVERAGE_WINDOW)) * (value - average[field]);
+        }
+        latest[field] = value;
+        lastTimestamp[field] = timestamp;
+    }
+};
+
+// Read position in a time series file that is being appended to
+struct WatchedFile
+{
+    std::filesystem::path path;
+    int fd = -1;
+    bool hasHeader = false;
+    bool finished = false;          // the collector closed the file
+    TimeSeriesHeader header;
+    uint64_t offset = 0;            // of the next unread sample
+    uint64_t limit = UINT64_MAX;    // end of the raw samples, known once the file is closed
+    std::vector<long> gpus;         // index in the step of the GPU of each channel, -1 for the node
+    std::vector<int64_t> lastTimestamp; // of each channel and field, to detect the end of the raw samples
+};
+
+struct WatchedNode
+{
+    float power = NAN; // W, node channel
+    int64_t lastTimestamp = 0;
+};
+
+struct WatchedStep
+{
+    unsigned int stepId = 0;
+    std::vector<WatchedGpu> gpus;
+    std::map<std::pair<std::string, uint32_t>, size_t> index;
+    std::map<std::string, WatchedNode> nodes;
+};
+
+class JobWatcher
+{
+public:
+    explicit JobWatcher(const std::filesystem::path &root, double refresh) : root(root), refresh(refresh) {}
+    ~JobWatcher();
+
+    void run();
+
+private:
+    std::filesystem::path root;
+    double refresh; // s
+    int inotifyFd = -1;
+    std::map<int, std::filesystem::path> watches; // step directories by watch descriptor
+    std::map<std::string, WatchedFile> files;
+    std::set<std::string> dirty;
+    std::map<unsigned int, WatchedStep> steps;
+
+    void scan();
+    void watch_step(const std::filesystem::path &dir);
+    void drain_events();
+    void update(WatchedFile &file);
+    bool open(WatchedFile &file);
+    void render(OutputBuffer &out);
+};
+
+volatile sig_atomic_t watch_interrupted = 0;
+
+JobWatcher::~JobWatcher()
+{
+    for (auto &[name, file] : files)
+    {
+        if (file.fd >= 0)
+            close(file.fd);
+    }
+    if (inotifyFd >= 0)
+        close(inotifyFd);
+}
+
+// Step id of a step_<n> directory, false for any other name
+bool parse_step_dir(const std::filesystem::path &dir, unsigned int &step)
+{
+    std::string name = dir.filename().string();
+    if (name.rfind("step_", 0) != 0 || name.size() == 5)
+        return false;
+    char *end = nullptr;
+    step = std::strtoul(name.c_str() + 5, &end, 10);
+    return *end == '\0';
+}
+
+void JobWatcher::watch_step(const std::filesystem::path &dir)
+{
+    int wd = inotify_add_watch(inotifyFd, dir.c_str(), IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (wd < 0)
+    {
+        std::cerr << "WARNING: Unable to watch " << dir << ": " << std::strerror(errno) << std::endl;
+        return;
+    }
+    watches[wd] = dir;
+
+    // Files written before the watch was added
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::directory_iterator(dir, ec))
+    {
+        if (entry.path().extension() == TIMESERIES_EXTENSION)
+            dirty.insert(entry.path().string());
+    }
+}
+
+// Watches the step directories, a step directory on its own or those of a job directory and its new steps
+void JobWatcher::scan()
+{
+    unsigned int stepId;
+    if (parse_step_dir(root, stepId))
+    {
+        watch_step(root);
+        return;
+    }
+
+    int wd = inotify_add_watch(inotifyFd, root.c_str(), IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+    if (wd < 0)
+    {
+        raise_error("Error: Unable to watch \"" + root.string() + "\": " + std::strerror(errno));
+    }
+    watches[wd] = root;
+    for (const auto &entry : std::filesystem::directory_iterator(root))
+    {
+        if (entry.is_directory() && parse_step_dir(entry.path(), stepId))
+            watch_step(entry.path());
+    }
+}
+
+void JobWatcher::drain_events()
+{
+    alignas(struct inotify_event) char buffer[64 * 1024];
+    while (true)
+    {
+        ssize_t n = read(inotifyFd, buffer, sizeof(buffer));
+        if (n <= 0)
+            return;
+
+        for (char *p = buffer; p < buffer + n;)
+        {
+            const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(p);
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                // Events were lost, look at every file again
+                LOG("inotify queue overflow");
+                for (const auto &[name, file] : files)
+                    dirty.insert(name);
+                scan();
+                continue;
+            }
+
+            auto it = watches.find(event->wd);
+            if (it == watches.end() || event->len == 0)
+                continue;
+            std::filesystem::path path = it->second / event->name;
+
+            unsigned int step;
+            if ((event->mask & IN_ISDIR) && it->second == root && parse_step_dir(path, step))
+            {
+                watch_step(path);
+            }
+            else if (path.extension() == TIMESERIES_EXTENSION)
+            {
+                dirty.insert(path.string());
+                if (event->mask & IN_CLOSE_WRITE)
+                    files[path.string()].finished = true;
+            }
+        }
+    }
+}
+
+bool JobWatcher::open(WatchedFile &file)
+{
+    unsigned int stepId;
+    if (!parse_step_dir(file.path.parent_path(), stepId))
+        return false;
+
+    // The header is written right after the file is created, retry on the next change if it is not there yet
+    std::ifstream is(file.path, std::ios::binary);
+    if (!is.is_open() || !file.header.read(is))
+        return false;
+    file.offset = is.tellg();
+
+    file.fd = ::open(file.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file.fd < 0)
+        return false;
+    file.hasHeader = true;
+
+    WatchedStep &step = steps[stepId];
+    step.stepId = stepId;
+    double stallTimeout = std::max(WATCH_STALL_MIN, WATCH_STALL_SAMPLES * file.header.samplingTime / 1e6);
+    for (uint32_t channel : file.header.channels)
+    {
+        if (channel == NODE_CHANNEL)
+        {
+            file.gpus.push_back(-1);
+            continue;
+        }
+
+        auto [it, inserted] = step.index.insert({{file.header.host, channel}, step.gpus.size()});
+        if (inserted)
+        {
+            WatchedGpu gpu;
+            gpu.host = file.header.host;
+            gpu.gpuId = channel;
+            gpu.lastUpdate = WatchClock::now();
+            gpu.stallTimeout = stallTimeout;
+            step.gpus.push_back(gpu);
+        }
+        file.gpus.push_back(it->second);
+    }
+    step.nodes[file.header.host];
+    file.lastTimestamp.assign(file.header.channels.size() * TIMESERIES_FIELDS, std::numeric_limits<int64_t>::min());
+
+    // Only the recent past of a file that has been written for a while is of interest
+    struct stat st;
+    if (fstat(file.fd, &st) != 0)
+        return true;
+
+    // Closed before the view started
+    TimeSeriesFooter footer;
+    if (static_cast<uint64_t>(st.st_size) >= file.offset + sizeof(footer)
+        && pread(file.fd, &footer, sizeof(footer), st.st_size - sizeof(footer)) == sizeof(footer)
+        && std::memcmp(footer.magic, TIMESERIES_FOOTER_MAGIC, 4) == 0)
+    {
+        // The raw samples end where the aggregated levels start
+        file.finished = true;
+        file.limit = footer.rawEnd;
+    }
+
+    if (file.header.samplingTime > 0)
+    {
+        uint64_t perSecond = file.header.channels.size() * TIMESERIES_FIELDS * 1000000 / file.header.samplingTime + 1;
+        uint64_t recent = 2 * WATCH_AVERAGE_WINDOW * perSecond * sizeof(TimeSeriesSample);
+        uint64_t size = std::min(static_cast<uint64_t>(st.st_size), file.limit);
+        if (size > file.offset + recent)
+            file.offset += (size - file.offset - recent) / sizeof(TimeSeriesSample) * sizeof(TimeSeriesSample);
+    }
+    return true;
+}
+
+void JobWatcher::update(WatchedFile &file)
+{
+    if (!file.hasHeader && !open(file))
+        return;
+
+    struct stat st;
+    if (fstat(file.fd, &st) != 0)
+        return;
+    uint64_t size = static_cast<uint64_t>(st.st_size);
+
+    // A closed file ends with the aggregated levels, indexed by the footer
+    if (file.finished && file.limit == UINT64_MAX && size >= sizeof(TimeSeriesFooter))
+    {
+        TimeSeriesFooter footer;
+        if (pread(file.fd, &footer, sizeof(footer), size - sizeof(footer)) == sizeof(footer)
+            && std::memcmp(footer.magic, TIMESERIES_FOOTER_MAGIC, 4) == 0)
+        {
+            file.limit = footer.rawEnd;
+        }
+    }
+
+    unsigned int stepId;
+    parse_step_dir(file.path.parent_path(), stepId);
+    WatchedStep &step = steps[stepId];
+    WatchClock::time_point now = WatchClock::now();
+
+    std::vector<TimeSeriesSample> samples(TimeSeriesReader::CHUNK);
+    uint64_t end = std::min(size, file.limit);
+    while (file.offset + sizeof(TimeSeriesSample) <= end)
+    {
+        size_t n = std::min<uint64_t>(samples.size(), (end - file.offset) / sizeof(TimeSeriesSample));
+        ssize_t got = pread(file.fd, samples.data(), n * sizeof(TimeSeriesSample), file.offset);
+        if (got <= 0)
+            break;
+        n = got / sizeof(TimeSeriesSample);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            const TimeSeriesSample &s = samples[i];
+            size_t key = s.channel * TIMESERIES_FIELDS + s.field;
+            // The samples of a channel only go forward in time: anything else is the
+            // aggregated levels being appended while the file is closed
+            if (s.channel >= file.gpus.size() || s.field >= TIMESERIES_FIELDS || s.timestamp < file.lastTimestamp[key])
+            {
+                file.limit = file.offset;
+                return;
+            }
+            file.lastTimestamp[key] = s.timestamp;
+            file.offset += sizeof(TimeSeriesSample);
+
+            if (file.gpus[s.channel] < 0)
+            {
+                WatchedNode &node = step.nodes[file.header.host];
+                if (s.field == static_cast<uint16_t>(TimeSeriesField::Power) && s.timestamp >= node.lastTimestamp)
+                {
+                    node.power = s.value;
+                    node.lastTimestamp = s.timestamp;
+                }
+                continue;
+            }
+
+            WatchedGpu &gpu = step.gpus[file.gpus[s.channel]];
+            gpu.add(s.field, s.timestamp, s.value);
+            gpu.lastUpdate = now;
+        }
+    }
+
+    if (file.finished)
+    {
+        for (long g : file.gpus)
+        {
+            if (g >= 0)
+                step.gpus[g].finished = true;
+        }
+    }
+}
+
+// Rows of the terminal, to fit the view on one screen
+size_t terminal_rows()
+{
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0)
+        return ws.ws_row;
+    return WATCH_DEFAULT_ROWS;
+}
+
+void JobWatcher::render(OutputBuffer &out)
+{
+    WatchClock::time_point now = WatchClock::now();
+    std::time_t wall = std::time(nullptr);
+    char clock[16];
+    std::strftime(clock, sizeof(clock), "%H:%M:%S", std::localtime(&wall));
+
+    // Clear the screen and go home
+    out.write("\033[H\033[2J");
+    out.write("jobreport watch ");
+    out.write(root.string());
+    out.write("    ");
+    out.write(clock);
+    out.write("    refresh ");
+    out.fixed(refresh, 1);
+    out.write(" s\n\n");
+
+    if (steps.empty())
+    {
+        out.write("Waiting for the first step to start...\n");
+        out.flush();
+        return;
+    }
+
+    // The latest step is the one running
+    const WatchedStep &step = steps.rbegin()->second;
+
+    struct NodeRow
+    {
+        std::string host;
+        std::vector<const WatchedGpu *> gpus;
+        size_t nFlagged = 0;
+        double sm = 0;
+    };
+    std::map<std::string, NodeRow> byHost;
+    size_t nRunning = 0, nIdle = 0, nStalled = 0;
+    double totalPower = 0, totalSm = 0;
+    for (const auto &gpu : step.gpus)
+    {
+        NodeRow &row = byHost[gpu.host];
+        row.host = gpu.host;
+        row.gpus.push_back(&gpu);
+        bool stalled = gpu.stalled(now);
+        bool idle = !stalled && gpu.idle();
+        row.nFlagged += stalled || idle;
+        nRunning += !gpu.finished;
+        nStalled += stalled;
+        nIdle += idle;
+        if (!std::isnan(gpu.latest[0]))
+            totalPower += gpu.latest[0];
+        if (!std::isnan(gpu.average[1]))
+            totalSm += gpu.average[1];
+    }
+
+    out.write("Step ");
+    out.integer(step.stepId);
+    out.write(": ");
+    out.integer(byHost.size());
+    out.write(" nodes, ");
+    out.integer(step.gpus.size());
+    out.write(" GPUs (");
+    out.integer(nRunning);
+    out.write(" running, ");
+    out.integer(nIdle);
+    out.write(" idle, ");
+    out.integer(nStalled);
+    out.write(" stalled), GPU power ");
+    out.fixed(totalPower / 1e3, 1);
+    out.write(" kW, average SM utilization ");
+    out.fixed(step.gpus.empty() ? 0 : totalSm / step.gpus.size(), 0);
+    out.write(" %\n\n");
+
+    // Nodes with flagged GPUs first, then the least utilized
+    std::vector<NodeRow> rows;
+    for (auto &[host, row] : byHost)
+    {
+        for (const WatchedGpu *gpu : row.gpus)
+            row.sm += std::isnan(gpu->average[1]) ? 0 : gpu->average[1] / row.gpus.size();
+        rows.push_back(std::move(row));
+    }
+    std::sort(rows.begin(), rows.end(), [](const NodeRow &a, const NodeRow &b) {
+        if (a.nFlagged != b.nFlagged)
+            return a.nFlagged > b.nFlagged;
+        if (a.sm != b.sm)
+            return a.sm < b.sm;
+        return a.host < b.host;
+    });
+
+    // Header, summary and table borders take 10 lines, each node two
+    size_t rowsLeft = terminal_rows();
+    size_t fit = rowsLeft > 12 ? (rowsLeft - 12) / 2 : 1;
+
+    FixedWidthTable table(out, {15, 12, 12, 14, 32, 24});
+    table.rule();
+    table.header({"Host", "Power", "SM Util.\n(1 min)", "Mem BW Util.\n(1 min)", "SM Util. per GPU\n(latest)", "Status"});
+    table.rule();
+    Cell cells[6];
+    std::string_view views[6];
+    for (size_t r = 0; r < rows.size() && r < fit; ++r)
+    {
+        const NodeRow &row = rows[r];
+        for (auto &cell : cells)
+            cell.clear();
+
+        double gpuPower = 0, mem = 0;
+        bool finished = true;
+        std::string flagged;
+        for (const WatchedGpu *gpu : row.gpus)
+        {
+            gpuPower += std::isnan(gpu->latest[0]) ? 0 : gpu->latest[0];
+            mem += std::isnan(gpu->average[2]) ? 0 : gpu->average[2] / row.gpus.size();
+            finished &= gpu->finished;
+
+            if (cells[4].size > 0)
+                cells[4].append(" ");
+            if (std::isnan(gpu->latest[1]))
+                cells[4].append("-");
+            else
+                cells[4].integer(static_cast<int>(gpu->latest[1]));
+
+            const char *flag = gpu->stalled(now) ? "stalled" : gpu->idle() ? "idle" : nullptr;
+            if (flag != nullptr)
+            {
+                cells[4].append("!");
+                flagged += (flagged.empty() ? "" : ", ") + std::string(flag) + " " + std::to_string(gpu->gpuId);
+            }
+        }
+
+        // The node power counter where there is one, the sum of the GPUs otherwise
+        auto node = step.nodes.find(row.host);
+        double power = node != step.nodes.end() && !std::isnan(node->second.power) ? node->second.power : gpuPower;
+
+        cells[0].append(row.host);
+        cells[1].fixed(power, 0).append(" W");
+        cells[2].fixed(row.sm, 0).append(" %");
+        cells[3].fixed(mem, 0).append(" %");
+        cells[5].append(!flagged.empty() ? std::string_view(flagged) : finished ? "finished" : "running");
+        for (size_t c = 0; c < 6; ++c)
+            views[c] = cells[c].view();
+        table.row(views);
+        table.rule();
+    }
+    if (rows.size() > fit)
+    {
+        out.write("... ");
+        out.integer(rows.size() - fit);
+        out.write(" more nodes\n");
+    }
+    out.write("! idle: SM utilization below ");
+    out.fixed(WATCH_IDLE_THRESHOLD, 0);
+    out.write(" % over the last minute, stalled: no sample for ");
+    out.integer(WATCH_STALL_SAMPLES);
+    out.write(" sampling periods\n");
+    out.flush();
+}
+
+void JobWatcher::run()
+{
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0)
+    {
+        raise_error("Error: Unable to initialize inotify: " + std::string(std::strerror(errno)));
+    }
+
+    scan();
+
+    struct sigaction action = {};
+    action.sa_handler = [](int) { watch_interrupted = 1; };
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    OutputBuffer out(std::cout);
+    auto period = std::chrono::duration_cast<WatchClock::duration>(std::chrono::duration<double>(refresh));
+    WatchClock::time_point next = WatchClock::now();
+    while (!watch_interrupted)
+    {
+        WatchClock::time_point now = WatchClock::now();
+        if (now >= next)
+        {
+            // Only the files that changed since the previous refresh are read
+            for (const auto &name : dirty)
+            {
+                WatchedFile &file = files[name];
+                file.path = name;
+                update(file);
+            }
+            dirty.clear();
+            render(out);
+
+            next += period;
+            if (next < now)
+                next = now + period;
+            continue;
+        }
+
+        struct pollfd pfd = {inotifyFd, POLLIN, 0};
+        int timeout = std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count() + 1;
+        if (poll(&pfd, 1, timeout) > 0)
+            drain_events();
+    }
+    out.write("\n");
+}
+
+void watch_job(const std::string &input, double refresh)
+{
+    std::filesystem::path root = std::filesystem::absolute(input).lexically_normal();
+    if (root.filename().empty())
+        root = root.parent_path();
+    if (!std::filesystem::is_directory(root))
+    {
+        raise_error("Error: Not a directory: \"" + input + "\"");
+    }
+
+    JobWatcher watcher(root, refresh);
+    watcher.run();
+}
+
+#endif // JOBREPORT_WATCH_HPP
@@ -0,0 +1,389 @@
+/*
+    jobreport_bench: benchmark of the analysis pipeline of print.
+
+    Every case is a synthetic job (synth.hpp), loaded as print loads it
+    with the summary cache bypassed, in separately timed stages:
+
+        scan    list the steps, and the files of the steps without manifest
+        parse   read the CSV files into DataFrames
+        sort    order the rows by host and GPU id
+        reduce  step averages and load imbalance
+        render  the print report, into a discarded stream
+
+    Each stage reports its wall and CPU time over all steps of the job,
+    its throughput and the peak resident memory of the process during the
+    stage. The json and csv formats are versioned by BENCH_SCHEMA, so that
+    results of different releases can be compared.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <limits>
+#include <filesystem>
+#include <cstdlib>
+#include <ctime>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "args.hpp"
+#include "dataframe.hpp"
+#include "dataframe_io.hpp"
+#include "imbalance.hpp"
+#include "synth.hpp"
+#include "third_party/tabulate/tabulate.hpp"
+
+#define BENCH_SCHEMA "jobreport-bench/1"
+
+struct StageResult
+{
+    std::string name;
+    double wall = std::numeric_limits<double>::infinity(); // seconds, fastest run
+    double cpu = 0;                                         // seconds, of the fastest run
+    uint64_t files = 0;
+    uint64_t rows = 0;
+    uint64_t bytes = 0;
+    uint64_t peakRss = 0; // bytes, highest of all runs
+};
+
+struct CaseResult
+{
+    unsigned int ranks;
+    unsigned int steps;
+    std::vector<StageResult> stages;
+};
+
+// Stream that discards its output, to render without terminal or file I/O
+class NullBuffer : public std::streambuf
+{
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char *, std::streamsize n) override { return n; }
+};
+
+double cpu_seconds()
+{
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Resets the peak resident set size to the current one, false if the kernel cannot
+bool reset_peak_rss()
+{
+    std::ofstream ofs("/proc/self/clear_refs");
+    ofs << "5";
+    ofs.close();
+    return static_cast<bool>(ofs);
+}
+
+// Peak resident set size in bytes, since the last reset
+uint64_t peak_rss()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+        {
+            return std::stoull(line.substr(6)) * 1024;
+        }
+    }
+
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+}
+
+// Times `run` as one stage of `result`, keeping the fastest run
+template <typename F>
+void time_stage(StageResult &result, F &&run)
+{
+    reset_peak_rss();
+    double cpu = cpu_seconds();
+    auto start = std::chrono::steady_clock::now();
+
+    run();
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    cpu = cpu_seconds() - cpu;
+    if (wall < result.wall)
+    {
+        result.wall = wall;
+        result.cpu = cpu;
+    }
+    result.peakRss = std::max(result.peakRss, peak_rss());
+}
+
+// Runs the stages on the job in `root`, adding their times to `stages`
+void run_pipeline(const std::filesystem::path &root, std::vector<StageResult> &stages)
+{
+    StageResult &scan = stages[0], &parse = stages[1], &sort = stages[2], &reduce = stages[3], &render = stages[4];
+
+    std::vector<StepFiles> steps;
+    std::vector<std::vector<std::filesystem::path>> files;
+    time_stage(scan, [&]() {
+        steps = list_steps(root.string());
+        files.resize(steps.size());
+        for (size_t s = 0; s < steps.size(); ++s)
+        {
+            if (steps[s].records.empty())
+                files[s] = list_step_files(steps[s].dir);
+        }
+    });
+
+    // Counted outside of the stages, which must not stat the files for it
+    uint64_t nFiles = 0, nBytes = 0;
+    for (size_t s = 0; s < steps.size(); ++s)
+    {
+        for (const auto &record : steps[s].records)
+            nBytes += record.fileSize;
+        for (const auto &file : files[s])
+            nBytes += std::filesystem::file_size(file);
+        nFiles += steps[s].records.empty() ? files[s].size() : steps[s].records.size();
+    }
+
+    std::vector<StepReport> reports(steps.size());
+    std::vector<std::vector<DataFrameBlock>> blocks(steps.size());
+    time_stage(parse, [&]() {
+        for (size_t s = 0; s < steps.size(); ++s)
+        {
+            reports[s].df = steps[s].records.empty() ? read_step_files(steps[s].dir, files[s], blocks[s])
+                                                     : read_step_files(steps[s], blocks[s]);
+        }
+    });
+
+    uint64_t nRows = 0;
+    for (const auto &report : reports)
+        nRows += report.df.gpuId.size();
+
+    time_stage(sort, [&]() {
+        for (size_t s = 0; s < steps.size(); ++s)
+            reports[s].df.sort_by_gpu_id(std::move(blocks[s]));
+    });
+
+    time_stage(reduce, [&]() {
+        for (auto &report : reports)
+        {
+            report.avg = report.df.average();
+            report.imbalance = compute_imbalance(report.df);
+        }
+    });
+
+    NullBuffer null;
+    std::ostream os(&null);
+    time_stage(render, [&]() {
+        for (const auto &report : reports)
+            write_job_stats(os, report);
+    });
+
+    scan.files = nFiles;
+    parse.files = nFiles;
+    parse.bytes = nBytes;
+    for (StageResult *stage : {&parse, &sort, &reduce, &render})
+        stage->rows = nRows;
+}
+
+CaseResult run_case(const BenchCmdArgs &args, const BenchCmdArgs::Case &c, const std::filesystem::path &dir)
+{
+    CaseResult result{c.ranks, c.steps, {}};
+    for (const char *name : {"scan", "parse", "sort", "reduce", "render"})
+    {
+        StageResult stage;
+        stage.name = name;
+        result.stages.push_back(stage);
+    }
+
+    // 4 ranks of one GPU per node, rounded up to whole nodes
+    SynthOptions options;
+    options.ranksPerNode = std::min(c.ranks, 4u);
+    options.gpusPerNode = options.ranksPerNode;
+    options.nodes = (c.ranks + options.ranksPerNode - 1) / options.ranksPerNode;
+    options.steps = c.steps;
+    options.consolidate = args.consolidate;
+    options.manifest = !args.no_manifest;
+
+    std::filesystem::path root = dir / ("job_" + std::to_string(c.ranks) + "x" + std::to_string(c.steps));
+    std::filesystem::remove_all(root);
+    std::cerr << "Generating " << root.string() << " (" << options.nodes * options.ranksPerNode << " ranks, "
+              << c.steps << " steps)" << std::endl;
+    write_synthetic_job(root, options);
+
+    for (int run = 0; run < args.repeat; ++run)
+    {
+        run_pipeline(root, result.stages);
+    }
+
+    if (!args.keep)
+    {
+        std::filesystem::remove_all(root);
+    }
+    return result;
+}
+
+std::string format_rate(double count, double seconds, const char *unit)
+{
+    if (count == 0 || seconds <= 0)
+        return "-";
+
+    const char *prefixes[] = {"", "k", "M", "G"};
+    double rate = count / seconds;
+    int p = 0;
+    while (rate >= 1000 && p < 3)
+    {
+        rate /= 1000;
+        p++;
+    }
+    char formatted[48];
+    snprintf(formatted, sizeof(formatted), "%.1f %s%s/s", rate, prefixes[p], unit);
+    return formatted;
+}
+
+void write_table(std::ostream &os, const std::vector<CaseResult> &results)
+{
+    tabulate::Table table;
+    table.add_row({"Ranks", "Steps", "Stage", "Time", "CPU Time", "Files", "Rows", "Throughput", "Peak RSS"});
+    for (const auto &result : results)
+    {
+        for (const auto &stage : result.stages)
+        {
+            char wall[32], cpu[32];
+            snprintf(wall, sizeof(wall), "%.3f s", stage.wall);
+            snprintf(cpu, sizeof(cpu), "%.3f s", stage.cpu);
+            std::string throughput = stage.bytes > 0   ? format_rate(stage.bytes, stage.wall, "B")
+                                     : stage.rows > 0  ? format_rate(stage.rows, stage.wall, "rows")
+                                                       : format_rate(stage.files, stage.wall, "files");
+            table.add_row(tabulate::Table::Row_t{
+                std::to_string(result.ranks),
+                std::to_string(result.steps),
+                stage.name,
+                wall,
+                cpu,
+                stage.files > 0 ? std::to_string(stage.files) : "-",
+                stage.rows > 0 ? std::to_string(stage.rows) : "-",
+                throughput,
+                format_bytes(stage.peakRss)});
+        }
+    }
+
+    table.format()
+        .border_top("-")
+        .border_bottom("-")
+        .border_left("|")
+        .border_right("|")
+        .corner("+");
+
+    os << table << std::endl;
+}
+
+void write_json(std::ostream &os, const std::vector<CaseResult> &results, const BenchCmdArgs &args)
+{
+    os << std::fixed << std::setprecision(6)
+       << "{\"schema\":\"" BENCH_SCHEMA "\",\"repeat\":" << args.repeat
+       << ",\"consolidate\":" << (args.consolidate ? "true" : "false")
+       << ",\"manifest\":" << (args.no_manifest ? "false" : "true") << ",\"cases\":[";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const CaseResult &result = results[i];
+        os << (i > 0 ? "," : "") << "{\"ranks\":" << result.ranks << ",\"steps\":" << result.steps << ",\"stages\":[";
+        for (size_t j = 0; j < result.stages.size(); ++j)
+        {
+            const StageResult &stage = result.stages[j];
+            os << (j > 0 ? "," : "") << "{\"stage\":\"" << stage.name << "\""
+               << ",\"wall_s\":" << stage.wall
+               << ",\"cpu_s\":" << stage.cpu
+               << ",\"files\":" << stage.files
+               << ",\"rows\":" << stage.rows
+               << ",\"bytes\":" << stage.bytes
+               << ",\"files_per_s\":" << (stage.wall > 0 ? stage.files / stage.wall : 0)
+               << ",\"rows_per_s\":" << (stage.wall > 0 ? stage.rows / stage.wall : 0)
+               << ",\"bytes_per_s\":" << (stage.wall > 0 ? stage.bytes / stage.wall : 0)
+               << ",\"peak_rss_bytes\":" << stage.peakRss << "}";
+        }
+        os << "]}";
+    }
+    os << "]}" << std::endl;
+}
+
+void write_csv(std::ostream &os, const std::vector<CaseResult> &results)
+{
+    os << std::fixed << std::setprecision(6)
+       << "schema,ranks,steps,stage,wall_s,cpu_s,files,rows,bytes,files_per_s,rows_per_s,bytes_per_s,peak_rss_bytes"
+       << std::endl;
+    for (const auto &result : results)
+    {
+        for (const auto &stage : result.stages)
+        {
+            os << BENCH_SCHEMA << ',' << result.ranks << ',' << result.steps << ',' << stage.name << ','
+               << stage.wall << ',' << stage.cpu << ','
+               << stage.files << ',' << stage.rows << ',' << stage.bytes << ','
+               << (stage.wall > 0 ? stage.files / stage.wall : 0) << ','
+               << (stage.wall > 0 ? stage.rows / stage.wall : 0) << ','
+               << (stage.wall > 0 ? stage.bytes / stage.wall : 0) << ','
+               << stage.peakRss << std::endl;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    BenchCmdArgs args;
+    if (args.parse(argc, argv) != Status::Success)
+    {
+        args.help();
+        return 1;
+    }
+
+    if (!reset_peak_rss())
+    {
+        std::cerr << "WARNING: Cannot reset the peak memory of the process, "
+                  << "the peak RSS of each stage includes the stages before it" << std::endl;
+    }
+
+    // Synthetic jobs go to a private temporary directory unless given one
+    std::filesystem::path dir = args.dir;
+    bool temporary = dir.empty();
+    if (temporary)
+    {
+        std::string tmpl = (std::filesystem::temp_directory_path() / "jobreport_bench_XXXXXX").string();
+        if (mkdtemp(tmpl.data()) == nullptr)
+        {
+            raise_error("Error: Could not create a temporary directory in " + std::filesystem::temp_directory_path().string());
+        }
+        dir = tmpl;
+    }
+    std::filesystem::create_directories(dir);
+
+    std::vector<CaseResult> results;
+    for (const auto &c : args.cases)
+    {
+        results.push_back(run_case(args, c, dir));
+    }
+
+    if (temporary && !args.keep)
+    {
+        std::filesystem::remove_all(dir);
+    }
+
+    std::ofstream ofs;
+    if (!args.output.empty())
+    {
+        ofs.open(args.output);
+        if (!ofs.is_open())
+        {
+            raise_error("Error: Could not open output file: \"" + args.output + "\"");
+        }
+    }
+    std::ostream &os = args.output.empty() ? std::cout : ofs;
+
+    if (args.format == "json")
+        write_json(os, results, args);
+    else if (args.format == "csv")
+        write_csv(os, results);
+    else
+        write_table(os, results);
+
+    return 0;
+}
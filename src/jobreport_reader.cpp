@@ -0,0 +1,281 @@
+/*
+    libjobreport_reader: the report loader of `jobreport print` behind the
+    C API of jobreport_reader.h.
+
+    The library is built with JOBREPORT_LIBRARY, which makes raise_error
+    throw instead of exiting: every entry point catches the exception and
+    keeps its message for jobreport_last_error().
+*/
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <memory>
+#include <algorithm>
+#include <exception>
+#include <new>
+
+#include "jobreport_reader.h"
+#include "dataframe.hpp"
+#include "dataframe_io.hpp"
+
+struct jobreport_job
+{
+    std::vector<StepFiles> steps;
+    std::vector<std::string> paths;
+};
+
+struct jobreport_step
+{
+    DataFrame df;
+    DataFrameAvg avg;
+};
+
+namespace
+{
+
+thread_local std::string last_error;
+
+struct ColumnInfo
+{
+    const char *name;
+    jobreport_column_type type;
+};
+
+// Columns of the DataFrame, in the order of the CSV files
+const ColumnInfo COLUMNS[] = {
+    {"user", JOBREPORT_COLUMN_STRING},
+    {"account", JOBREPORT_COLUMN_STRING},
+    {"jobId", JOBREPORT_COLUMN_UINT32},
+    {"stepId", JOBREPORT_COLUMN_UINT32},
+    {"nNodes", JOBREPORT_COLUMN_UINT32},
+    {"host", JOBREPORT_COLUMN_STRING},
+    {"gpuId", JOBREPORT_COLUMN_UINT32},
+    {"powerUsageMin", JOBREPORT_COLUMN_DOUBLE},
+    {"powerUsageMax", JOBREPORT_COLUMN_DOUBLE},
+    {"powerUsageAvg", JOBREPORT_COLUMN_DOUBLE},
+    {"startTime", JOBREPORT_COLUMN_INT64},
+    {"endTime", JOBREPORT_COLUMN_INT64},
+    {"smUtilizationMin", JOBREPORT_COLUMN_INT32},
+    {"smUtilizationMax", JOBREPORT_COLUMN_INT32},
+    {"smUtilizationAvg", JOBREPORT_COLUMN_INT32},
+    {"memoryUtilizationMin", JOBREPORT_COLUMN_INT32},
+    {"memoryUtilizationMax", JOBREPORT_COLUMN_INT32},
+    {"memoryUtilizationAvg", JOBREPORT_COLUMN_INT32},
+    {"maxAllocatedMemory", JOBREPORT_COLUMN_INT64},
+    {"energyConsumed", JOBREPORT_COLUMN_DOUBLE},
+};
+constexpr size_t N_COLUMNS = sizeof(COLUMNS) / sizeof(COLUMNS[0]);
+
+// Storage of a column, nullptr for an unknown name
+const void *column_data(const DataFrame &df, const std::string &name)
+{
+    if (name == "jobId") return df.jobId.data();
+    if (name == "stepId") return df.stepId.data();
+    if (name == "nNodes") return df.nNodes.data();
+    if (name == "gpuId") return df.gpuId.data();
+    if (name == "powerUsageMin") return df.powerUsageMin.data();
+    if (name == "powerUsageMax") return df.powerUsageMax.data();
+    if (name == "powerUsageAvg") return df.powerUsageAvg.data();
+    if (name == "startTime") return df.startTime.data();
+    if (name == "endTime") return df.endTime.data();
+    if (name == "smUtilizationMin") return df.smUtilizationMin.data();
+    if (name == "smUtilizationMax") return df.smUtilizationMax.data();
+    if (name == "smUtilizationAvg") return df.smUtilizationAvg.data();
+    if (name == "memoryUtilizationMin") return df.memoryUtilizationMin.data();
+    if (name == "memoryUtilizationMax") return df.memoryUtilizationMax.data();
+    if (name == "memoryUtilizationAvg") return df.memoryUtilizationAvg.data();
+    if (name == "maxAllocatedMemory") return df.maxAllocatedMemory.data();
+    if (name == "energyConsumed") return df.energyConsumed.data();
+    return nullptr;
+}
+
+const DFColumn<std::string> *string_column(const DataFrame &df, const std::string &name)
+{
+    if (name == "host") return &df.host;
+    if (name == "user") return &df.user;
+    if (name == "account") return &df.account;
+    return nullptr;
+}
+
+// Runs f, returning `error` and keeping the message if it throws
+template <typename F, typename R>
+R guard(F &&f, R error)
+{
+    try
+    {
+        return f();
+    }
+    catch (const std::exception &e)
+    {
+        last_error = e.what();
+    }
+    catch (...)
+    {
+        last_error = "Unknown error";
+    }
+    return error;
+}
+
+} // namespace
+
+extern "C" {
+
+int jobreport_reader_version(void)
+{
+    return JOBREPORT_READER_VERSION;
+}
+
+const char *jobreport_last_error(void)
+{
+    return last_error.c_str();
+}
+
+jobreport_job *jobreport_open(const char *path)
+{
+    return guard([&]() -> jobreport_job * {
+        if (path == nullptr)
+            raise_error("Error: No path given");
+
+        auto job = std::make_unique<jobreport_job>();
+        job->steps = list_steps(path);
+        for (const auto &step : job->steps)
+            job->paths.push_back(step.dir.string());
+        return job.release();
+    }, static_cast<jobreport_job *>(nullptr));
+}
+
+void jobreport_close(jobreport_job *job)
+{
+    delete job;
+}
+
+size_t jobreport_step_count(const jobreport_job *job)
+{
+    return job != nullptr ? job->steps.size() : 0;
+}
+
+const char *jobreport_step_path(const jobreport_job *job, size_t index)
+{
+    if (job == nullptr || index >= job->paths.size())
+    {
+        last_error = "Error: No such step";
+        return nullptr;
+    }
+    return job->paths[index].c_str();
+}
+
+jobreport_step *jobreport_step_open(const jobreport_job *job, size_t index)
+{
+    return guard([&]() -> jobreport_step * {
+        if (job == nullptr || index >= job->steps.size())
+            raise_error("Error: No such step");
+
+        const StepFiles &files = job->steps[index];
+        if (files.records.empty() && !std::filesystem::is_directory(files.dir))
+            raise_error("Error: Missing step directory: \"" + files.dir.string() + "\"");
+
+        auto step = std::make_unique<jobreport_step>();
+        step->df = load_step(files, step->avg);
+        return step.release();
+    }, static_cast<jobreport_step *>(nullptr));
+}
+
+void jobreport_step_close(jobreport_step *step)
+{
+    delete step;
+}
+
+size_t jobreport_step_rows(const jobreport_step *step)
+{
+    return step != nullptr ? step->df.gpuId.size() : 0;
+}
+
+int jobreport_step_summary(const jobreport_step *step, jobreport_summary *summary, size_t size)
+{
+    if (step == nullptr || summary == nullptr)
+    {
+        last_error = "Error: No step or summary given";
+        return -1;
+    }
+
+    const DataFrameAvg &avg = step->avg;
+    jobreport_summary s;
+    s.job_id = avg.jobId;
+    s.step_id = avg.stepId;
+    s.n_nodes = avg.nNodes;
+    s.n_gpus = avg.nGpus;
+    s.start_time_us = avg.startTime;
+    s.end_time_us = avg.endTime;
+    s.power_total_avg_w = avg.powerUsageAvg;
+    s.energy_j = avg.energyConsumed * 3600.; // from Wh
+    s.sm_util_avg_pct = avg.smUtilizationAvg;
+    s.mem_bw_util_avg_pct = avg.memoryUtilizationAvg;
+    s.max_memory_bytes = avg.maxAllocatedMemory;
+    s.load_imbalance = avg.loadImbalance;
+    s.user = avg.user.c_str();
+    s.account = avg.account.c_str();
+
+    // Callers built against an older, smaller summary only get its fields
+    std::memcpy(summary, &s, std::min(size, sizeof(s)));
+    return 0;
+}
+
+size_t jobreport_column_count(void)
+{
+    return N_COLUMNS;
+}
+
+const char *jobreport_column_name(size_t index)
+{
+    return index < N_COLUMNS ? COLUMNS[index].name : nullptr;
+}
+
+const void *jobreport_step_column(const jobreport_step *step, const char *name, jobreport_column_type *type)
+{
+    if (step == nullptr || name == nullptr)
+    {
+        last_error = "Error: No step or column given";
+        return nullptr;
+    }
+
+    for (const ColumnInfo &column : COLUMNS)
+    {
+        if (std::strcmp(column.name, name) != 0)
+            continue;
+        if (type != nullptr)
+            *type = column.type;
+        if (column.type == JOBREPORT_COLUMN_STRING)
+        {
+            last_error = "Error: Column \"" + std::string(name) + "\" holds strings, use jobreport_step_string()";
+            return nullptr;
+        }
+        return column_data(step->df, name);
+    }
+    last_error = "Error: Unknown column: \"" + std::string(name) + "\"";
+    return nullptr;
+}
+
+const char *jobreport_step_string(const jobreport_step *step, const char *name, size_t row)
+{
+    if (step == nullptr || name == nullptr)
+    {
+        last_error = "Error: No step or column given";
+        return nullptr;
+    }
+
+    const DFColumn<std::string> *column = string_column(step->df, name);
+    if (column == nullptr)
+    {
+        last_error = "Error: Unknown string column: \"" + std::string(name) + "\"";
+        return nullptr;
+    }
+    if (row >= column->size())
+    {
+        last_error = "Error: Row out of range";
+        return nullptr;
+    }
+    return (*column)[row].c_str();
+}
+
+} // extern "C"
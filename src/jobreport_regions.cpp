@@ -0,0 +1,220 @@
+/*
+    Producer side of the region markers, built as libjobreport_regions.
+
+    The shared segment is mapped on the first call, or retried at most
+    once per second until the node root has created it. Each thread
+    then claims a lane, and each (thread, name address) pair interns its
+    name once, so the fast path is a thread-local lookup, a clock read,
+    a slot write and a release store.
+
+    Pops are held back in the lane (region_ring.hpp): a push continuing
+    the held region takes it back with an exchange and records nothing,
+    which keeps a region wrapping a loop body within the lane's budget.
+*/
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "jobreport_regions.h"
+#include "region_ring.hpp"
+
+#define REGION_NAME_CACHE 64 // per thread, a power of two
+#define REGION_OPEN_DEPTH 64  // open regions whose names are tracked, deeper pops are not held
+#define REGION_ATTACH_RETRY 1000000000ull // ns
+
+namespace
+{
+
+struct NameCacheEntry
+{
+    const char *address;
+    uint32_t name;
+};
+
+struct ThreadState
+{
+    RegionLane *lane;
+    bool disabled;  // no lane left for this thread
+    uint32_t depth; // open regions, recorded or not
+    uint32_t open[REGION_OPEN_DEPTH];      // names of the open regions, UINT32_MAX if not recorded
+    uint32_t instances[REGION_OPEN_DEPTH]; // instances continued by each open region
+    bool held;         // a pop of `heldName` at `depth` may be held in the lane
+    uint32_t heldName;
+    NameCacheEntry names[REGION_NAME_CACHE];
+};
+
+std::atomic<RegionRing *> ring{nullptr};
+std::atomic<uint64_t> next_attach{0};
+thread_local ThreadState state;
+
+// The child of a fork has its own pid and must claim its own lane
+void reset_after_fork()
+{
+    state.lane = nullptr;
+    state.disabled = false;
+    state.depth = 0;
+    state.held = false;
+}
+
+RegionRing *attach()
+{
+    RegionRing *r = ring.load(std::memory_order_acquire);
+    if (r != nullptr)
+        return r;
+
+    // The workload may start before the node root created the segment
+    uint64_t next = next_attach.load(std::memory_order_relaxed);
+    if (next == UINT64_MAX)
+        return nullptr;
+    uint64_t now = region_clock();
+    if (now < next || !next_attach.compare_exchange_strong(next, now + REGION_ATTACH_RETRY))
+        return nullptr;
+
+    const char *name = std::getenv(REGION_RING_ENV);
+    if (name == nullptr)
+    {
+        next_attach.store(UINT64_MAX); // not run by jobreport
+        return nullptr;
+    }
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+        return nullptr;
+    void *p = mmap(nullptr, sizeof(RegionRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return nullptr;
+
+    r = static_cast<RegionRing *>(p);
+    // Not initialized yet if the magic is not there
+    uint32_t magic = r->magic.load(std::memory_order_acquire);
+    if (magic != REGION_RING_MAGIC || r->version != REGION_RING_VERSION)
+    {
+        munmap(p, sizeof(RegionRing));
+        if (magic != 0)
+            next_attach.store(UINT64_MAX);
+        return nullptr;
+    }
+
+    RegionRing *expected = nullptr;
+    if (!ring.compare_exchange_strong(expected, r))
+    {
+        munmap(p, sizeof(RegionRing));
+        return expected;
+    }
+    pthread_atfork(nullptr, nullptr, reset_after_fork);
+    return r;
+}
+
+RegionLane *lane()
+{
+    if (state.lane != nullptr || state.disabled)
+        return state.lane;
+
+    RegionRing *r = attach();
+    if (r == nullptr)
+        return nullptr;
+
+    uint32_t index = r->nLanes.fetch_add(1, std::memory_order_relaxed);
+    if (index >= REGION_RING_LANES)
+    {
+        state.disabled = true;
+        return nullptr;
+    }
+    state.lane = &r->lanes[index];
+    state.lane->pid.store(getpid(), std::memory_order_release);
+    return state.lane;
+}
+
+// Index of `name` in the shared table, UINT32_MAX if the table is full
+uint32_t intern(const char *name)
+{
+    NameCacheEntry &entry = state.names[(reinterpret_cast<uintptr_t>(name) >> 3) & (REGION_NAME_CACHE - 1)];
+    if (entry.address == name)
+        return entry.name;
+
+    uint32_t index = region_ring_intern(*ring.load(std::memory_order_relaxed), name);
+    if (index == UINT32_MAX)
+        return UINT32_MAX;
+
+    entry = NameCacheEntry{name, index};
+    return index;
+}
+
+// Takes back the pop held in the lane, 0 if the collector recorded it already
+uint64_t take_held(RegionLane &l)
+{
+    if (!state.held)
+        return 0;
+    state.held = false;
+    return l.held.exchange(0, std::memory_order_acquire);
+}
+
+} // namespace
+
+extern "C" int jobreport_region_push(const char *name)
+{
+    uint32_t depth = state.depth++;
+    if (depth < REGION_OPEN_DEPTH)
+        state.open[depth] = UINT32_MAX;
+    RegionLane *l = lane();
+    if (l == nullptr)
+        return -1;
+
+    uint32_t index = name != nullptr ? intern(name) : UINT32_MAX;
+    uint32_t heldName = state.heldName;
+    uint64_t held = take_held(*l);
+    uint64_t now = region_clock();
+    if (held != 0)
+    {
+        // Pushed again right after its pop: the held region goes on
+        if (index == heldName && index != UINT32_MAX && now - held < REGION_HOLD_GAP)
+        {
+            state.open[depth] = index;
+            state.instances[depth]++;
+            return 0;
+        }
+        region_ring_record(*l, RegionPop, state.instances[depth], depth, held);
+    }
+
+    if (index == UINT32_MAX)
+        return -1;
+    if (depth < REGION_OPEN_DEPTH)
+    {
+        state.open[depth] = index;
+        state.instances[depth] = 1;
+    }
+    return region_ring_record(*l, RegionPush, index, depth, now);
+}
+
+extern "C" int jobreport_region_pop(void)
+{
+    if (state.depth == 0)
+        return -1;
+    uint32_t depth = --state.depth;
+    RegionLane *l = lane();
+    if (l == nullptr)
+        return -1;
+
+    // The pop of a nested region held until now is recorded first
+    uint64_t held = take_held(*l);
+    if (held != 0)
+        region_ring_record(*l, RegionPop, state.instances[depth + 1], depth + 1, held);
+
+    if (depth >= REGION_OPEN_DEPTH || state.open[depth] == UINT32_MAX)
+        return region_ring_record(*l, RegionPop, 1, depth);
+
+    state.held = true;
+    state.heldName = state.open[depth];
+    l->heldDepth.store(depth, std::memory_order_relaxed);
+    l->heldInstances.store(state.instances[depth], std::memory_order_relaxed);
+    l->held.store(region_clock(), std::memory_order_release);
+    return 0;
+}
@@ -4,30 +4,208 @@
 #include <string>
 #include <memory>
 #include <filesystem>
+#include <chrono>
+#include <iomanip>
 
 #include "macros.hpp"
 #include "args.hpp" // Argument parsers
+#ifdef JOBREPORT_WITH_DCGM
 #include "jobreport.hpp"
+#endif
 #include "dataframe.hpp"
 #include "dataframe_io.hpp"
+#include "export.hpp"
+#include "history.hpp"
+#include "diff.hpp"
+#include "watch.hpp"
+#include "control_socket.hpp"
+#include "synth.hpp"
 
 void main_cmd(const MainCmdArgs &args)
 {
+#ifndef JOBREPORT_WITH_DCGM
+    (void)args;
+    raise_error("Error: This jobreport was built without DCGM (JOBREPORT_WITH_DCGM=OFF) and can only analyze reports");
+#else
     JobReport jr(
         args.output,
         args.sampling_time,
         args.max_time,
         args.ignore_gpu_binding,
         args.verbose,
-        args.force
+        args.force,
+        args.consolidate,
+        args.metrics_textfile,
+        args.history
         );
     jr.run(args.cmd);
+#endif
 }
 
 void print_cmd(const PrintCmdArgs &args)
 {
+    PrintOptions options;
+    options.resolution = static_cast<long long>(args.resolution * 1e6);
+    options.heatmap = parse_heatmap_metric(args.heatmap);
+
+    std::stringstream where(args.where);
+    std::string expr;
+    while (std::getline(where, expr, ','))
+    {
+        RowFilter filter;
+        if (!parse_filter(expr, filter))
+        {
+            raise_error("Error: Invalid filter: \"" + expr + "\"");
+        }
+        options.selection.where.push_back(filter);
+    }
+
+    options.selection.sortBy = args.sort_by;
+    size_t colon = args.sort_by.find(':');
+    if (colon != std::string::npos)
+    {
+        options.selection.sortBy = args.sort_by.substr(0, colon);
+        std::string direction = args.sort_by.substr(colon + 1);
+        if (direction != "desc" && direction != "asc")
+        {
+            raise_error("Error: Invalid sort direction: \"" + direction + "\"");
+        }
+        options.selection.descending = direction == "desc";
+    }
+    if (!options.selection.sortBy.empty() && !visit_column(DataFrame(), options.selection.sortBy, [](const auto &) {}))
+    {
+        raise_error("Error: Unknown column: \"" + options.selection.sortBy + "\"");
+    }
+
+    options.selection.top = static_cast<size_t>(args.top);
+
+    bool profile = args.profile || !args.profile_trace.empty();
+#ifdef JOBREPORT_PROFILING
+    if (profile)
+    {
+        profile_enable();
+    }
+#else
+    if (profile)
+    {
+        std::cerr << "WARNING: This jobreport was built without profiling (JOBREPORT_PROFILING=OFF), "
+                  << "ignoring --profile" << std::endl;
+    }
+#endif
+
     // Load data into DataFrame
-    process_stats(args.input, args.output);
+    process_stats(args.input, args.output, options);
+
+#ifdef JOBREPORT_PROFILING
+    // On stderr, not to mix with a report on stdout
+    if (args.profile)
+    {
+        write_profile_table(std::cerr);
+    }
+    if (!args.profile_trace.empty())
+    {
+        std::ofstream ofs(args.profile_trace);
+        write_profile_trace(ofs);
+        if (!ofs)
+        {
+            raise_error("Error: Could not write the profile to \"" + args.profile_trace + "\"");
+        }
+        std::cerr << "Profile written to: \"" << args.profile_trace << "\"" << std::endl;
+    }
+#endif
+}
+
+void export_cmd(const ExportCmdArgs &args)
+{
+    ExportFormat format = ExportFormat::Ndjson;
+    if (args.format == "json")
+    {
+        format = ExportFormat::Json;
+    }
+    else if (args.format == "csv")
+    {
+        format = ExportFormat::Csv;
+    }
+
+    export_stats(args.inputs, args.output, format);
+}
+
+void synth_cmd(const SynthCmdArgs &args)
+{
+    SynthOptions options;
+    options.nodes = args.nodes;
+    options.gpusPerNode = args.gpus_per_node;
+    options.ranksPerNode = args.ranks_per_node;
+    options.steps = args.steps;
+    options.threads = args.threads;
+    options.timeseries = args.timeseries;
+    options.duration = args.duration;
+    options.samplingTime = args.sampling_time;
+    options.consolidate = args.consolidate;
+    options.manifest = !args.no_manifest;
+    options.seed = args.seed;
+    options.jobId = args.job_id;
+    options.distribution.idle = args.idle;
+    options.distribution.stragglers = args.stragglers;
+    options.distribution.throttled = args.throttled;
+    options.distribution.nanPower = args.nan_power;
+
+    auto start = std::chrono::steady_clock::now();
+    write_synthetic_job(args.output, options);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Wrote " << args.steps << " steps of " << args.nodes * args.ranks_per_node << " ranks and "
+              << args.nodes * args.gpus_per_node << " GPUs to " << args.output << " in " << std::fixed
+              << std::setprecision(1) << elapsed << " s" << std::endl;
+}
+
+void archive_cmd(const ArchiveCmdArgs &args)
+{
+    archive_steps(history_store(args.store), args.inputs);
+}
+
+void query_cmd(const QueryCmdArgs &args)
+{
+    HistoryQuery query;
+    query.groupBy = args.group_by;
+
+    std::stringstream where(args.where);
+    std::string expr;
+    while (std::getline(where, expr, ','))
+    {
+        RowFilter filter;
+        if (!parse_history_filter(expr, filter))
+        {
+            raise_error("Error: Invalid filter: \"" + expr + "\"");
+        }
+        query.where.push_back(filter);
+    }
+
+    if (!args.since.empty() && !parse_history_time(args.since, query.since))
+    {
+        raise_error("Error: Invalid time: \"" + args.since + "\"");
+    }
+    if (!args.until.empty() && !parse_history_time(args.until, query.until))
+    {
+        raise_error("Error: Invalid time: \"" + args.until + "\"");
+    }
+
+    query_history(history_store(args.store), query);
+}
+
+void status_cmd(const StatusCmdArgs &args)
+{
+    query_status(args.target);
+}
+
+void watch_cmd(const WatchCmdArgs &args)
+{
+    watch_job(args.input, args.refresh);
+}
+
+void diff_cmd(const DiffCmdArgs &args)
+{
+    diff_runs(args.inputA, args.inputB, args.output);
 }
 
 void hook_cmd(const HookCmdArgs &args)
@@ -124,6 +302,76 @@ int main(int argc, char **argv)
         }
         print_cmd(print_args);
     }
+    else if (cmd == "export")
+    {
+        ExportCmdArgs export_args;
+        if (export_args.parse(argc, argv) != Status::Success)
+        {
+            export_args.help();
+            return 1;
+        }
+        export_cmd(export_args);
+    }
+    else if (cmd == "synth")
+    {
+        SynthCmdArgs synth_args;
+        if (synth_args.parse(argc, argv) != Status::Success)
+        {
+            synth_args.help();
+            return 1;
+        }
+        synth_cmd(synth_args);
+    }
+    else if (cmd == "archive")
+    {
+        ArchiveCmdArgs archive_args;
+        if (archive_args.parse(argc, argv) != Status::Success)
+        {
+            archive_args.help();
+            return 1;
+        }
+        archive_cmd(archive_args);
+    }
+    else if (cmd == "query")
+    {
+        QueryCmdArgs query_args;
+        if (query_args.parse(argc, argv) != Status::Success)
+        {
+            query_args.help();
+            return 1;
+        }
+        query_cmd(query_args);
+    }
+    else if (cmd == "status")
+    {
+        StatusCmdArgs status_args;
+        if (status_args.parse(argc, argv) != Status::Success)
+        {
+            status_args.help();
+            return 1;
+        }
+        status_cmd(status_args);
+    }
+    else if (cmd == "watch")
+    {
+        WatchCmdArgs watch_args;
+        if (watch_args.parse(argc, argv) != Status::Success)
+        {
+            watch_args.help();
+            return 1;
+        }
+        watch_cmd(watch_args);
+    }
+    else if (cmd == "diff")
+    {
+        DiffCmdArgs diff_args;
+        if (diff_args.parse(argc, argv) != Status::Success)
+        {
+            diff_args.help();
+            return 1;
+        }
+        diff_cmd(diff_args);
+    }
     else if (cmd == "container-hook")
     {
         HookCmdArgs container_hook_args;